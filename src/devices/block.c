@@ -1,9 +1,79 @@
 #include "devices/block.h"
+#include <inttypes.h>
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+
+/* Request queues.
+
+   Each block device that is not part of another one and does
+   not carry out requests by itself (see the "map" and "submit"
+   block operations) has a queue of pending requests (struct
+   bio) and a dispatcher thread that carries them out one after
+   another.  block_submit() adds a request to the queue and
+   returns immediately.  The dispatcher calls the request's
+   completion function once the device is done with it.  The
+   synchronous functions block_read() and friends submit a
+   request and wait for it.
+
+   The queue is kept sorted by sector, and the dispatcher serves
+   it in C-LOOK order: it sweeps from low sectors to high ones,
+   taking the first request at or after the end of the previous
+   one, and jumps back to the lowest request when nothing is
+   left ahead of it.  Requests that continue one another on the
+   disk in the same direction are merged into a single driver
+   call of up to MERGE_MAX sectors, through a merge buffer.
+
+   The dispatcher runs in its own thread, so it cannot reach user
+   memory.  Synchronous transfers to or from user addresses skip
+   the queue and call the driver directly.
+
+   Requests that overlap may be carried out in either order, so
+   a client must wait for one to complete before submitting
+   another that overlaps it, if the order matters. */
+
+/* Maximum number of sectors in a merged request. */
+#define MERGE_MAX 64
+
+/* Request queue of a block device. */
+struct block_queue
+  {
+    struct lock lock;                   /* Protects the members below. */
+    struct condition not_empty;         /* Signaled when requests arrive. */
+    struct list requests;               /* Pending bios, by dev_sector. */
+    block_sector_t next_sector;         /* End of last dispatched request. */
+    uint8_t *merge_buf;                 /* MERGE_MAX sectors, or null. */
+
+    unsigned long long bio_cnt;         /* Requests submitted. */
+    unsigned long long dispatch_cnt;    /* Driver calls made for them. */
+  };
+
+/* Number of buckets in a latency histogram. */
+#define LATENCY_BUCKETS 40
+
+/* Statistics for the reads, or for the writes, on a block
+   device. */
+struct io_stats
+  {
+    unsigned long long sector_cnt;      /* Sectors transferred. */
+    unsigned long long request_cnt;     /* Requests completed. */
+    unsigned long long seq_cnt;         /* Requests that started where
+                                           the previous one ended. */
+    unsigned long long latency[LATENCY_BUCKETS];
+                                        /* Requests by latency: element
+                                           I counts those that took
+                                           2**I to 2**(I+1) - 1 cycles. */
+  };
 
 /* A block device. */
 struct block
@@ -17,8 +87,13 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct io_stats stats[2];           /* Reads, writes. */
+    block_sector_t next_sector;         /* End of the last request. */
+    int depth;                          /* Requests in progress. */
+    int max_depth;                      /* Maximum value of DEPTH. */
+
+    struct block_queue *queue;          /* Request queue, or null. */
+    const void *controller;             /* Controller, or null. */
   };
 
 /* List of all block devices. */
@@ -28,6 +103,21 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t, void *buffer,
+                      block_sector_t cnt, bool write);
+static void create_queue (struct block *);
+static struct block *map_sector (struct block *, block_sector_t *);
+static bio_end_func wake_waiter;
+static thread_func dispatcher NO_RETURN;
+static struct bio *next_request (struct block_queue *);
+static uint64_t start_io (struct block *, block_sector_t, block_sector_t cnt,
+                          bool write);
+static void end_io (struct block *, block_sector_t cnt, bool write,
+                    uint64_t start);
+static void print_io_stats (const char *, const struct io_stats *,
+                            uint64_t cycles_per_sec);
+static bool bio_less (const struct list_elem *, const struct list_elem *,
+                      void *aux);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +203,22 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  if (cnt > 0)
+    {
+      check_sector (block, sector);
+      check_sector (block, sector + (cnt - 1));
+      if (sector + (cnt - 1) < sector)
+        PANIC ("Access past end of device %s (sector=%"PRDSNu", "
+               "count=%"PRDSNu")\n", block_name (block), sector, cnt);
+    }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +226,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, buffer, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +237,174 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
+  block_write_multiple (block, sector, buffer, 1);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for CNT *
+   BLOCK_SECTOR_SIZE bytes.  Drivers that support it do so with
+   a single request, which is much faster than reading the
+   sectors one by one.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, block_sector_t cnt)
+{
+  check_sectors (block, sector, cnt);
+  if (cnt == 0)
+    return;
+  TRACE (TRACE_BLOCK_READ_BEGIN, sector, block->type);
+  if (is_kernel_vaddr (buffer))
+    {
+      struct bio bio;
+      bio_init (&bio, sector, buffer, cnt, false, NULL, NULL);
+      block_submit_wait (block, &bio);
+    }
+  else
+    {
+      uint64_t start = start_io (block, sector, cnt, false);
+      transfer (block, sector, buffer, cnt, false);
+      end_io (block, cnt, false, start);
+    }
+  TRACE (TRACE_BLOCK_READ_END, sector, block->type);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to
+   BLOCK from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE
+   bytes.  Returns after the block device has acknowledged
+   receiving the data.  Drivers that support it do so with a
+   single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  check_sectors (block, sector, cnt);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  if (cnt == 0)
+    return;
+  TRACE (TRACE_BLOCK_WRITE_BEGIN, sector, block->type);
+  if (is_kernel_vaddr (buffer))
+    {
+      struct bio bio;
+      bio_init (&bio, sector, (void *) buffer, cnt, true, NULL, NULL);
+      block_submit_wait (block, &bio);
+    }
+  else
+    {
+      uint64_t start = start_io (block, sector, cnt, true);
+      transfer (block, sector, (void *) buffer, cnt, true);
+      end_io (block, cnt, true, start);
+    }
+  TRACE (TRACE_BLOCK_WRITE_END, sector, block->type);
+}
+
+/* Initializes B as a request to transfer the CNT sectors
+   starting at SECTOR to BUFFER, if WRITE is false, or from
+   BUFFER to the sectors, if WRITE is true.  BUFFER must be in
+   kernel memory and have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   If END is nonnull, it is called when the request completes,
+   and may use AUX, which is otherwise unused. */
+void
+bio_init (struct bio *b, block_sector_t sector, void *buffer,
+          block_sector_t cnt, bool write, bio_end_func *end, void *aux)
+{
+  ASSERT (b != NULL);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  b->sector = sector;
+  b->cnt = cnt;
+  b->buffer = buffer;
+  b->write = write;
+  b->end = end;
+  b->aux = aux;
+}
+
+/* Submits request B to BLOCK and returns without waiting for
+   it.  B's completion function, if any, is called later from a
+   kernel thread, never from an interrupt handler: the queue's
+   dispatcher thread, a thread of the driver's for a device that
+   implements the "submit" operation, or, for a device that
+   finishes requests at once, the caller's.  It must not keep
+   that thread busy for long.  B must remain valid, and its
+   buffer must not be touched, until then.  Must not be called
+   from an interrupt handler. */
+void
+block_submit (struct block *block, struct bio *b)
+{
+  struct block *dev;
+  struct block_queue *q;
+
+  ASSERT (!intr_context ());
+  ASSERT (b->cnt > 0);
+  check_sectors (block, b->sector, b->cnt);
+  ASSERT (!b->write || block->type != BLOCK_FOREIGN);
+
+  b->block = block;
+  b->start = start_io (block, b->sector, b->cnt, b->write);
+  b->dev_sector = b->sector;
+  dev = map_sector (block, &b->dev_sector);
+  if (dev != block)
+    {
+      /* Count the sectors on the underlying device too. */
+      enum intr_level old_level = intr_disable ();
+      dev->stats[b->write].sector_cnt += b->cnt;
+      intr_set_level (old_level);
+    }
+  if (dev->ops->submit != NULL)
+    {
+      dev->ops->submit (dev->aux, b);
+      return;
+    }
+  q = dev->queue;
+  if (q == NULL)
+    {
+      /* No queue: carry out the request right away. */
+      transfer (dev, b->dev_sector, b->buffer, b->cnt, b->write);
+      bio_complete (b);
+      return;
+    }
+
+  lock_acquire (&q->lock);
+  list_insert_ordered (&q->requests, &b->elem, bio_less, NULL);
+  q->bio_cnt++;
+  cond_signal (&q->not_empty, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Submits request B to BLOCK, as block_submit(), and waits for
+   it to complete.  B's completion function and auxiliary data
+   are replaced. */
+void
+block_submit_wait (struct block *block, struct bio *b)
+{
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  b->end = wake_waiter;
+  b->aux = &done;
+  block_submit (block, b);
+  sema_down (&done);
+}
+
+/* Marks request B as complete and calls its completion
+   function.  Called by the block layer and by drivers that
+   implement the "submit" operation. */
+void
+bio_complete (struct bio *b)
+{
+  end_io (b->block, b->cnt, b->write, b->start);
+  if (b->end != NULL)
+    b->end (b);
+}
+
+/* Completion function for block_submit_wait(). */
+static void
+wake_waiter (struct bio *b)
+{
+  sema_up (b->aux);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +428,28 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Returns true if A and B are, or are parts of, devices attached
+   to the same controller, so that I/O to one cannot proceed
+   while the other is busy. */
+bool
+block_share_controller (struct block *a, struct block *b)
+{
+  block_sector_t sector = 0;
+  const void *a_ctl, *b_ctl;
+
+  a = map_sector (a, &sector);
+  b = map_sector (b, &sector);
+  a_ctl = a->controller != NULL ? a->controller : a;
+  b_ctl = b->controller != NULL ? b->controller : b;
+  return a_ctl == b_ctl;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
 {
+  uint64_t cycles_per_sec = timer_cycles_per_sec ();
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -173,7 +459,23 @@ block_print_stats (void)
         {
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->stats[0].sector_cnt, block->stats[1].sector_cnt);
+          print_io_stats ("read", &block->stats[0], cycles_per_sec);
+          print_io_stats ("write", &block->stats[1], cycles_per_sec);
+          if (block->max_depth > 0)
+            printf ("  at most %d requests at once\n", block->max_depth);
+        }
+    }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      struct block_queue *q = block->queue;
+      if (q != NULL && q->bio_cnt > 0)
+        {
+          printf ("%s: %llu requests in %llu transfers\n",
+                  block->name, q->bio_cnt, q->dispatch_cnt);
         }
     }
 }
@@ -198,8 +500,12 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (block->stats, 0, sizeof block->stats);
+  block->next_sector = 0;
+  block->depth = 0;
+  block->max_depth = 0;
+  block->queue = NULL;
+  block->controller = NULL;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -208,8 +514,22 @@ block_register (const char *name, enum block_type type,
     printf (", %s", extra_info);
   printf ("\n");
 
+  if (ops->map == NULL && ops->submit == NULL)
+    create_queue (block);
+
   return block;
 }
+
+/* Records that BLOCK is attached to CONTROLLER, an arbitrary
+   pointer that identifies the controller, such as the driver's
+   own data for it.  Devices with the same CONTROLLER cannot
+   transfer data at the same time.  Devices for which this is
+   never called are assumed to have controllers of their own. */
+void
+block_set_controller (struct block *block, const void *controller)
+{
+  block->controller = controller;
+}
 
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
@@ -221,3 +541,256 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Transfers the CNT sectors starting at SECTOR of BLOCK to
+   BUFFER, if WRITE is false, or from BUFFER to the sectors, if
+   WRITE is true, by calling BLOCK's driver directly. */
+static void
+transfer (struct block *block, block_sector_t sector, void *buffer_,
+          block_sector_t cnt, bool write)
+{
+  uint8_t *buffer = buffer_;
+  const struct block_operations *ops = block->ops;
+  block_sector_t i;
+
+  if (write)
+    {
+      if (ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, sector, buffer, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->write (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, sector, buffer, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->read (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Returns the device at the bottom of BLOCK's stack of "map"
+   operations, translating *SECTOR into a sector on it. */
+static struct block *
+map_sector (struct block *block, block_sector_t *sector)
+{
+  while (block->ops->map != NULL)
+    block = block->ops->map (block->aux, sector);
+  return block;
+}
+
+/* Creates a request queue and dispatcher thread for BLOCK.  If
+   memory is not available, BLOCK does without a queue. */
+static void
+create_queue (struct block *block)
+{
+  struct block_queue *q = malloc (sizeof *q);
+  char name[sizeof block->name + sizeof "-io" - 1];
+
+  if (q == NULL)
+    return;
+
+  lock_init (&q->lock);
+  lock_set_name (&q->lock, block->name);
+  cond_init (&q->not_empty);
+  list_init (&q->requests);
+  q->next_sector = 0;
+  q->merge_buf = palloc_get_multiple (0, DIV_ROUND_UP (MERGE_MAX
+                                                       * BLOCK_SECTOR_SIZE,
+                                                       PGSIZE));
+  q->bio_cnt = 0;
+  q->dispatch_cnt = 0;
+
+  block->queue = q;
+  snprintf (name, sizeof name, "%s-io", block->name);
+  if (thread_create (name, PRI_MAX, dispatcher, block) == TID_ERROR)
+    {
+      block->queue = NULL;
+      palloc_free_multiple (q->merge_buf, DIV_ROUND_UP (MERGE_MAX
+                                                        * BLOCK_SECTOR_SIZE,
+                                                        PGSIZE));
+      free (q);
+    }
+}
+
+/* Dispatcher thread for the request queue of BLOCK_. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+  struct block_queue *q = block->queue;
+
+  for (;;)
+    {
+      struct list batch;
+      struct list_elem *e;
+      struct bio *first, *last;
+      block_sector_t cnt;
+      void *buffer;
+
+      /* Take the next request, and any that it can be merged
+         with, off the queue. */
+      lock_acquire (&q->lock);
+      while (list_empty (&q->requests))
+        cond_wait (&q->not_empty, &q->lock);
+      list_init (&batch);
+      first = last = next_request (q);
+      cnt = first->cnt;
+      e = list_remove (&first->elem);
+      list_push_back (&batch, &first->elem);
+      while (q->merge_buf != NULL && e != list_end (&q->requests))
+        {
+          struct bio *b = list_entry (e, struct bio, elem);
+          if (b->dev_sector != last->dev_sector + last->cnt
+              || b->write != first->write || cnt + b->cnt > MERGE_MAX)
+            break;
+          e = list_remove (&b->elem);
+          list_push_back (&batch, &b->elem);
+          cnt += b->cnt;
+          last = b;
+        }
+      q->next_sector = first->dev_sector + cnt;
+      q->dispatch_cnt++;
+      lock_release (&q->lock);
+
+      /* Carry out the requests with one driver call. */
+      if (first == last)
+        buffer = first->buffer;
+      else
+        {
+          uint8_t *p = buffer = q->merge_buf;
+
+          if (first->write)
+            for (e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct bio *b = list_entry (e, struct bio, elem);
+                memcpy (p, b->buffer, b->cnt * BLOCK_SECTOR_SIZE);
+                p += b->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+      transfer (block, first->dev_sector, buffer, cnt, first->write);
+
+      /* Complete them. */
+      while (!list_empty (&batch))
+        {
+          struct bio *b = list_entry (list_pop_front (&batch),
+                                      struct bio, elem);
+          if (!b->write && buffer != b->buffer)
+            {
+              memcpy (b->buffer, buffer, b->cnt * BLOCK_SECTOR_SIZE);
+              buffer = (uint8_t *) buffer + b->cnt * BLOCK_SECTOR_SIZE;
+            }
+          bio_complete (b);
+        }
+    }
+}
+
+/* Returns the request in Q to carry out next, in C-LOOK order:
+   the first one that starts at or after the end of the last
+   request dispatched or, if there is none, the first one.  Q
+   must not be empty, and its lock must be held. */
+static struct bio *
+next_request (struct block_queue *q)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+  ASSERT (!list_empty (&q->requests));
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct bio *b = list_entry (e, struct bio, elem);
+      if (b->dev_sector >= q->next_sector)
+        return b;
+    }
+  return list_entry (list_front (&q->requests), struct bio, elem);
+}
+
+/* Returns true if request A starts before request B. */
+static bool
+bio_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED)
+{
+  const struct bio *a = list_entry (a_, struct bio, elem);
+  const struct bio *b = list_entry (b_, struct bio, elem);
+
+  return a->dev_sector < b->dev_sector;
+}
+
+/* Records the start of a request to BLOCK for the CNT sectors
+   starting at SECTOR, reading them if WRITE is false or writing
+   them if WRITE is true.  Returns the time, for end_io(). */
+static uint64_t
+start_io (struct block *block, block_sector_t sector, block_sector_t cnt,
+          bool write)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (sector == block->next_sector)
+    block->stats[write].seq_cnt++;
+  block->next_sector = sector + cnt;
+  if (++block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  intr_set_level (old_level);
+
+  return timer_cycles ();
+}
+
+/* Records the end of a request to BLOCK for CNT sectors, which
+   read them if WRITE is false or wrote them if WRITE is true,
+   and which start_io() said started at time START. */
+static void
+end_io (struct block *block, block_sector_t cnt, bool write, uint64_t start)
+{
+  struct io_stats *s = &block->stats[write];
+  uint64_t latency = timer_cycles () - start;
+  enum intr_level old_level;
+  int bucket;
+
+  for (bucket = 0; latency > 1 && bucket < LATENCY_BUCKETS - 1; bucket++)
+    latency >>= 1;
+
+  old_level = intr_disable ();
+  s->sector_cnt += cnt;
+  s->request_cnt++;
+  s->latency[bucket]++;
+  block->depth--;
+  intr_set_level (old_level);
+}
+
+/* Prints S, the statistics for requests of the given KIND, with
+   a histogram of their latencies, converted to microseconds if
+   CYCLES_PER_SEC is nonzero. */
+static void
+print_io_stats (const char *kind, const struct io_stats *s,
+                uint64_t cycles_per_sec)
+{
+  int i;
+
+  if (s->request_cnt == 0)
+    return;
+
+  printf ("  %s: %llu requests, %llu bytes, %llu sequential, "
+          "%llu random; latency in %s:\n",
+          kind, s->request_cnt, s->sector_cnt * BLOCK_SECTOR_SIZE,
+          s->seq_cnt, s->request_cnt - s->seq_cnt,
+          cycles_per_sec != 0 ? "us" : "cycles");
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (s->latency[i] != 0)
+      {
+        uint64_t lo = (uint64_t) 1 << i;
+        uint64_t hi = ((uint64_t) 1 << (i + 1)) - 1;
+
+        if (cycles_per_sec != 0)
+          {
+            lo = lo * 1000000 / cycles_per_sec;
+            hi = hi * 1000000 / cycles_per_sec;
+          }
+        printf ("    %10"PRIu64" to %10"PRIu64": %llu\n",
+                lo, hi, s->latency[i]);
+      }
+}
@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,8 +55,44 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
+bool block_share_controller (struct block *, struct block *);
+
+/* Asynchronous requests. */
+
+struct bio;
+
+/* Called when request B has completed. */
+typedef void bio_end_func (struct bio *b);
+
+/* A request to read or write consecutive sectors, for
+   block_submit().  See block.c for details. */
+struct bio
+  {
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write, false to read. */
+    bio_end_func *end;          /* Completion function, or null. */
+    void *aux;                  /* For END's use. */
+
+    /* Owned by the block layer. */
+    struct list_elem elem;      /* Element in a request queue,
+                                   or a driver's list. */
+    block_sector_t dev_sector;  /* First sector on the queue's device. */
+    struct block *block;        /* Device submitted to. */
+    uint64_t start;             /* timer_cycles() at submission. */
+  };
+
+void bio_init (struct bio *, block_sector_t sector, void *buffer,
+               block_sector_t cnt, bool write, bio_end_func *, void *aux);
+void block_submit (struct block *, struct bio *);
+void block_submit_wait (struct block *, struct bio *);
 
 /* Statistics. */
 void block_print_stats (void);
@@ -65,10 +103,38 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors at once.  Either may be
+       null, in which case read or write is called once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
+
+    /* For a device that is a part of another one, such as a
+       partition: returns the underlying device and translates
+       *SECTOR into a sector on it.  Null for other devices.
+       Requests to a device with this function go into the
+       underlying device's request queue. */
+    struct block *(*map) (void *aux, block_sector_t *sector);
+
+    /* For a device that gains nothing from a request queue,
+       such as a stripe, which passes requests on to other
+       devices, or a RAM disk: carries out request B, whose
+       dev_sector member is the first sector on this device, and
+       arranges for bio_complete() to be called on B once it is
+       done, in a thread rather than an interrupt handler.  Until
+       then, the driver may use B's elem member.  Null for other
+       devices.  A device with this function has no request
+       queue of its own. */
+    void (*submit) (void *aux, struct bio *b);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_controller (struct block *, const void *controller);
+void bio_complete (struct bio *);
 
 #endif /* devices/block.h */
@@ -4,14 +4,30 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
+#include <string.h>
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the ATA controller is a PCI bus master, such as the Intel
+   PIIX found in QEMU and Bochs, sectors are transferred by
+   direct memory access (DMA): the controller copies the data
+   between the disk and memory by itself, following a "physical
+   region descriptor" (PRD) table, and the requesting thread
+   sleeps on the channel's completion semaphore until it is done,
+   leaving the CPU free in the meantime.  Otherwise, or if a DMA
+   transfer fails, the CPU moves each sector through the data
+   register in programmed I/O (PIO) mode.  Refer to the Intel
+   "Programming Interface for Bus Master IDE Controller",
+   revision 1.0. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -33,7 +49,9 @@
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DF 0x20             /* Device Fault. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +67,50 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors transferred by a single command. */
+#define XFER_MAX 256
+
+/* Bus master port addresses, for channels with a bus master. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  Writing 1 to BMS_ERROR or
+   BMS_INTR clears it. */
+#define BMS_ERROR 0x02          /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk raised its interrupt. */
+
+/* PCI class and subclass of IDE controllers, and the
+   programming interface bits that matter to us. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define IDE_PROG_NATIVE 0x05    /* Either channel in PCI native mode. */
+#define IDE_PROG_MASTER 0x80    /* Controller is a bus master. */
+
+/* Physical region descriptor.  Describes a physically
+   contiguous region of memory that does not cross a 64 kB
+   boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Size in bytes, even; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT for the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Number of PRDs in a channel's table. */
+#define PRD_CNT 16
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +119,10 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Use DMA for transfers? */
+    int mult_cnt;               /* Sectors per interrupt for READ
+                                   MULTIPLE and WRITE MULTIPLE, or 0
+                                   if the disk lacks them. */
   };
 
 /* An ATA channel (aka controller).
@@ -73,6 +139,12 @@ struct channel
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    /* Bus mastering, used only if BM_BASE is nonzero. */
+    uint16_t bm_base;           /* Bus master base I/O port, or 0. */
+    struct prd *prdt;           /* PRD table, PRD_CNT entries. */
+    uint8_t *bounce;            /* Page for buffers DMA cannot reach. */
+    uint8_t bm_status;          /* Bus master status at last interrupt. */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -84,12 +156,23 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int mult_max);
+
+static void transfer (struct ata_disk *, block_sector_t, void *buffer,
+                      block_sector_t cnt, bool write);
+static void pio_transfer (struct ata_disk *, block_sector_t,
+                          uint8_t *buffer, block_sector_t cnt, bool write);
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static void init_bus_master (bool dma);
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          uint8_t *buffer, block_sector_t *cnt, bool write);
+static size_t build_prdt (struct channel *, void *buffer, size_t size);
+
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
@@ -97,9 +180,10 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initialize the disk subsystem and detect disks.  If DMA is
+   true, use DMA for disks that support it. */
 void
-ide_init (void) 
+ide_init (bool dma) 
 {
   size_t chan_no;
 
@@ -124,8 +208,13 @@ ide_init (void)
           NOT_REACHED ();
         }
       lock_init (&c->lock);
+      lock_set_name (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = 0;
+      c->prdt = NULL;
+      c->bounce = NULL;
+      c->bm_status = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,7 +225,18 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
+          d->mult_cnt = 0;
         }
+    }
+
+  /* Find the bus master, if any. */
+  init_bus_master (dma);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      int dev_no;
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
@@ -155,6 +255,50 @@ ide_init (void)
     }
 }
 
+/* Looks for a PCI IDE controller that is a bus master and
+   drives the legacy ATA channels.  If DMA is true and there is
+   one, sets up both channels to use it. */
+static void
+init_bus_master (bool dma) 
+{
+  struct pci_dev *pci;
+  uint16_t bm_base;
+  size_t chan_no;
+
+  if (!dma)
+    return;
+
+  for (pci = pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, NULL);
+       pci != NULL;
+       pci = pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, pci))
+    if ((pci->prog_if & IDE_PROG_MASTER) != 0
+        && (pci->prog_if & IDE_PROG_NATIVE) == 0
+        && pci_io_bar (pci, 4, &bm_base))
+      break;
+  if (pci == NULL)
+    return;
+
+  pci_enable (pci, PCI_CMD_IO | PCI_CMD_MASTER);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+
+      /* The PRD table must not cross a 64 kB boundary, which a
+         page never does. */
+      c->prdt = palloc_get_page (0);
+      c->bounce = palloc_get_page (0);
+      if (c->prdt == NULL || c->bounce == NULL)
+        {
+          palloc_free_page (c->prdt);
+          palloc_free_page (c->bounce);
+          c->prdt = NULL;
+          c->bounce = NULL;
+          continue;
+        }
+      c->bm_base = bm_base + chan_no * 8;
+    }
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -284,10 +428,13 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x0100) != 0;
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -306,9 +453,34 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_set_controller (block, c);
   partition_scan (block);
 }
 
+/* Tells disk D to transfer as many sectors per interrupt as
+   possible, up to MULT_MAX, in response to READ MULTIPLE and
+   WRITE MULTIPLE, and sets D's mult_cnt accordingly. */
+static void
+set_multiple_mode (struct ata_disk *d, int mult_max) 
+{
+  struct channel *c = d->channel;
+  int mult_cnt;
+
+  /* The count must be a power of 2. */
+  if (mult_max < 2)
+    return;
+  for (mult_cnt = 1; mult_cnt * 2 <= mult_max; mult_cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), mult_cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & (STA_ERR | STA_DF)) == 0)
+    d->mult_cnt = mult_cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -344,16 +516,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  transfer (d_, sec_no, buffer, 1, false);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +527,130 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  transfer (d_, sec_no, (void *) buffer, 1, true);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, void *buffer,
+                   block_sector_t cnt)
+{
+  transfer (d_, sec_no, buffer, cnt, false);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, const void *buffer,
+                    block_sector_t cnt)
+{
+  transfer (d_, sec_no, (void *) buffer, cnt, true);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL,
+    NULL
   };
-
+
+/* Transfers CNT sectors starting at SEC_NO of disk D to BUFFER,
+   if WRITE is false, or from BUFFER to the sectors, if WRITE is
+   true.  Uses one command for up to XFER_MAX sectors, by DMA if
+   possible and otherwise by PIO. */
+static void
+transfer (struct ata_disk *d, block_sector_t sec_no, void *buffer_,
+          block_sector_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < XFER_MAX ? cnt : XFER_MAX;
+
+      if (!d->dma || !dma_transfer (d, sec_no, buffer, &n, write))
+        pio_transfer (d, sec_no, buffer, n, write);
+      sec_no += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
+
+/* Transfers CNT sectors, at most XFER_MAX, starting at SEC_NO of
+   disk D to BUFFER, if WRITE is false, or from BUFFER to the
+   sectors, if WRITE is true, in PIO mode.  The disk interrupts
+   once per sector, or once per D->mult_cnt sectors if it
+   supports READ MULTIPLE and WRITE MULTIPLE.  The channel's lock
+   must be held. */
+static void
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, uint8_t *buffer,
+              block_sector_t cnt, bool write) 
+{
+  struct channel *c = d->channel;
+  block_sector_t per_intr = 1;
+  uint8_t command = write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (cnt > 1 && d->mult_cnt > 1)
+    {
+      per_intr = d->mult_cnt;
+      command = write ? CMD_WRITE_MULTIPLE : CMD_READ_MULTIPLE;
+    }
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, command);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < per_intr ? cnt : per_intr;
+      block_sector_t i;
+
+      /* A read interrupts when data is ready.  A write interrupts
+         after the data has been accepted. */
+      if (!write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sec_no);
+      for (i = 0; i < n; i++, buffer += BLOCK_SECTOR_SIZE)
+        if (write)
+          output_sector (c, buffer);
+        else
+          input_sector (c, buffer);
+      if (write)
+        sema_down (&c->completion_wait);
+
+      sec_no += n;
+      cnt -= n;
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and XFER_MAX,
+   to the disk's sector selection registers.  (We use LBA
+   mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= XFER_MAX);
+  ASSERT (sec_no < (1UL << 28) && cnt <= (1UL << 28) - sec_no);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);            /* 0 means 256 sectors. */
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -430,6 +687,106 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Transfers *CNT sectors, at most XFER_MAX, starting at SEC_NO
+   of disk D to BUFFER, if WRITE is false, or from BUFFER to the
+   sectors, if WRITE is true, by DMA.  The channel's lock must be
+   held.  Returns true if successful, after setting *CNT to the
+   number of sectors transferred, which may be fewer than
+   requested.  On failure, turns off DMA for D and returns false,
+   so that the caller can fall back to PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, uint8_t *buffer,
+              block_sector_t *cnt, bool write) 
+{
+  struct channel *c = d->channel;
+  uint8_t *dma_buffer = buffer;
+  size_t size = *cnt * BLOCK_SECTOR_SIZE;
+  uint8_t status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (*cnt >= 1 && *cnt <= XFER_MAX);
+
+  /* DMA reaches memory by physical address, so it cannot use a
+     buffer in user memory, whose pages are scattered, or one at
+     an odd address.  Copy through the bounce page instead, a
+     page's worth at a time. */
+  if (build_prdt (c, buffer, size) == 0)
+    {
+      if (size > PGSIZE)
+        {
+          *cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+          size = PGSIZE;
+        }
+      dma_buffer = c->bounce;
+      if (write)
+        memcpy (dma_buffer, buffer, size);
+      build_prdt (c, dma_buffer, size);
+    }
+
+  /* Program the bus master, issue the command, and start the
+     transfer.  The disk interrupts when it is done. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), BMS_ERROR | BMS_INTR);
+  outb (reg_bm_command (c), write ? 0 : BMC_READ);
+  select_sector (d, sec_no, *cnt);
+  ASSERT (intr_get_level () == INTR_ON);
+  c->expecting_interrupt = true;
+  outb (reg_command (c), write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), (write ? 0 : BMC_READ) | BMC_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), 0);
+
+  status = inb (reg_alt_status (c));
+  if ((c->bm_status & BMS_ERROR) != 0 || (status & (STA_ERR | STA_DF)) != 0)
+    {
+      printf ("%s: DMA transfer failed, sector=%"PRDSNu", "
+              "switching to PIO\n", d->name, sec_no);
+      d->dma = false;
+      return false;
+    }
+
+  if (!write && dma_buffer != buffer)
+    memcpy (buffer, dma_buffer, size);
+  return true;
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes
+   starting at BUFFER.  Returns the number of PRDs used, or 0 if
+   BUFFER is not in kernel memory, is not 2-byte aligned, or would
+   need too many PRDs. */
+static size_t
+build_prdt (struct channel *c, void *buffer, size_t size) 
+{
+  uint32_t paddr;
+  size_t prd_cnt;
+
+  ASSERT (size > 0 && size % 2 == 0);
+
+  if (!is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+    return 0;
+
+  /* Kernel virtual memory maps physical memory one-to-one, so
+     BUFFER is physically contiguous.  Split it only at 64 kB
+     boundaries. */
+  paddr = vtop (buffer);
+  for (prd_cnt = 0; size > 0; prd_cnt++)
+    {
+      size_t chunk = 0x10000 - (paddr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+      if (prd_cnt >= PRD_CNT)
+        return 0;
+
+      c->prdt[prd_cnt].addr = paddr;
+      c->prdt[prd_cnt].size = chunk & 0xffff;
+      c->prdt[prd_cnt].flags = 0;
+      paddr += chunk;
+      size -= chunk;
+    }
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+  return prd_cnt;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -513,6 +870,13 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
+            if (c->bm_base != 0)
+              {
+                /* Save the bus master's status for dma_transfer(),
+                   and clear its interrupt and error bits. */
+                c->bm_status = inb (reg_bm_status (c));
+                outb (reg_bm_status (c), c->bm_status);
+              }
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
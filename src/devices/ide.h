@@ -1,6 +1,8 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
-void ide_init (void);
+#include <stdbool.h>
+
+void ide_init (bool dma);
 
 #endif /* devices/ide.h */
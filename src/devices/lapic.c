@@ -0,0 +1,162 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <stdint.h>
+#include "devices/timer.h"
+
+/* Interface to the local Advanced Programmable Interrupt
+   Controller (APIC) that each CPU in a multiprocessor has.
+   Pintos uses it only to send interprocessor interrupts (IPIs)
+   and to start the other CPUs.  Device interrupts still arrive
+   through the 8259A PICs, which the BIOS wires to the first
+   CPU's local APIC in "virtual wire" mode.  Refer to [IA32-v3a]
+   chapter 10 "Advanced Programmable Interrupt Controller (APIC)"
+   for details. */
+
+/* Local APIC registers, as byte offsets from LAPIC_VADDR. */
+#define LAPIC_ID        0x020   /* ID. */
+#define LAPIC_TPR       0x080   /* Task priority. */
+#define LAPIC_EOI       0x0b0   /* End of interrupt. */
+#define LAPIC_SVR       0x0f0   /* Spurious interrupt vector. */
+#define LAPIC_ESR       0x280   /* Error status. */
+#define LAPIC_ICR_LO    0x300   /* Interrupt command, bits 0...31. */
+#define LAPIC_ICR_HI    0x310   /* Interrupt command, bits 32...63. */
+#define LAPIC_LVT_TIMER 0x320   /* Local vector table: timer. */
+#define LAPIC_LVT_LINT0 0x350   /* Local vector table: LINT0 pin. */
+#define LAPIC_LVT_LINT1 0x360   /* Local vector table: LINT1 pin. */
+#define LAPIC_LVT_ERROR 0x370   /* Local vector table: error. */
+
+/* SVR bits. */
+#define SVR_ENABLE      0x100   /* APIC software enable. */
+
+/* Local vector table bits. */
+#define LVT_MASKED      0x10000 /* Interrupt masked. */
+#define LVT_EXTINT      0x700   /* Deliver as if from a PIC. */
+#define LVT_NMI         0x400   /* Deliver as NMI. */
+
+/* Interrupt command register bits. */
+#define ICR_FIXED       0x00000 /* Deliver vector to target. */
+#define ICR_INIT        0x00500 /* INIT IPI. */
+#define ICR_STARTUP     0x00600 /* Startup IPI. */
+#define ICR_BUSY        0x01000 /* Delivery still pending. */
+#define ICR_ASSERT      0x04000 /* Level assert. */
+#define ICR_LEVEL       0x08000 /* Level triggered. */
+#define ICR_OTHERS      0xc0000 /* All CPUs but self. */
+
+uint32_t lapic_paddr;
+
+static uint32_t lapic_read (int reg);
+static void lapic_write (int reg, uint32_t value);
+static void send_command (uint8_t apic_id, uint32_t command);
+
+/* Enables the running CPU's local APIC.  On the bootstrap
+   processor (BSP), keeps the PICs' interrupts flowing in through
+   LINT0; on the others, masks LINT0 so that device interrupts go
+   only to the BSP. */
+void
+lapic_init (bool bsp) 
+{
+  ASSERT (lapic_present ());
+
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED);
+  lapic_write (LAPIC_LVT_LINT0, bsp ? LVT_EXTINT : LVT_MASKED);
+  lapic_write (LAPIC_LVT_LINT1, bsp ? LVT_NMI : LVT_MASKED);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+
+  /* Clear error status, which takes two writes, and any
+     outstanding interrupt, then accept all interrupts. */
+  lapic_write (LAPIC_ESR, 0);
+  lapic_write (LAPIC_ESR, 0);
+  lapic_write (LAPIC_EOI, 0);
+  lapic_write (LAPIC_TPR, 0);
+}
+
+/* Returns true if the machine has a local APIC. */
+bool
+lapic_present (void) 
+{
+  return lapic_paddr != 0;
+}
+
+/* Returns the running CPU's local APIC ID. */
+uint8_t
+lapic_id (void) 
+{
+  return lapic_present () ? lapic_read (LAPIC_ID) >> 24 : 0;
+}
+
+/* Acknowledges an interrupt delivered by the local APIC, that
+   is, an IPI. */
+void
+lapic_eoi (void) 
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends interrupt VEC to the CPU whose local APIC ID is
+   APIC_ID. */
+void
+lapic_send_ipi (uint8_t apic_id, uint8_t vec) 
+{
+  send_command (apic_id, ICR_FIXED | vec);
+}
+
+/* Sends interrupt VEC to every CPU except the running one. */
+void
+lapic_broadcast_ipi (uint8_t vec) 
+{
+  send_command (0, ICR_OTHERS | ICR_FIXED | vec);
+}
+
+/* Starts the CPU whose local APIC ID is APIC_ID executing
+   real-mode code at START_PADDR, which must be page-aligned and
+   below 1 MB, using the INIT-SIPI-SIPI sequence from the
+   MultiProcessor Specification, section B.4. */
+void
+lapic_start_ap (uint8_t apic_id, uint32_t start_paddr) 
+{
+  int i;
+
+  ASSERT (start_paddr % 4096 == 0 && start_paddr < 0x100000);
+
+  send_command (apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  timer_udelay (200);
+  send_command (apic_id, ICR_INIT | ICR_LEVEL);
+  timer_mdelay (10);
+
+  for (i = 0; i < 2; i++)
+    {
+      send_command (apic_id, ICR_STARTUP | (start_paddr >> 12));
+      timer_udelay (200);
+    }
+}
+
+/* Returns the value of local APIC register REG. */
+static uint32_t
+lapic_read (int reg) 
+{
+  return *(volatile uint32_t *) ((uint8_t *) LAPIC_VADDR + reg);
+}
+
+/* Writes VALUE to local APIC register REG. */
+static void
+lapic_write (int reg, uint32_t value) 
+{
+  *(volatile uint32_t *) ((uint8_t *) LAPIC_VADDR + reg) = value;
+
+  /* Read back a harmless register to wait for the write. */
+  lapic_read (LAPIC_ID);
+}
+
+/* Issues interprocessor COMMAND to the CPU with local APIC ID
+   APIC_ID, and waits for it to be delivered. */
+static void
+send_command (uint8_t apic_id, uint32_t command) 
+{
+  ASSERT (lapic_present ());
+
+  lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, command);
+  while (lapic_read (LAPIC_ICR_LO) & ICR_BUSY)
+    continue;
+}
@@ -0,0 +1,27 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel virtual address at which the local APIC's registers
+   are mapped by paging_init(), if the machine has one. */
+#define LAPIC_VADDR ((void *) 0xfee00000)
+
+/* Vector of the spurious interrupts that the local APIC may
+   raise.  They need no acknowledgment. */
+#define LAPIC_SPURIOUS_VEC 0xff
+
+/* Physical address of the local APIC's registers, or 0 if there
+   is no local APIC.  Set by cpu_init(). */
+extern uint32_t lapic_paddr;
+
+void lapic_init (bool bsp);
+bool lapic_present (void);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t apic_id, uint8_t vec);
+void lapic_broadcast_ipi (uint8_t vec);
+void lapic_start_ap (uint8_t apic_id, uint32_t start_paddr);
+
+#endif /* devices/lapic.h */
@@ -317,8 +317,45 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+partition_read_multiple (void *p_, block_sector_t sector, void *buffer,
+                         block_sector_t cnt)
+{
+  struct partition *p = p_;
+  block_read_multiple (p->block, p->start + sector, buffer, cnt);
+}
+
+/* Writes CNT sectors starting at SECTOR to partition P from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block has acknowledged receiving the
+   data. */
+static void
+partition_write_multiple (void *p_, block_sector_t sector,
+                          const void *buffer, block_sector_t cnt)
+{
+  struct partition *p = p_;
+  block_write_multiple (p->block, p->start + sector, buffer, cnt);
+}
+
+/* Returns the device that partition P is on, and translates
+   *SECTOR from a sector in P into a sector on that device. */
+static struct block *
+partition_map (void *p_, block_sector_t *sector)
+{
+  struct partition *p = p_;
+  *sector += p->start;
+  return p->block;
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multiple,
+    partition_write_multiple,
+    partition_map,
+    NULL
   };
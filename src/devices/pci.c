@@ -0,0 +1,209 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/io.h"
+
+/* Interface to the PCI bus.  pci_init() enumerates the functions
+   on the bus through configuration mechanism #1, the pair of I/O
+   ports that every PC chipset since the PCI 2.0 days provides,
+   and remembers them so that drivers can look up their devices
+   later.  Refer to the PCI Local Bus Specification, revision
+   2.2, chapter 6 "Configuration Space" and section 3.2.2.3.2
+   "Software Generation of Configuration Transactions". */
+
+/* Configuration mechanism #1 I/O ports. */
+#define CONFIG_ADDRESS 0xcf8    /* Selects a configuration register. */
+#define CONFIG_DATA 0xcfc       /* Reads or writes the selected one. */
+
+/* More configuration space registers. */
+#define PCI_PROG_IF     0x09    /* Programming interface, 8 bits. */
+#define PCI_SUBCLASS    0x0a    /* Subclass code, 8 bits. */
+#define PCI_CLASS       0x0b    /* Class code, 8 bits. */
+#define PCI_HEADER_TYPE 0x0e    /* Header type, 8 bits. */
+
+/* Header type bits. */
+#define HEADER_MULTIFUNC 0x80   /* Device has more than one function. */
+
+/* Base address register bits. */
+#define BAR_IO 0x1              /* BAR maps I/O space, not memory. */
+
+/* Maximum number of functions we keep track of. */
+#define PCI_DEV_MAX 32
+
+/* Functions found by pci_init(). */
+static struct pci_dev devs[PCI_DEV_MAX];
+static size_t dev_cnt;
+
+static void scan_func (uint8_t bus, uint8_t dev, uint8_t func);
+static uint32_t config_address (uint8_t bus, uint8_t dev, uint8_t func,
+                                uint8_t reg);
+
+/* Enumerates the functions on the PCI bus. */
+void
+pci_init (void) 
+{
+  int bus, dev;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      {
+        struct pci_dev probe;
+        int func;
+
+        probe.bus = bus;
+        probe.dev = dev;
+        probe.func = 0;
+        if (pci_read_config16 (&probe, PCI_VENDOR_ID) == 0xffff)
+          continue;
+
+        scan_func (bus, dev, 0);
+        if (pci_read_config8 (&probe, PCI_HEADER_TYPE) & HEADER_MULTIFUNC)
+          for (func = 1; func < 8; func++)
+            scan_func (bus, dev, func);
+      }
+  printf ("pci: %zu functions found\n", dev_cnt);
+}
+
+/* Returns the first function found after PREV, or the first one
+   found if PREV is a null pointer, with class code CLASS and
+   subclass code SUBCLASS.  Returns a null pointer if there is no
+   such function. */
+struct pci_dev *
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *prev) 
+{
+  struct pci_dev *d;
+
+  for (d = prev != NULL ? prev + 1 : devs; d < devs + dev_cnt; d++)
+    if (d->class == class && d->subclass == subclass)
+      return d;
+  return NULL;
+}
+
+/* Returns the first function found after PREV, or the first one
+   found if PREV is a null pointer, with the given VENDOR_ID and
+   DEVICE_ID.  Returns a null pointer if there is no such
+   function. */
+struct pci_dev *
+pci_find_device (uint16_t vendor_id, uint16_t device_id,
+                 struct pci_dev *prev) 
+{
+  struct pci_dev *d;
+
+  for (d = prev != NULL ? prev + 1 : devs; d < devs + dev_cnt; d++)
+    if (d->vendor_id == vendor_id && d->device_id == device_id)
+      return d;
+  return NULL;
+}
+
+/* Reads and returns the 8-bit configuration register REG of
+   function D. */
+uint8_t
+pci_read_config8 (const struct pci_dev *d, uint8_t reg) 
+{
+  return pci_read_config32 (d, reg & ~3) >> (reg & 3) * 8;
+}
+
+/* Reads and returns the 16-bit configuration register REG of
+   function D.  REG must be a multiple of 2. */
+uint16_t
+pci_read_config16 (const struct pci_dev *d, uint8_t reg) 
+{
+  ASSERT (reg % 2 == 0);
+  return pci_read_config32 (d, reg & ~3) >> (reg & 2) * 8;
+}
+
+/* Reads and returns the 32-bit configuration register REG of
+   function D.  REG must be a multiple of 4. */
+uint32_t
+pci_read_config32 (const struct pci_dev *d, uint8_t reg) 
+{
+  ASSERT (reg % 4 == 0);
+  outl (CONFIG_ADDRESS, config_address (d->bus, d->dev, d->func, reg));
+  return inl (CONFIG_DATA);
+}
+
+/* Writes VALUE to the 16-bit configuration register REG of
+   function D.  REG must be a multiple of 2. */
+void
+pci_write_config16 (const struct pci_dev *d, uint8_t reg, uint16_t value) 
+{
+  ASSERT (reg % 2 == 0);
+  outl (CONFIG_ADDRESS, config_address (d->bus, d->dev, d->func, reg));
+  outw (CONFIG_DATA + (reg & 2), value);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG of
+   function D.  REG must be a multiple of 4. */
+void
+pci_write_config32 (const struct pci_dev *d, uint8_t reg, uint32_t value) 
+{
+  ASSERT (reg % 4 == 0);
+  outl (CONFIG_ADDRESS, config_address (d->bus, d->dev, d->func, reg));
+  outl (CONFIG_DATA, value);
+}
+
+/* If base address register BAR (0...5) of function D maps I/O
+   space, stores its base port in *PORT and returns true.
+   Otherwise, returns false. */
+bool
+pci_io_bar (const struct pci_dev *d, int bar, uint16_t *port) 
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+
+  value = pci_read_config32 (d, PCI_BAR0 + bar * 4);
+  if (!(value & BAR_IO) || (value & ~3u) == 0)
+    return false;
+  *port = value & ~3u;
+  return true;
+}
+
+/* Turns on CMD_BITS, a combination of PCI_CMD_* bits, in the
+   command register of function D. */
+void
+pci_enable (const struct pci_dev *d, uint16_t cmd_bits) 
+{
+  uint16_t cmd = pci_read_config16 (d, PCI_COMMAND);
+  if ((cmd & cmd_bits) != cmd_bits)
+    pci_write_config16 (d, PCI_COMMAND, cmd | cmd_bits);
+}
+
+/* Adds bus BUS, device DEV, function FUNC to devs[], if it
+   exists. */
+static void
+scan_func (uint8_t bus, uint8_t dev, uint8_t func) 
+{
+  struct pci_dev *d;
+  uint8_t irq;
+
+  if (dev_cnt >= PCI_DEV_MAX)
+    return;
+
+  d = &devs[dev_cnt];
+  d->bus = bus;
+  d->dev = dev;
+  d->func = func;
+  d->vendor_id = pci_read_config16 (d, PCI_VENDOR_ID);
+  if (d->vendor_id == 0xffff)
+    return;
+  d->device_id = pci_read_config16 (d, PCI_DEVICE_ID);
+  d->class = pci_read_config8 (d, PCI_CLASS);
+  d->subclass = pci_read_config8 (d, PCI_SUBCLASS);
+  d->prog_if = pci_read_config8 (d, PCI_PROG_IF);
+  irq = pci_read_config8 (d, PCI_IRQ_LINE);
+  d->irq = irq < 16 ? irq : 0xff;
+  dev_cnt++;
+}
+
+/* Returns the value to write to CONFIG_ADDRESS to select
+   configuration register REG of bus BUS, device DEV, function
+   FUNC. */
+static uint32_t
+config_address (uint8_t bus, uint8_t dev, uint8_t func, uint8_t reg) 
+{
+  ASSERT (dev < 32);
+  ASSERT (func < 8);
+  return (0x80000000 | (bus << 16) | (dev << 11) | (func << 8)
+          | (reg & 0xfc));
+}
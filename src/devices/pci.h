@@ -0,0 +1,49 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A function of a device on the PCI bus. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number on the bus. */
+    uint8_t func;               /* Function number in the device. */
+    uint16_t vendor_id;         /* Vendor ID. */
+    uint16_t device_id;         /* Device ID. */
+    uint8_t class;              /* Class code. */
+    uint8_t subclass;           /* Subclass code. */
+    uint8_t prog_if;            /* Programming interface. */
+    uint8_t irq;                /* Interrupt line (PIC IRQ), or 0xff. */
+  };
+
+/* Configuration space registers common to all devices. */
+#define PCI_VENDOR_ID   0x00    /* Vendor ID, 16 bits. */
+#define PCI_DEVICE_ID   0x02    /* Device ID, 16 bits. */
+#define PCI_COMMAND     0x04    /* Command, 16 bits. */
+#define PCI_STATUS      0x06    /* Status, 16 bits. */
+#define PCI_BAR0        0x10    /* First base address register. */
+#define PCI_IRQ_LINE    0x3c    /* Interrupt line, 8 bits. */
+
+/* Command register bits. */
+#define PCI_CMD_IO      0x0001  /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY  0x0002  /* Respond to memory space accesses. */
+#define PCI_CMD_MASTER  0x0004  /* Allow bus mastering. */
+
+void pci_init (void);
+struct pci_dev *pci_find_class (uint8_t class, uint8_t subclass,
+                                struct pci_dev *prev);
+struct pci_dev *pci_find_device (uint16_t vendor_id, uint16_t device_id,
+                                 struct pci_dev *prev);
+
+uint8_t pci_read_config8 (const struct pci_dev *, uint8_t reg);
+uint16_t pci_read_config16 (const struct pci_dev *, uint8_t reg);
+uint32_t pci_read_config32 (const struct pci_dev *, uint8_t reg);
+void pci_write_config16 (const struct pci_dev *, uint8_t reg, uint16_t);
+void pci_write_config32 (const struct pci_dev *, uint8_t reg, uint32_t);
+
+bool pci_io_bar (const struct pci_dev *, int bar, uint16_t *port);
+void pci_enable (const struct pci_dev *, uint16_t cmd_bits);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,163 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* RAM disk.
+
+   A block device whose sectors live in kernel memory, so that
+   reading and writing it costs no more than a memcpy().  It
+   makes it possible to measure the file system's own overhead
+   apart from disk latency, and to run jobs that create many
+   temporary files at memory speed.  Its contents are lost at
+   power off.
+
+   The disk's memory is allocated a page at a time, so it need
+   not be contiguous.  Requests are carried out as soon as they
+   are submitted, so the RAM disk needs no request queue. */
+
+/* Number of sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The RAM disk. */
+static struct block *ramdisk;
+
+/* Its pages. */
+static uint8_t **pages;
+static size_t page_cnt;
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk "ram0" of SIZE_KB kB, rounded up to a whole
+   number of pages, filled with zeros.  Panics if memory is not
+   available. */
+void
+ramdisk_init (size_t size_kb) 
+{
+  size_t i;
+
+  ASSERT (ramdisk == NULL);
+
+  page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  if (page_cnt == 0)
+    PANIC ("ramdisk: size must be positive");
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ramdisk: out of memory");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ramdisk: out of memory after %zu of %zu kB",
+               i * PGSIZE / 1024, page_cnt * PGSIZE / 1024);
+    }
+
+  ramdisk = block_register ("ram0", BLOCK_RAW, "RAM disk",
+                            page_cnt * SECTORS_PER_PAGE,
+                            &ramdisk_operations, NULL);
+}
+
+/* Copies the contents of block device SRC into the RAM disk,
+   as much as fits. */
+void
+ramdisk_load (struct block *src) 
+{
+  block_sector_t sector_cnt = block_size (src);
+  block_sector_t sector;
+
+  ASSERT (ramdisk != NULL);
+  ASSERT (src != ramdisk);
+
+  if (sector_cnt > block_size (ramdisk))
+    sector_cnt = block_size (ramdisk);
+  for (sector = 0; sector < sector_cnt; sector += SECTORS_PER_PAGE)
+    {
+      block_sector_t n = sector_cnt - sector;
+      if (n > SECTORS_PER_PAGE)
+        n = SECTORS_PER_PAGE;
+      block_read_multiple (src, sector, pages[sector / SECTORS_PER_PAGE], n);
+    }
+  printf ("ram0: loaded %'"PRDSNu" sectors from %s\n",
+          sector_cnt, block_name (src));
+}
+
+/* Copies the CNT sectors starting at SECTOR to BUFFER, if WRITE
+   is false, or from BUFFER to the sectors, if WRITE is true. */
+static void
+transfer (block_sector_t sector, void *buffer_, block_sector_t cnt,
+          bool write) 
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      uint8_t *page = pages[sector / SECTORS_PER_PAGE];
+      size_t ofs = sector % SECTORS_PER_PAGE;
+      block_sector_t n = SECTORS_PER_PAGE - ofs;
+      if (n > cnt)
+        n = cnt;
+
+      if (write)
+        memcpy (page + ofs * BLOCK_SECTOR_SIZE, buffer,
+                n * BLOCK_SECTOR_SIZE);
+      else
+        memcpy (buffer, page + ofs * BLOCK_SECTOR_SIZE,
+                n * BLOCK_SECTOR_SIZE);
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SECTOR into BUFFER. */
+static void
+ramdisk_read (void *aux UNUSED, block_sector_t sector, void *buffer) 
+{
+  transfer (sector, buffer, 1, false);
+}
+
+/* Writes sector SECTOR from BUFFER. */
+static void
+ramdisk_write (void *aux UNUSED, block_sector_t sector, const void *buffer) 
+{
+  transfer (sector, (void *) buffer, 1, true);
+}
+
+/* Reads CNT sectors starting at SECTOR into BUFFER. */
+static void
+ramdisk_read_multiple (void *aux UNUSED, block_sector_t sector, void *buffer,
+                       block_sector_t cnt) 
+{
+  transfer (sector, buffer, cnt, false);
+}
+
+/* Writes CNT sectors starting at SECTOR from BUFFER. */
+static void
+ramdisk_write_multiple (void *aux UNUSED, block_sector_t sector,
+                        const void *buffer, block_sector_t cnt) 
+{
+  transfer (sector, (void *) buffer, cnt, true);
+}
+
+/* Carries out request B at once, in the caller's thread. */
+static void
+ramdisk_submit (void *aux UNUSED, struct bio *b) 
+{
+  transfer (b->dev_sector, b->buffer, b->cnt, b->write);
+  bio_complete (b);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL,
+    ramdisk_submit
+  };
@@ -0,0 +1,11 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stddef.h>
+
+struct block;
+
+void ramdisk_init (size_t size_kb);
+void ramdisk_load (struct block *);
+
+#endif /* devices/ramdisk.h */
@@ -5,13 +5,21 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #endif
 
 /* Keyboard control register port. */
@@ -90,6 +98,8 @@ shutdown_power_off (void)
   const char s[] = "Shutdown";
   const char *p;
 
+  trace_dump ();
+
 #ifdef FILESYS
   filesys_done ();
 #endif
@@ -130,8 +140,15 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  sync_print_stats ();
+  palloc_print_stats ();
+  malloc_print_stats ();
+  kmem_cache_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  dcache_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
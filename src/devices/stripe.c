@@ -0,0 +1,265 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+/* Striped block device ("RAID-0").
+
+   A stripe device spreads its sectors across several member
+   devices, a chunk of STRIPE_CHUNK sectors at a time: chunk 0
+   goes to the first member, chunk 1 to the second, and so on,
+   wrapping around after the last member.  A request that spans
+   several chunks is split into one request per chunk, which are
+   submitted to the members' request queues together, so members
+   on different controllers, such as disks on the two IDE
+   channels, transfer their parts at the same time.  There is no
+   redundancy: losing any member loses the device.
+
+   The stripe device has no request queue of its own; each
+   member's queue sorts and merges the parts sent to it. */
+
+/* Sectors per chunk. */
+#define STRIPE_CHUNK 16
+
+/* Maximum number of member devices. */
+#define MEMBER_MAX 4
+
+/* A stripe device. */
+struct stripe
+  {
+    struct block *members[MEMBER_MAX];  /* Member devices. */
+    size_t member_cnt;                  /* Number of members. */
+  };
+
+/* A request to a stripe device, split into parts for the
+   members. */
+struct stripe_request
+  {
+    struct bio *orig;           /* Original request. */
+    size_t pending;             /* Number of parts not yet done. */
+    struct bio parts[];         /* Parts. */
+  };
+
+static struct block_operations stripe_operations;
+
+/* Number of stripe devices created so far. */
+static int stripe_cnt;
+
+static struct block *locate (const struct stripe *, block_sector_t,
+                             block_sector_t *member_sector,
+                             block_sector_t *chunk_left);
+
+/* Creates a stripe device out of MEMBERS, a comma-separated list
+   of the names of two or more block devices, such as "hdb,hdc".
+   Panics if MEMBERS is invalid. */
+void
+stripe_init (const char *members) 
+{
+  struct stripe *s;
+  char *copy, *name, *save_ptr;
+  block_sector_t member_size = 0;
+  char dev_name[16], extra_info[128];
+  size_t i;
+
+  s = malloc (sizeof *s);
+  copy = malloc (strlen (members) + 1);
+  if (s == NULL || copy == NULL)
+    PANIC ("stripe: out of memory");
+  strlcpy (copy, members, strlen (members) + 1);
+
+  s->member_cnt = 0;
+  extra_info[0] = '\0';
+  for (name = strtok_r (copy, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *block = block_get_by_name (name);
+      if (block == NULL)
+        PANIC ("stripe: no such block device \"%s\"", name);
+      if (s->member_cnt >= MEMBER_MAX)
+        PANIC ("stripe: more than %d members", MEMBER_MAX);
+      for (i = 0; i < s->member_cnt; i++)
+        if (s->members[i] == block)
+          PANIC ("stripe: \"%s\" named twice", name);
+
+      if (s->member_cnt == 0 || block_size (block) < member_size)
+        member_size = block_size (block);
+      s->members[s->member_cnt++] = block;
+      snprintf (extra_info + strlen (extra_info),
+                sizeof extra_info - strlen (extra_info),
+                "%s%s", s->member_cnt > 1 ? "+" : "striped across ", name);
+    }
+  free (copy);
+
+  if (s->member_cnt < 2)
+    PANIC ("stripe: need at least 2 members, not \"%s\"", members);
+  member_size -= member_size % STRIPE_CHUNK;
+  if (member_size == 0)
+    PANIC ("stripe: members are too small");
+
+  snprintf (dev_name, sizeof dev_name, "stripe%d", stripe_cnt++);
+  block_register (dev_name, BLOCK_RAW, extra_info,
+                  member_size * s->member_cnt, &stripe_operations, s);
+}
+
+/* Returns the member of S that holds SECTOR.  Stores the
+   corresponding sector on the member in *MEMBER_SECTOR and the
+   number of sectors from SECTOR to the end of its chunk in
+   *CHUNK_LEFT. */
+static struct block *
+locate (const struct stripe *s, block_sector_t sector,
+        block_sector_t *member_sector, block_sector_t *chunk_left)
+{
+  block_sector_t chunk = sector / STRIPE_CHUNK;
+  block_sector_t ofs = sector % STRIPE_CHUNK;
+
+  *member_sector = chunk / s->member_cnt * STRIPE_CHUNK + ofs;
+  *chunk_left = STRIPE_CHUNK - ofs;
+  return s->members[chunk % s->member_cnt];
+}
+
+/* Transfers CNT sectors starting at SECTOR of stripe S to
+   BUFFER, if WRITE is false, or from BUFFER to the sectors, if
+   WRITE is true, one chunk at a time. */
+static void
+transfer (struct stripe *s, block_sector_t sector, void *buffer_,
+          block_sector_t cnt, bool write) 
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t member_sector, n;
+      struct block *member = locate (s, sector, &member_sector, &n);
+
+      if (n > cnt)
+        n = cnt;
+      if (write)
+        block_write_multiple (member, member_sector, buffer, n);
+      else
+        block_read_multiple (member, member_sector, buffer, n);
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SECTOR from stripe S_ into BUFFER. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer)
+{
+  transfer (s_, sector, buffer, 1, false);
+}
+
+/* Writes sector SECTOR to stripe S_ from BUFFER. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer)
+{
+  transfer (s_, sector, (void *) buffer, 1, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from stripe S_ into
+   BUFFER. */
+static void
+stripe_read_multiple (void *s_, block_sector_t sector, void *buffer,
+                      block_sector_t cnt)
+{
+  transfer (s_, sector, buffer, cnt, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to stripe S_ from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s_, block_sector_t sector, const void *buffer,
+                       block_sector_t cnt)
+{
+  transfer (s_, sector, (void *) buffer, cnt, true);
+}
+
+/* Completion function for the parts of a stripe_request.  Once
+   all of them are done, completes the original request. */
+static void
+part_done (struct bio *part) 
+{
+  struct stripe_request *r = part->aux;
+  struct bio *orig = r->orig;
+  enum intr_level old_level;
+  bool last;
+
+  /* Parts on different members complete in different
+     dispatcher threads. */
+  old_level = intr_disable ();
+  last = --r->pending == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    {
+      free (r);
+      bio_complete (orig);
+    }
+}
+
+/* Carries out request B to stripe S_ by submitting a part of it
+   for each chunk that it spans. */
+static void
+stripe_submit (void *s_, struct bio *b) 
+{
+  struct stripe *s = s_;
+  struct stripe_request *r;
+  block_sector_t sector = b->dev_sector;
+  block_sector_t cnt = b->cnt;
+  uint8_t *buffer = b->buffer;
+  size_t part_cnt, i;
+
+  /* Each part but the first and last is a whole chunk. */
+  part_cnt = ((sector + cnt - 1) / STRIPE_CHUNK - sector / STRIPE_CHUNK) + 1;
+  r = malloc (sizeof *r + part_cnt * sizeof *r->parts);
+  if (r == NULL)
+    {
+      /* Do without splitting. */
+      transfer (s, sector, buffer, cnt, b->write);
+      bio_complete (b);
+      return;
+    }
+
+  r->orig = b;
+  r->pending = part_cnt;
+  for (i = 0; i < part_cnt; i++)
+    {
+      block_sector_t member_sector, n;
+
+      locate (s, sector, &member_sector, &n);
+      if (n > cnt)
+        n = cnt;
+      bio_init (&r->parts[i], member_sector, buffer, n, b->write,
+                part_done, r);
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  ASSERT (cnt == 0);
+
+  /* Submit only after initializing every part, since R may be
+     freed as soon as the last part is done. */
+  sector = b->dev_sector;
+  for (i = 0; i < part_cnt; i++)
+    {
+      block_sector_t member_sector, n;
+      struct block *member = locate (s, sector, &member_sector, &n);
+
+      sector += r->parts[i].cnt;
+      block_submit (member, &r->parts[i]);
+    }
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple,
+    NULL,
+    stripe_submit
+  };
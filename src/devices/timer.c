@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -17,8 +18,16 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
+/* Number of timer ticks since OS booted.
+   Updated only by the timer interrupt handler, under
+   ticks_seqlock, so that readers need not disable interrupts to
+   read all 64 bits consistently. */
 static int64_t ticks;
+static struct seqlock ticks_seqlock;
+
+/* Time-stamp counter value when the timer was initialized.
+   Used by timer_cycles_per_sec(). */
+static uint64_t boot_cycles;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
@@ -37,6 +46,7 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  boot_cycles = timer_cycles ();
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -70,9 +80,15 @@ timer_calibrate (void)
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+    {
+      seq = seqlock_read_begin (&ticks_seqlock);
+      t = ticks;
+    }
+  while (seqlock_read_retry (&ticks_seqlock, seq));
   return t;
 }
 
@@ -84,6 +100,18 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns an estimate of the number of timer_cycles() per
+   second, based on the cycles and timer ticks elapsed since
+   timer_init().  Returns 0 if no tick has happened yet. */
+uint64_t
+timer_cycles_per_sec (void)
+{
+  int64_t elapsed = timer_ticks ();
+  if (elapsed <= 0)
+    return 0;
+  return (timer_cycles () - boot_cycles) * TIMER_FREQ / elapsed;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -170,7 +198,10 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
+  seqlock_write_begin (&ticks_seqlock);
   ticks++;
+  seqlock_write_end (&ticks_seqlock);
+  cpu_broadcast_tick ();
   thread_tick ();
 }
 
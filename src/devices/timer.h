@@ -13,6 +13,19 @@ void timer_calibrate (void);
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
+/* High-resolution timing. */
+uint64_t timer_cycles_per_sec (void);
+
+/* Returns the CPU's time-stamp counter, which advances once per
+   processor clock cycle.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+timer_cycles (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
@@ -0,0 +1,690 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices, the paravirtual disks that
+   QEMU provides with "-drive if=virtio" (see "pintos --virtio").
+   It uses the "legacy" PCI interface described in section 4.1.4.8
+   of "Virtual I/O Device (VIRTIO) Version 1.0", which QEMU's
+   transitional virtio-blk device offers through I/O port BAR0.
+
+   Unlike an IDE disk, which needs several port accesses, each of
+   them a trap to the host, for every command and every sector
+   moved by PIO, a virtio disk reads its requests straight out of
+   memory.  Each request is a chain of descriptors in the disk's
+   "virtqueue": a header that gives the direction and the first
+   sector, one descriptor per physically contiguous segment of
+   the data buffer, and a status byte that the host fills in.
+   The driver puts the head of the chain in the queue's "available"
+   ring and writes the queue notification register, a single port
+   access.  When the host is done with a request, it puts it in
+   the "used" ring and raises the disk's interrupt.
+
+   Many requests may be outstanding at once, up to the size of
+   the queue, and the host orders them as it sees fit, so a
+   virtio disk implements the block layer's "submit" operation
+   instead of having a request queue: block_submit() adds the
+   request to the virtqueue and returns.  When the device is
+   done, the interrupt handler passes the request to the disk's
+   completion thread, which calls bio_complete().  Completion
+   functions may sleep, for example in free(), so they cannot
+   run in the interrupt handler itself. */
+
+/* PCI IDs of a transitional virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy interface registers, as offsets from BAR0. */
+#define REG_DEVICE_FEATURES 0x00        /* Device features, 32 bits. */
+#define REG_GUEST_FEATURES 0x04         /* Accepted features, 32 bits. */
+#define REG_QUEUE_PFN 0x08              /* Queue page number, 32 bits. */
+#define REG_QUEUE_SIZE 0x0c             /* Queue size, 16 bits. */
+#define REG_QUEUE_SELECT 0x0e           /* Queue select, 16 bits. */
+#define REG_QUEUE_NOTIFY 0x10           /* Queue notify, 16 bits. */
+#define REG_STATUS 0x12                 /* Device status, 8 bits. */
+#define REG_ISR 0x13                    /* ISR status, 8 bits. */
+#define REG_CONFIG 0x14                 /* Device configuration. */
+
+/* Block device configuration fields, as offsets from REG_CONFIG. */
+#define CFG_CAPACITY 0                  /* Size in sectors, 64 bits. */
+#define CFG_SIZE_MAX 8                  /* Max segment size, 32 bits. */
+#define CFG_SEG_MAX 12                  /* Max segments, 32 bits. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Guest has noticed device. */
+#define STATUS_DRIVER 0x02              /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+#define STATUS_FAILED 0x80              /* Driver gave up on device. */
+
+/* Block device features that we accept. */
+#define F_SIZE_MAX (1u << 1)            /* CFG_SIZE_MAX is valid. */
+#define F_SEG_MAX (1u << 2)             /* CFG_SEG_MAX is valid. */
+
+/* Request types and status. */
+#define REQ_IN 0                        /* Read. */
+#define REQ_OUT 1                       /* Write. */
+#define REQ_OK 0                        /* Request succeeded. */
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_* below. */
+    uint16_t next;              /* Next descriptor, if VRING_DESC_F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* NEXT is valid. */
+#define VRING_DESC_F_WRITE 2    /* Device writes, instead of reads, buffer. */
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry will go. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* Ring of descriptor chains that the device is done with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of descriptor chain. */
+    uint32_t len;               /* Bytes written into the chain. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry will go. */
+    struct vring_used_elem ring[];
+  };
+
+/* Maximum number of data segments in a request. */
+#define SEG_MAX 32
+
+/* Maximum number of virtio disks. */
+#define DISK_MAX 8
+
+/* Number of sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Request header, as read by the device. */
+struct request_header
+  {
+    uint32_t type;              /* REQ_IN or REQ_OUT. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+/* A request in a virtqueue. */
+struct request
+  {
+    struct request_header header;       /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+    struct bio *bio;                    /* Request to complete, or null. */
+    struct semaphore *done;             /* Otherwise, up'd when done. */
+  };
+
+/* A physically contiguous segment of a data buffer. */
+struct segment
+  {
+    uintptr_t addr;             /* Physical address. */
+    size_t len;                 /* Length in bytes. */
+  };
+
+/* A virtio block device. */
+struct disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector. */
+    size_t seg_max;             /* Maximum data segments per request. */
+    size_t size_max;            /* Maximum segment size, or 0 if none. */
+
+    /* The virtqueue.  Interrupts must be off to access these. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptors. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t used_idx;          /* Next entry in USED to complete. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+    struct request *requests;   /* Indexed by head descriptor. */
+    int waiter_cnt;             /* Threads waiting on SPACE. */
+    struct semaphore space;     /* Up'd when descriptors are freed. */
+
+    /* Requests done by the device, for the completion thread.
+       Interrupts must be off to access DONE_LIST. */
+    struct list done_list;      /* Struct bios, by their ELEMs. */
+    struct semaphore done_cnt;  /* Number of bios in DONE_LIST. */
+
+    /* For buffers outside kernel memory. */
+    struct lock bounce_lock;    /* Protects BOUNCE. */
+    uint8_t *bounce;            /* One page. */
+  };
+
+static struct disk *disks[DISK_MAX];
+static size_t disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static void probe (struct pci_dev *);
+static bool init_queue (struct disk *);
+static block_sector_t find_segments (const struct disk *, uint8_t *buffer,
+                                     block_sector_t cnt,
+                                     struct segment[SEG_MAX],
+                                     size_t *seg_cnt);
+static void queue_request (struct disk *, block_sector_t sector,
+                           const struct segment *, size_t seg_cnt,
+                           bool write, struct bio *, struct semaphore *);
+static void transfer (struct disk *, block_sector_t sector, void *buffer,
+                      block_sector_t cnt, bool write);
+static intr_handler_func interrupt_handler;
+static thread_func completion_thread NO_RETURN;
+
+/* Detects virtio block devices and registers them as "vda",
+   "vdb", and so on.  Must be called after pci_init(). */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev *pci;
+
+  for (pci = pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, NULL);
+       pci != NULL;
+       pci = pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, pci))
+    if (disk_cnt < DISK_MAX)
+      probe (pci);
+    else
+      printf ("virtio-blk: ignoring devices beyond %d\n", DISK_MAX);
+}
+
+/* Sets up virtio block device PCI and registers it with the
+   block layer. */
+static void
+probe (struct pci_dev *pci)
+{
+  struct disk *d;
+  uint16_t io_base;
+  uint32_t features;
+  uint64_t capacity;
+  struct block *block;
+  char name[sizeof d->name + sizeof "-io" - 1];
+  size_t i;
+
+  if (!pci_io_bar (pci, 0, &io_base) || pci->irq >= 16)
+    {
+      printf ("virtio-blk: %02"PRIx8":%02"PRIx8".%"PRIx8": "
+              "no I/O ports or no interrupt\n", pci->bus, pci->dev, pci->func);
+      return;
+    }
+  d = calloc (1, sizeof *d);
+  if (d == NULL)
+    {
+      printf ("virtio-blk: out of memory\n");
+      return;
+    }
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+  d->io_base = io_base;
+  d->irq = pci->irq + 0x20;
+  pci_enable (pci, PCI_CMD_IO | PCI_CMD_MASTER);
+
+  /* Reset the device, tell it we know how to drive it, and
+     settle on features, as in section 3.1 of the
+     specification. */
+  outb (io_base + REG_STATUS, 0);
+  outb (io_base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (io_base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  features = inl (io_base + REG_DEVICE_FEATURES) & (F_SIZE_MAX | F_SEG_MAX);
+  outl (io_base + REG_GUEST_FEATURES, features);
+
+  /* Read the configuration. */
+  capacity = (inl (io_base + REG_CONFIG + CFG_CAPACITY)
+              | (uint64_t) inl (io_base + REG_CONFIG + CFG_CAPACITY + 4) << 32);
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
+  d->size_max = 0;
+  if (features & F_SIZE_MAX)
+    d->size_max = inl (io_base + REG_CONFIG + CFG_SIZE_MAX);
+  d->seg_max = SEG_MAX;
+  if ((features & F_SEG_MAX)
+      && inl (io_base + REG_CONFIG + CFG_SEG_MAX) < SEG_MAX)
+    d->seg_max = inl (io_base + REG_CONFIG + CFG_SEG_MAX);
+  if (d->seg_max == 0)
+    d->seg_max = 1;
+
+  lock_init (&d->bounce_lock);
+  lock_set_name (&d->bounce_lock, d->name);
+  sema_init (&d->space, 0);
+  d->waiter_cnt = 0;
+  list_init (&d->done_list);
+  sema_init (&d->done_cnt, 0);
+  d->bounce = palloc_get_page (0);
+  if (d->bounce == NULL || !init_queue (d))
+    {
+      printf ("%s: initialization failed\n", d->name);
+      outb (io_base + REG_STATUS, STATUS_FAILED);
+      palloc_free_page (d->bounce);
+      free (d);
+      return;
+    }
+  snprintf (name, sizeof name, "%s-io", d->name);
+  if (thread_create (name, PRI_MAX, completion_thread, d)
+      == TID_ERROR)
+    {
+      /* The device already has the queue, so D stays
+         allocated. */
+      printf ("%s: cannot create completion thread\n", d->name);
+      outb (io_base + REG_STATUS, STATUS_FAILED);
+      return;
+    }
+
+  /* Share the interrupt handler with any other disk that has
+     the same interrupt. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i]->irq == d->irq)
+      break;
+  if (i >= disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  disks[disk_cnt++] = d;
+  outb (io_base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                          &virtio_blk_operations, d);
+  block_set_controller (block, d);
+  partition_scan (block);
+}
+
+/* Allocates and lays out D's virtqueue, the legacy interface's
+   queue 0, and gives it to the device.  Returns true if
+   successful, false on failure. */
+static bool
+init_queue (struct disk *d)
+{
+  size_t avail_size, used_size, page_cnt;
+  uint8_t *ring;
+  uint16_t i;
+
+  outw (d->io_base + REG_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->io_base + REG_QUEUE_SIZE);
+  if (d->queue_size < 3 || inl (d->io_base + REG_QUEUE_PFN) != 0)
+    return false;
+  if (d->seg_max > d->queue_size - 2u)
+    d->seg_max = d->queue_size - 2u;
+
+  /* The legacy interface puts the used ring at the first page
+     boundary after the descriptors and the available ring. */
+  avail_size = 3 * sizeof (uint16_t) + d->queue_size * sizeof (uint16_t);
+  used_size = (3 * sizeof (uint16_t)
+               + d->queue_size * sizeof (struct vring_used_elem));
+  page_cnt = (DIV_ROUND_UP (d->queue_size * sizeof (struct vring_desc)
+                            + avail_size, PGSIZE)
+              + DIV_ROUND_UP (used_size, PGSIZE));
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  d->requests = calloc (d->queue_size, sizeof *d->requests);
+  if (ring == NULL || d->requests == NULL)
+    {
+      palloc_free_multiple (ring, page_cnt);
+      free (d->requests);
+      return false;
+    }
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (d->desc + d->queue_size);
+  d->used = (struct vring_used *) (ring + ROUND_UP (d->queue_size
+                                                    * sizeof *d->desc
+                                                    + avail_size, PGSIZE));
+  d->used_idx = 0;
+
+  /* Chain all the descriptors into a free list. */
+  for (i = 0; i < d->queue_size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->queue_size;
+
+  outl (d->io_base + REG_QUEUE_PFN, vtop (ring) >> PGBITS);
+  return true;
+}
+
+/* Reads sector SECTOR from disk D_ into BUFFER. */
+static void
+virtio_blk_read (void *d_, block_sector_t sector, void *buffer)
+{
+  transfer (d_, sector, buffer, 1, false);
+}
+
+/* Writes sector SECTOR to disk D_ from BUFFER. */
+static void
+virtio_blk_write (void *d_, block_sector_t sector, const void *buffer)
+{
+  transfer (d_, sector, (void *) buffer, 1, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from disk D_ into
+   BUFFER. */
+static void
+virtio_blk_read_multiple (void *d_, block_sector_t sector, void *buffer,
+                          block_sector_t cnt)
+{
+  transfer (d_, sector, buffer, cnt, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to disk D_ from
+   BUFFER. */
+static void
+virtio_blk_write_multiple (void *d_, block_sector_t sector,
+                           const void *buffer, block_sector_t cnt)
+{
+  transfer (d_, sector, (void *) buffer, cnt, true);
+}
+
+/* Queues request B to disk D_, to be completed by the disk's
+   completion thread.  If B's buffer has more segments than can go in a
+   single request, which is rare, carries it out piece by piece
+   in the caller's thread instead. */
+static void
+virtio_blk_submit (void *d_, struct bio *b)
+{
+  struct disk *d = d_;
+  struct segment segs[SEG_MAX];
+  size_t seg_cnt;
+
+  if (find_segments (d, b->buffer, b->cnt, segs, &seg_cnt) == b->cnt)
+    queue_request (d, b->dev_sector, segs, seg_cnt, b->write, b, NULL);
+  else
+    {
+      transfer (d, b->dev_sector, b->buffer, b->cnt, b->write);
+      bio_complete (b);
+    }
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple,
+    NULL,
+    virtio_blk_submit
+  };
+
+/* Divides the first sectors of the CNT-sector BUFFER, which must
+   be in kernel memory, into as many as D allows of physically
+   contiguous segments, which it stores in SEGS and counts in
+   *SEG_CNT.  Returns the number of sectors covered, which is at
+   least 1. */
+static block_sector_t
+find_segments (const struct disk *d, uint8_t *buffer, block_sector_t cnt,
+               struct segment segs[SEG_MAX], size_t *seg_cnt)
+{
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  size_t ofs, excess;
+  size_t n = 0;
+
+  for (ofs = 0; ofs < size; )
+    {
+      uintptr_t addr = vtop (buffer + ofs);
+      size_t len = PGSIZE - pg_ofs (buffer + ofs);
+      struct segment *last = n > 0 ? &segs[n - 1] : NULL;
+
+      if (len > size - ofs)
+        len = size - ofs;
+      if (d->size_max != 0 && len > d->size_max)
+        len = d->size_max;
+
+      if (last != NULL && last->addr + last->len == addr
+          && (d->size_max == 0 || last->len + len <= d->size_max))
+        last->len += len;
+      else if (n < d->seg_max)
+        segs[n++] = (struct segment) {addr, len};
+      else
+        break;
+      ofs += len;
+    }
+
+  /* Stop at a sector boundary. */
+  excess = ofs % BLOCK_SECTOR_SIZE;
+  while (excess > 0)
+    {
+      struct segment *last = &segs[n - 1];
+      size_t trim = excess < last->len ? excess : last->len;
+
+      last->len -= trim;
+      excess -= trim;
+      if (last->len == 0)
+        n--;
+    }
+  ASSERT (n > 0);
+
+  *seg_cnt = n;
+  return ofs / BLOCK_SECTOR_SIZE;
+}
+
+/* Takes a free descriptor from D, which must have one, and
+   returns its index.  Interrupts must be off. */
+static uint16_t
+alloc_desc (struct disk *d)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+  return i;
+}
+
+/* Returns the chain of descriptors that starts at HEAD to D's
+   free list.  Interrupts must be off. */
+static void
+free_chain (struct disk *d, uint16_t head)
+{
+  uint16_t tail = head;
+
+  d->free_cnt++;
+  while (d->desc[tail].flags & VRING_DESC_F_NEXT)
+    {
+      tail = d->desc[tail].next;
+      d->free_cnt++;
+    }
+  d->desc[tail].next = d->free_head;
+  d->free_head = head;
+}
+
+/* Sets descriptor I of D to describe the LEN bytes at physical
+   address ADDR, with the given FLAGS. */
+static void
+set_desc (struct disk *d, uint16_t i, uintptr_t addr, size_t len,
+          uint16_t flags)
+{
+  d->desc[i].addr = addr;
+  d->desc[i].len = len;
+  d->desc[i].flags = flags;
+}
+
+/* Adds a request to D's virtqueue to read (if WRITE is false) or
+   write (if WRITE is true) the sectors starting at SECTOR, using
+   the SEG_CNT buffer segments in SEGS, and notifies the device.
+   Waits for enough free descriptors, if necessary.  When the
+   request is done, has the completion thread call
+   bio_complete(BIO), if BIO is nonnull, or ups DONE otherwise. */
+static void
+queue_request (struct disk *d, block_sector_t sector,
+               const struct segment *segs, size_t seg_cnt, bool write,
+               struct bio *bio, struct semaphore *done)
+{
+  enum intr_level old_level;
+  struct request *r;
+  uint16_t head, prev, i;
+  size_t s;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  while (d->free_cnt < seg_cnt + 2)
+    {
+      d->waiter_cnt++;
+      sema_down (&d->space);
+    }
+
+  /* The header, then the data, then the status byte. */
+  head = alloc_desc (d);
+  r = &d->requests[head];
+  r->header.type = write ? REQ_OUT : REQ_IN;
+  r->header.reserved = 0;
+  r->header.sector = sector;
+  r->status = 0xff;
+  r->bio = bio;
+  r->done = done;
+  set_desc (d, head, vtop (&r->header), sizeof r->header, VRING_DESC_F_NEXT);
+  prev = head;
+  for (s = 0; s < seg_cnt; s++)
+    {
+      i = alloc_desc (d);
+      set_desc (d, i, segs[s].addr, segs[s].len,
+                VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE));
+      d->desc[prev].next = i;
+      prev = i;
+    }
+  i = alloc_desc (d);
+  set_desc (d, i, vtop (&r->status), sizeof r->status, VRING_DESC_F_WRITE);
+  d->desc[prev].next = i;
+
+  /* Offer the chain to the device.  The device must see the
+     descriptors before the ring entry, and the entry before the
+     new index. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->io_base + REG_QUEUE_NOTIFY, 0);
+
+  intr_set_level (old_level);
+}
+
+/* Reads (if WRITE is false) or writes (if WRITE is true) the CNT
+   sectors of D starting at SECTOR to or from BUFFER, and waits
+   for the transfer to finish.  BUFFER need not be in kernel
+   memory. */
+static void
+transfer (struct disk *d, block_sector_t sector, void *buffer_,
+          block_sector_t cnt, bool write)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      struct segment segs[SEG_MAX];
+      struct semaphore done;
+      size_t seg_cnt;
+      block_sector_t n;
+
+      sema_init (&done, 0);
+      if (is_kernel_vaddr (buffer))
+        {
+          n = find_segments (d, buffer, cnt, segs, &seg_cnt);
+          queue_request (d, sector, segs, seg_cnt, write, NULL, &done);
+          sema_down (&done);
+        }
+      else
+        {
+          n = cnt < SECTORS_PER_PAGE ? cnt : SECTORS_PER_PAGE;
+          lock_acquire (&d->bounce_lock);
+          if (write)
+            memcpy (d->bounce, buffer, n * BLOCK_SECTOR_SIZE);
+          n = find_segments (d, d->bounce, n, segs, &seg_cnt);
+          queue_request (d, sector, segs, seg_cnt, write, NULL, &done);
+          sema_down (&done);
+          if (!write)
+            memcpy (buffer, d->bounce, n * BLOCK_SECTOR_SIZE);
+          lock_release (&d->bounce_lock);
+        }
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Completes the requests that disk D has put in its used ring,
+   handing bios to D's completion thread.  Interrupts must be
+   off. */
+static void
+complete_requests (struct disk *d)
+{
+  for (;;)
+    {
+      struct request *r;
+      uint16_t head;
+
+      barrier ();
+      if (d->used_idx == d->used->idx)
+        break;
+      head = d->used->ring[d->used_idx++ % d->queue_size].id;
+      ASSERT (head < d->queue_size);
+
+      r = &d->requests[head];
+      if (r->status != REQ_OK)
+        PANIC ("%s: disk %s failed, sector=%"PRIu64, d->name,
+               r->header.type == REQ_OUT ? "write" : "read",
+               r->header.sector);
+      free_chain (d, head);
+      if (r->bio != NULL)
+        {
+          list_push_back (&d->done_list, &r->bio->elem);
+          sema_up (&d->done_cnt);
+        }
+      else
+        sema_up (r->done);
+    }
+
+  /* Let every waiting thread check for enough descriptors. */
+  for (; d->waiter_cnt > 0; d->waiter_cnt--)
+    sema_up (&d->space);
+}
+
+/* Completion thread for disk D_.  Calls bio_complete() on each
+   bio that the interrupt handler finds done, in order. */
+static void
+completion_thread (void *d_)
+{
+  struct disk *d = d_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct bio *b;
+
+      sema_down (&d->done_cnt);
+      old_level = intr_disable ();
+      b = list_entry (list_pop_front (&d->done_list), struct bio, elem);
+      intr_set_level (old_level);
+      bio_complete (b);
+    }
+}
+
+/* Virtio block device interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct disk *d = disks[i];
+
+      /* Reading the ISR status acknowledges the interrupt. */
+      if (f->vec_no == d->irq && inb (d->io_base + REG_ISR) != 0)
+        complete_requests (d);
+    }
+}
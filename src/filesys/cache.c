@@ -0,0 +1,713 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <rhash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   The cache holds CACHE_SIZE blocks of the file system device.
+   A block is named by its owner, the inode sector of the file
+   it belongs to, and its index within that file, not by where it
+   lives on disk.  Plain device sectors, such as inodes, belong to
+   CACHE_DEVICE and are indexed by sector number.  Naming blocks
+   this way lets a file's dirty blocks sit in the cache before
+   they have sectors of their own ("delayed allocation"): the
+   inode code hands the cache CACHE_UNMAPPED as the sector of a
+   block past the end of what it has allocated, and later, when
+   it knows how many such blocks the file has, allocates them all
+   at once, side by side, and tells the cache where they went
+   with cache_set_sector().
+
+   Blocks are evicted in "clock" order, skipping delayed blocks,
+   which have nowhere to go.  A dirty block is written back along
+   with any dirty blocks of the same owner that lie next to it on
+   disk, up to CLUSTER_MAX sectors in a single request, and a
+   miss reads up to READ_AHEAD sectors that follow one another
+   in the file and on disk.
+
+   Blocks of file system metadata, such as inodes and directories,
+   may reach their sectors only after the journal has a copy (see
+   journal.c).  A metadata block written since the journal's last
+   commit is "uncommitted", and eviction passes it by, like a
+   delayed block, until the journal takes it with
+   cache_get_uncommitted() and then cache_commit().
+
+   A single lock protects the cache, but it is not held across
+   disk I/O, so that a miss on one block does not hold up hits on
+   every other.  Instead, a block is marked "reading" while its
+   data comes in from disk and "writing" while it goes out.  Such
+   a block cannot be evicted or dropped, a reading block cannot
+   be looked at, and a writing block cannot be changed, until its
+   I/O is done, when io_done is signaled.  A thread that must wait
+   looks the block up again afterward, because it may have gone
+   in the meantime.  The buffers for multi-sector transfers serve
+   one request at a time; a request that finds its buffer in use
+   transfers a single block in place instead. */
+
+/* Most sectors written back in one request. */
+#define CLUSTER_MAX 32
+
+/* Most sectors read in one request. */
+#define READ_AHEAD 8
+
+/* Names a block. */
+struct cache_key
+  {
+    block_sector_t owner;       /* Inode sector, or CACHE_DEVICE. */
+    block_sector_t index;       /* Block within owner. */
+  };
+
+/* A cached block. */
+struct cache_block
+  {
+    struct cache_key key;       /* Which block. */
+    block_sector_t sector;      /* Sector on disk, or CACHE_UNMAPPED. */
+    bool in_use;                /* Holds a block? */
+    bool dirty;                 /* Changed since read or written? */
+    bool accessed;              /* Used since the clock hand passed? */
+    bool meta;                  /* Metadata, written through the journal? */
+    bool uncommitted;           /* Metadata not in the journal yet? */
+    bool reading;               /* Being read from disk? */
+    bool writing;               /* Being written to disk? */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+static struct cache_block blocks[CACHE_SIZE];
+static struct rhash table;          /* Blocks in use, by key. */
+static struct lock cache_lock;      /* Protects everything here. */
+static struct condition io_done;    /* Signaled when I/O finishes. */
+static size_t hand;                 /* Clock hand, an index into blocks. */
+static size_t delayed_cnt;          /* Number of delayed blocks. */
+static size_t uncommitted_cnt;      /* Number of uncommitted blocks. */
+
+/* Buffers for multi-sector transfers. */
+static uint8_t *write_buffer;       /* CLUSTER_MAX sectors. */
+static uint8_t *read_buffer;        /* READ_AHEAD sectors. */
+static bool write_buffer_busy;      /* write_buffer in use? */
+static bool read_buffer_busy;       /* read_buffer in use? */
+
+/* Statistics. */
+static long long hit_cnt;           /* Lookups that found the block. */
+static long long miss_cnt;          /* Lookups that read the disk. */
+static long long write_cnt;         /* Write-back requests. */
+static long long written_cnt;       /* Sectors written back. */
+
+static rhash_match_func block_matches;
+static struct cache_block *lookup (block_sector_t owner,
+                                   block_sector_t index);
+static struct cache_block *insert (block_sector_t owner,
+                                   block_sector_t index,
+                                   block_sector_t sector);
+static void drop (struct cache_block *);
+static void write_back (struct cache_block *);
+static struct cache_block *read_blocks (block_sector_t owner,
+                                        block_sector_t index,
+                                        block_sector_t sector,
+                                        block_sector_t run);
+
+/* Returns true if B is a delayed block. */
+static inline bool
+is_delayed (const struct cache_block *b)
+{
+  return b->dirty && b->sector == CACHE_UNMAPPED;
+}
+
+/* Returns true if B may be written back to its sector. */
+static inline bool
+can_write_back (const struct cache_block *b)
+{
+  return b->dirty && b->sector != CACHE_UNMAPPED && !b->uncommitted;
+}
+
+/* Returns true if B has I/O in progress. */
+static inline bool
+is_busy (const struct cache_block *b)
+{
+  return b->reading || b->writing;
+}
+
+/* Returns the hash value for the block named by OWNER and
+   INDEX. */
+static inline unsigned
+hash_key (const struct cache_key *key)
+{
+  return hash_bytes (key, sizeof *key);
+}
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  uint8_t *page = NULL;
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_set_name (&cache_lock, "buffer cache");
+  cond_init (&io_done);
+  if (!rhash_init (&table, block_matches, NULL))
+    PANIC ("cannot create buffer cache table");
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      if (i % per_page == 0)
+        page = palloc_get_page (PAL_ASSERT);
+      blocks[i].data = page + i % per_page * BLOCK_SECTOR_SIZE;
+    }
+  write_buffer = palloc_get_multiple (PAL_ASSERT, CLUSTER_MAX / per_page);
+  read_buffer = palloc_get_multiple (PAL_ASSERT, READ_AHEAD / per_page);
+
+  /* Grow the table to hold every block up front, so that
+     insert() never needs memory. */
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      blocks[i].key.owner = CACHE_DEVICE;
+      blocks[i].key.index = i;
+      if (rhash_insert (&table, hash_key (&blocks[i].key), &blocks[i].key,
+                        &blocks[i]) != NULL)
+        PANIC ("cannot create buffer cache table");
+    }
+  for (i = 0; i < CACHE_SIZE; i++)
+    rhash_delete (&table, hash_key (&blocks[i].key), &blocks[i].key);
+}
+
+/* Reads SIZE bytes, starting at byte offset OFS, from the block
+   named by OWNER and INDEX into BUFFER.  SECTOR is where the
+   block lies on disk, or CACHE_UNMAPPED if it has no sector, in
+   which case it reads as zeros unless it is a delayed block.
+   RUN is the number of blocks, starting with this one, that lie
+   in consecutive sectors starting at SECTOR; if the block must
+   be read from disk, up to READ_AHEAD of them are read at once
+   and kept for later. */
+void
+cache_read (block_sector_t owner, block_sector_t index,
+            block_sector_t sector, block_sector_t run,
+            void *buffer, int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      b = lookup (owner, index);
+      if (b == NULL || !b->reading)
+        break;
+      cond_wait (&io_done, &cache_lock);
+    }
+  if (b != NULL)
+    {
+      hit_cnt++;
+      b->accessed = true;
+      memcpy (buffer, b->data + ofs, size);
+    }
+  else if (sector == CACHE_UNMAPPED)
+    memset (buffer, 0, size);
+  else
+    {
+      b = read_blocks (owner, index, sector, run);
+      memcpy (buffer, b->data + ofs, size);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into the block named by OWNER
+   and INDEX, starting at byte offset OFS.  SECTOR is where the
+   block lies on disk, or CACHE_UNMAPPED if it has no sector yet,
+   in which case the block starts out as zeros and becomes a
+   delayed block.  The data reaches the disk only when the block
+   is evicted or flushed.  If META is true, the block is metadata,
+   which stays in the cache until the journal commits it. */
+void
+cache_write (block_sector_t owner, block_sector_t index,
+             block_sector_t sector, const void *buffer, int ofs, int size,
+             bool meta)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      b = lookup (owner, index);
+      if (b != NULL)
+        {
+          if (!is_busy (b))
+            {
+              hit_cnt++;
+              break;
+            }
+          cond_wait (&io_done, &cache_lock);
+        }
+      else if ((b = insert (owner, index, sector)) != NULL)
+        {
+          if (sector == CACHE_UNMAPPED
+              || (ofs == 0 && size == BLOCK_SECTOR_SIZE))
+            memset (b->data, 0, BLOCK_SECTOR_SIZE);
+          else
+            {
+              miss_cnt++;
+              b->reading = true;
+              lock_release (&cache_lock);
+              block_read (fs_device, sector, b->data);
+              lock_acquire (&cache_lock);
+              b->reading = false;
+              cond_broadcast (&io_done, &cache_lock);
+            }
+          break;
+        }
+    }
+  if (!b->dirty)
+    {
+      b->dirty = true;
+      if (b->sector == CACHE_UNMAPPED)
+        delayed_cnt++;
+    }
+  if (meta && !b->uncommitted)
+    {
+      b->meta = b->uncommitted = true;
+      uncommitted_cnt++;
+      journal_count_block ();
+    }
+  b->accessed = true;
+  memcpy (b->data + ofs, buffer, size);
+  lock_release (&cache_lock);
+}
+
+/* Returns true if the block named by OWNER and INDEX is in the
+   cache. */
+bool
+cache_contains (block_sector_t owner, block_sector_t index)
+{
+  bool contains;
+
+  lock_acquire (&cache_lock);
+  contains = lookup (owner, index) != NULL;
+  lock_release (&cache_lock);
+  return contains;
+}
+
+/* Returns the number of delayed blocks in the cache. */
+size_t
+cache_delayed_cnt (void)
+{
+  return delayed_cnt;
+}
+
+/* Stores the indexes of up to MAX of OWNER's delayed blocks into
+   INDEXES, in increasing order, and returns the number stored. */
+size_t
+cache_get_delayed (block_sector_t owner, block_sector_t indexes[], size_t max)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE && cnt < max; i++)
+    {
+      struct cache_block *b = &blocks[i];
+      if (b->in_use && b->key.owner == owner && is_delayed (b))
+        {
+          /* Insertion sort: there are few of them. */
+          size_t j;
+          for (j = cnt; j > 0 && indexes[j - 1] > b->key.index; j--)
+            indexes[j] = indexes[j - 1];
+          indexes[j] = b->key.index;
+          cnt++;
+        }
+    }
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Records that the block named by OWNER and INDEX, if it is in
+   the cache, has been given SECTOR on disk.  The block must not
+   have had a sector before. */
+void
+cache_set_sector (block_sector_t owner, block_sector_t index,
+                  block_sector_t sector)
+{
+  struct cache_block *b;
+
+  lock_acquire (&cache_lock);
+  b = lookup (owner, index);
+  if (b != NULL)
+    {
+      ASSERT (b->sector == CACHE_UNMAPPED);
+      if (b->dirty)
+        delayed_cnt--;
+      b->sector = sector;
+    }
+  lock_release (&cache_lock);
+}
+
+/* Returns the number of uncommitted blocks in the cache. */
+size_t
+cache_uncommitted_cnt (void)
+{
+  return uncommitted_cnt;
+}
+
+/* Copies up to MAX uncommitted blocks into BUFFER, one after
+   another, and stores their sectors into SECTORS.  Returns the
+   number copied.  Every uncommitted block must have a sector. */
+size_t
+cache_get_uncommitted (block_sector_t sectors[], void *buffer_, size_t max)
+{
+  uint8_t *buffer = buffer_;
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE && cnt < max; i++)
+    {
+      struct cache_block *b = &blocks[i];
+      if (b->in_use && b->uncommitted)
+        {
+          ASSERT (b->sector != CACHE_UNMAPPED);
+          sectors[cnt] = b->sector;
+          memcpy (buffer + cnt * BLOCK_SECTOR_SIZE, b->data,
+                  BLOCK_SECTOR_SIZE);
+          cnt++;
+        }
+    }
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Marks every uncommitted block committed, once the journal
+   holds copies of them, so that they may be written back. */
+void
+cache_commit (void)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    blocks[i].uncommitted = false;
+  uncommitted_cnt = 0;
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty block that has a sector back to disk,
+   except uncommitted blocks.  If DATA_ONLY is true, metadata
+   blocks stay dirty as well.  Delayed blocks stay in the
+   cache.  Returns once write-backs that other threads started
+   earlier are done, too. */
+void
+cache_flush (bool data_only)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (blocks[i].in_use && can_write_back (&blocks[i])
+        && !(data_only && blocks[i].meta))
+      write_back (&blocks[i]);
+  for (i = 0; i < CACHE_SIZE; i++)
+    while (blocks[i].writing)
+      cond_wait (&io_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Drops all of OWNER's blocks from the cache without writing
+   them back, as when OWNER's file has been deleted.  Returns the
+   number of them that were delayed blocks. */
+size_t
+cache_discard (block_sector_t owner)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_block *b = &blocks[i];
+      while (b->in_use && b->key.owner == owner && is_busy (b))
+        cond_wait (&io_done, &cache_lock);
+      if (b->in_use && b->key.owner == owner)
+        {
+          if (is_delayed (b))
+            {
+              delayed_cnt--;
+              cnt++;
+            }
+          drop (b);
+        }
+    }
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Drops device sector SECTOR from the cache without writing it
+   back, as when it has been freed. */
+void
+cache_discard_sector (block_sector_t sector)
+{
+  struct cache_block *b;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      b = lookup (CACHE_DEVICE, sector);
+      if (b == NULL || !is_busy (b))
+        break;
+      cond_wait (&io_done, &cache_lock);
+    }
+  if (b != NULL)
+    drop (b);
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %lld hits, %lld misses, "
+          "%lld sectors written in %lld requests\n",
+          hit_cnt, miss_cnt, written_cnt, write_cnt);
+}
+
+/* Returns true if block B_ has key KEY_.  Used as the match
+   function of the cache's table. */
+static bool
+block_matches (const void *b_, const void *key_, void *aux UNUSED)
+{
+  const struct cache_block *b = b_;
+  const struct cache_key *key = key_;
+
+  return b->key.owner == key->owner && b->key.index == key->index;
+}
+
+/* Returns the cached block named by OWNER and INDEX, or a null
+   pointer if it is not in the cache. */
+static struct cache_block *
+lookup (block_sector_t owner, block_sector_t index)
+{
+  struct cache_key key;
+
+  key.owner = owner;
+  key.index = index;
+  return rhash_find (&table, hash_key (&key), &key);
+}
+
+/* Evicts a block and returns it to be reused as the clean block
+   named by OWNER and INDEX, at SECTOR, with its data left as it
+   was.  If the block to evict is dirty, or every block that could
+   be evicted is busy, instead writes it back or waits for I/O,
+   with cache_lock released in the meantime, and returns a null
+   pointer, after which the caller must look for the block again:
+   another thread may have brought it in. */
+static struct cache_block *
+insert (block_sector_t owner, block_sector_t index, block_sector_t sector)
+{
+  struct cache_block *b;
+  size_t i;
+
+  /* Two trips around the clock clear every accessed bit, so the
+     second finds a victim, unless every block is busy, delayed,
+     or uncommitted.  Busy blocks become evictable once their I/O
+     is done; the others need the inode code or the journal. */
+  for (i = 0; ; i++)
+    {
+      if (i == 2 * CACHE_SIZE)
+        {
+          size_t j;
+
+          for (j = 0; j < CACHE_SIZE; j++)
+            if (is_busy (&blocks[j]))
+              break;
+          ASSERT (j < CACHE_SIZE);
+          cond_wait (&io_done, &cache_lock);
+          return NULL;
+        }
+      b = &blocks[hand];
+      hand = (hand + 1) % CACHE_SIZE;
+      if (!b->in_use)
+        break;
+      if (is_busy (b) || is_delayed (b) || b->uncommitted)
+        continue;
+      if (b->accessed)
+        b->accessed = false;
+      else if (b->dirty)
+        {
+          write_back (b);
+          return NULL;
+        }
+      else
+        {
+          drop (b);
+          break;
+        }
+    }
+
+  b->key.owner = owner;
+  b->key.index = index;
+  b->sector = sector;
+  b->in_use = true;
+  b->dirty = false;
+  b->accessed = true;
+  b->meta = false;
+  rhash_insert (&table, hash_key (&b->key), &b->key, b);
+  return b;
+}
+
+/* Removes B from the cache. */
+static void
+drop (struct cache_block *b)
+{
+  ASSERT (!is_busy (b));
+
+  rhash_delete (&table, hash_key (&b->key), &b->key);
+  if (b->uncommitted)
+    uncommitted_cnt--;
+  b->in_use = false;
+  b->dirty = false;
+  b->uncommitted = false;
+}
+
+/* Writes dirty block B back to disk in a single request, along
+   with as many dirty blocks of the same owner as lie next to B
+   both in the file and on disk and may be written back, up to
+   CLUSTER_MAX in all.  cache_lock is released during the write,
+   so B may have been changed again by the time this returns. */
+static void
+write_back (struct cache_block *b)
+{
+  struct cache_block *cluster[CLUSTER_MAX];
+  struct cache_block *first = b;
+  size_t max = write_buffer_busy ? 1 : CLUSTER_MAX;
+  size_t cnt, i;
+
+  ASSERT (can_write_back (b));
+
+  /* Find the first block of the cluster... */
+  for (cnt = 1; cnt < max; cnt++)
+    {
+      struct cache_block *prev;
+      if (first->key.index == 0 || first->sector == 0)
+        break;
+      prev = lookup (first->key.owner, first->key.index - 1);
+      if (prev == NULL || !can_write_back (prev)
+          || prev->sector != first->sector - 1)
+        break;
+      first = prev;
+    }
+
+  /* ...then gather the blocks from there forward. */
+  for (cnt = 0, b = first; cnt < max; )
+    {
+      b->dirty = false;
+      b->writing = true;
+      cluster[cnt++] = b;
+      b = lookup (first->key.owner, first->key.index + cnt);
+      if (b == NULL || !can_write_back (b)
+          || b->sector != first->sector + cnt)
+        break;
+    }
+
+  if (cnt == 1)
+    {
+      lock_release (&cache_lock);
+      block_write (fs_device, first->sector, first->data);
+      lock_acquire (&cache_lock);
+    }
+  else
+    {
+      write_buffer_busy = true;
+      for (i = 0; i < cnt; i++)
+        memcpy (write_buffer + i * BLOCK_SECTOR_SIZE, cluster[i]->data,
+                BLOCK_SECTOR_SIZE);
+      lock_release (&cache_lock);
+      block_write_multiple (fs_device, first->sector, write_buffer, cnt);
+      lock_acquire (&cache_lock);
+      write_buffer_busy = false;
+    }
+
+  for (i = 0; i < cnt; i++)
+    cluster[i]->writing = false;
+  cond_broadcast (&io_done, &cache_lock);
+  write_cnt++;
+  written_cnt += cnt;
+}
+
+/* Reads the block named by OWNER and INDEX from SECTOR, unless
+   another thread brings it into the cache first, and returns it.
+   RUN is the number of blocks, starting with this one, that lie
+   in consecutive sectors starting at SECTOR; up to READ_AHEAD of
+   them are read in a single request and kept for later.
+   cache_lock must be held; it is released during the read. */
+static struct cache_block *
+read_blocks (block_sector_t owner, block_sector_t index,
+             block_sector_t sector, block_sector_t run)
+{
+  struct cache_block *group[READ_AHEAD];
+  block_sector_t max = run < READ_AHEAD ? run : READ_AHEAD;
+  block_sector_t cnt, i;
+
+  for (;;)
+    {
+      struct cache_block *b = lookup (owner, index);
+      if (b != NULL)
+        {
+          if (!b->reading)
+            return b;
+          cond_wait (&io_done, &cache_lock);
+        }
+      else if ((group[0] = insert (owner, index, sector)) != NULL)
+        break;
+    }
+  group[0]->reading = true;
+
+  /* Read ahead only as far as the next block in the cache, which
+     may be newer than its sector on disk.  insert() may release
+     the lock, after which that might no longer hold, so stop
+     there too. */
+  if (read_buffer_busy)
+    max = 1;
+  if (max > 1)
+    read_buffer_busy = true;
+  for (cnt = 1; cnt < max; cnt++)
+    {
+      if (lookup (owner, index + cnt) != NULL)
+        break;
+      group[cnt] = insert (owner, index + cnt, sector + cnt);
+      if (group[cnt] == NULL)
+        break;
+      group[cnt]->reading = true;
+    }
+
+  miss_cnt++;
+  if (cnt == 1)
+    {
+      if (max > 1)
+        read_buffer_busy = false;
+      lock_release (&cache_lock);
+      block_read (fs_device, sector, group[0]->data);
+      lock_acquire (&cache_lock);
+    }
+  else
+    {
+      lock_release (&cache_lock);
+      block_read_multiple (fs_device, sector, read_buffer, cnt);
+      lock_acquire (&cache_lock);
+      for (i = 0; i < cnt; i++)
+        memcpy (group[i]->data, read_buffer + i * BLOCK_SECTOR_SIZE,
+                BLOCK_SECTOR_SIZE);
+      read_buffer_busy = false;
+    }
+
+  for (i = 0; i < cnt; i++)
+    group[i]->reading = false;
+  cond_broadcast (&io_done, &cache_lock);
+  return group[0];
+}
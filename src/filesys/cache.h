@@ -0,0 +1,49 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Owner of cached blocks that are plain device sectors, such as
+   inodes, rather than file data.  The index of such a block is
+   its sector number. */
+#define CACHE_DEVICE ((block_sector_t) -1)
+
+/* Sector of a block that has no place on disk yet. */
+#define CACHE_UNMAPPED ((block_sector_t) -1)
+
+/* Number of blocks in the cache. */
+#define CACHE_SIZE 64
+
+/* Number of "delayed" blocks, dirty blocks without a sector,
+   past which the inode code gives them sectors.  The cache cannot
+   evict delayed blocks, so this must stay well below
+   CACHE_SIZE. */
+#define CACHE_DELAYED_MAX (CACHE_SIZE / 2)
+
+void cache_init (void);
+void cache_read (block_sector_t owner, block_sector_t index,
+                 block_sector_t sector, block_sector_t run,
+                 void *, int ofs, int size);
+void cache_write (block_sector_t owner, block_sector_t index,
+                  block_sector_t sector, const void *, int ofs, int size,
+                  bool meta);
+bool cache_contains (block_sector_t owner, block_sector_t index);
+
+size_t cache_delayed_cnt (void);
+size_t cache_get_delayed (block_sector_t owner, block_sector_t indexes[],
+                          size_t max);
+void cache_set_sector (block_sector_t owner, block_sector_t index,
+                       block_sector_t sector);
+
+size_t cache_uncommitted_cnt (void);
+size_t cache_get_uncommitted (block_sector_t sectors[], void *, size_t max);
+void cache_commit (void);
+
+void cache_flush (bool data_only);
+size_t cache_discard (block_sector_t owner);
+void cache_discard_sector (block_sector_t sector);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
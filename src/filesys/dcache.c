@@ -0,0 +1,195 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <rhash.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Dentry cache.
+
+   Looking up a name in a directory means reading the directory
+   through the buffer cache and comparing every entry, and a path
+   such as /a/b/c/d does that once per component.  The dentry
+   cache remembers the result of each lookup: it maps a directory,
+   named by its inode sector, and a name within it to the inode
+   sector the name refers to, or to DCACHE_NONE if the directory
+   has no such entry, so that failed lookups, such as the one
+   made before every create, are cached as well.
+
+   The directory code keeps the cache up to date.  It fills it in
+   and consults it with the directory's lock held for reading,
+   and changes it along with the directory, with the lock held
+   for writing, so an entry never disagrees with the directory.
+   When a directory is removed, its sector may come back as a
+   different directory, so its entries are dropped.
+
+   The cache holds at most DCACHE_SIZE entries and evicts the
+   least recently used one to make room for another. */
+
+/* A cached lookup result. */
+struct dentry
+  {
+    struct list_elem lru_elem;  /* Element in lru_list. */
+    unsigned hash;              /* Hash of DIR and NAME. */
+    block_sector_t dir;         /* Directory's inode sector. */
+    block_sector_t sector;      /* Inode sector, or DCACHE_NONE. */
+    char name[1];               /* Null-terminated name (more follows). */
+  };
+
+/* Key for searching the table. */
+struct dentry_key
+  {
+    block_sector_t dir;         /* Directory's inode sector. */
+    const char *name;           /* Name within the directory. */
+  };
+
+static struct rhash table;          /* Entries, by directory and name. */
+static struct list lru_list;        /* Entries, most recently used first. */
+static struct lock dcache_lock;     /* Protects everything here. */
+
+/* Statistics. */
+static long long hit_cnt;           /* Lookups answered by the cache. */
+static long long miss_cnt;          /* Lookups that had to search. */
+
+static rhash_match_func dentry_matches;
+static void drop (struct dentry *);
+
+/* Returns the hash value for NAME within directory DIR. */
+static inline unsigned
+hash_key (block_sector_t dir, const char *name)
+{
+  return hash_string (name) ^ hash_int (dir);
+}
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  lock_init (&dcache_lock);
+  lock_set_name (&dcache_lock, "dentry cache");
+  if (!rhash_init (&table, dentry_matches, NULL))
+    PANIC ("cannot create dentry cache table");
+  list_init (&lru_list);
+}
+
+/* Searches the cache for NAME within directory DIR.  If it is
+   there, stores the sector that NAME refers to, or DCACHE_NONE
+   if DIR has no entry by that name, into *SECTOR and returns
+   true.  Otherwise returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sector)
+{
+  struct dentry_key key;
+  struct dentry *d;
+
+  key.dir = dir;
+  key.name = name;
+  lock_acquire (&dcache_lock);
+  d = rhash_find (&table, hash_key (dir, name), &key);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      *sector = d->sector;
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME within directory DIR refers to the inode in
+   SECTOR, or, if SECTOR is DCACHE_NONE, that DIR has no entry by
+   that name, replacing whatever the cache knew about NAME.  If
+   memory is short, just forgets about NAME. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry_key key;
+  unsigned hash = hash_key (dir, name);
+  struct dentry *d, *old;
+
+  key.dir = dir;
+  key.name = name;
+  d = malloc (sizeof *d + strlen (name));
+  if (d != NULL)
+    {
+      d->hash = hash;
+      d->dir = dir;
+      d->sector = sector;
+      strlcpy (d->name, name, strlen (name) + 1);
+    }
+
+  lock_acquire (&dcache_lock);
+  old = rhash_find (&table, hash, &key);
+  if (old != NULL)
+    drop (old);
+  if (d != NULL)
+    {
+      if (rhash_size (&table) >= DCACHE_SIZE)
+        drop (list_entry (list_back (&lru_list), struct dentry, lru_elem));
+      if (rhash_insert (&table, hash, &key, d) == NULL)
+        {
+          list_push_front (&lru_list, &d->lru_elem);
+          d = NULL;
+        }
+    }
+  lock_release (&dcache_lock);
+
+  /* Not inserted, because the table could not grow. */
+  free (d);
+}
+
+/* Drops every entry for names within directory DIR. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        drop (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %lld hits, %lld misses\n", hit_cnt, miss_cnt);
+}
+
+/* Returns true if dentry D_ has key KEY_.  Used as the match
+   function of the cache's table. */
+static bool
+dentry_matches (const void *d_, const void *key_, void *aux UNUSED)
+{
+  const struct dentry *d = d_;
+  const struct dentry_key *key = key_;
+
+  return d->dir == key->dir && !strcmp (d->name, key->name);
+}
+
+/* Removes D from the cache and frees it.  dcache_lock must be
+   held. */
+static void
+drop (struct dentry *d)
+{
+  struct dentry_key key;
+
+  key.dir = d->dir;
+  key.name = d->name;
+  rhash_delete (&table, d->hash, &key);
+  list_remove (&d->lru_elem);
+  free (d);
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Sector that a negative entry, one recording that a directory
+   has no entry by some name, maps the name to. */
+#define DCACHE_NONE ((block_sector_t) -1)
+
+/* Number of entries in the dentry cache. */
+#define DCACHE_SIZE 256
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sector);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector);
+void dcache_invalidate_dir (block_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
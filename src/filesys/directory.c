@@ -1,10 +1,27 @@
 #include "filesys/directory.h"
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* Directories.
+
+   Every directory starts with entries for "." and "..", which
+   refer to the directory itself and to its parent (the root is
+   its own parent), so that the path code can look them up like
+   any other name.  dir_readdir() skips them, and a directory
+   that holds nothing else is empty and may be removed.  Once it
+   has been removed, even while still open, nothing more can be
+   looked up in it or added to it.
+
+   Lookups go through the dentry cache (see dcache.c). */
 
 /* A directory. */
 struct dir 
@@ -13,20 +30,95 @@ struct dir
     off_t pos;                          /* Current position. */
   };
 
-/* A single directory entry. */
+/* Cache of struct dir. */
+static struct kmem_cache *dir_cache;
+
+/* A directory entry, as stored on disk: a header followed by the
+   name, without a null terminator.
+
+   A directory's data is a whole number of sectors ("blocks"),
+   each divided into a chain of entries.  REC_LEN is the number of
+   bytes from the start of an entry to the start of the next one,
+   so that the last entry in a block ends at the block's end.  An
+   entry may have more room than its name needs, because it took
+   over a removed entry's space or left space for one to be added
+   after it, and an entry not in use is just space.  Entries never
+   cross a block boundary, so a lookup reads each block once, and
+   a change to one entry rewrites a single block.  Each entry
+   starts on a 4-byte boundary. */
 struct dir_entry 
   {
     block_sector_t inode_sector;        /* Sector number of header. */
-    char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    uint16_t rec_len;                   /* Bytes to the next entry. */
+    uint8_t name_len;                   /* Length of name. */
+    uint8_t in_use;                     /* In use or free? */
+    char name[];                        /* File name, not null terminated. */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Number of bytes that an entry with a NAME_LEN-byte name
+   needs. */
+#define ENTRY_SIZE(NAME_LEN) \
+        ROUND_UP (sizeof (struct dir_entry) + (NAME_LEN), 4)
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  ASSERT (ENTRY_SIZE (NAME_MAX) <= BLOCK_SECTOR_SIZE);
+
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+  if (dir_cache == NULL)
+    PANIC ("cannot create dir cache");
+  dcache_init ();
+}
+
+/* Stores an entry for NAME, whose inode is in INODE_SECTOR, into
+   E, which has REC_LEN bytes of room. */
+static void
+set_entry (struct dir_entry *e, const char *name,
+           block_sector_t inode_sector, size_t rec_len)
+{
+  e->inode_sector = inode_sector;
+  e->rec_len = rec_len;
+  e->name_len = strlen (name);
+  e->in_use = true;
+  memcpy (e->name, name, e->name_len);
+}
+
+/* Creates a directory in the given SECTOR, within the directory
+   whose inode is in sector PARENT.  Returns true if successful,
+   false on failure.  On failure, SECTOR is released back to the
+   free map. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct inode *inode;
+  uint8_t *block;
+  bool success;
+
+  block = calloc (1, BLOCK_SECTOR_SIZE);
+  if (block == NULL || !inode_create (sector, BLOCK_SECTOR_SIZE, true))
+    {
+      free (block);
+      free_map_release (sector, 1);
+      return false;
+    }
+
+  /* The first block holds "." and "..", with the rest of the
+     block left to "..". */
+  set_entry ((struct dir_entry *) block, ".", sector, ENTRY_SIZE (1));
+  set_entry ((struct dir_entry *) (block + ENTRY_SIZE (1)), "..", parent,
+             BLOCK_SECTOR_SIZE - ENTRY_SIZE (1));
+
+  inode = inode_open (sector);
+  success = (inode != NULL
+             && inode_write_at (inode, block, BLOCK_SECTOR_SIZE, 0)
+                == BLOCK_SECTOR_SIZE);
+  if (!success && inode != NULL)
+    inode_remove (inode);
+  inode_close (inode);
+  free (block);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -34,7 +126,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
@@ -44,7 +136,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL; 
     }
 }
@@ -72,7 +164,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -83,51 +175,189 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Reads the block at byte offset BLOCK_OFS in directory INODE
+   into BLOCK.  Returns false if BLOCK_OFS is the end of the
+   directory.
+
+   inode_read_at() will only return a short read at end of file.
+   Otherwise, we'd need to verify that we didn't get a short read
+   due to something intermittent such as low memory. */
+static bool
+read_block (struct inode *inode, off_t block_ofs, uint8_t *block)
+{
+  return (inode_read_at (inode, block, BLOCK_SECTOR_SIZE, block_ofs)
+          == BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the entry at byte offset OFS in BLOCK, or a null
+   pointer if OFS is the end of BLOCK.  An entry that does not
+   fit also ends the block, so that a damaged block cannot lead a
+   scan astray. */
+static struct dir_entry *
+entry_at (uint8_t *block, size_t ofs)
+{
+  struct dir_entry *e = (struct dir_entry *) (block + ofs);
+
+  if (ofs + sizeof *e > BLOCK_SECTOR_SIZE
+      || e->rec_len % 4 != 0
+      || e->rec_len < ENTRY_SIZE (e->name_len)
+      || ofs + e->rec_len > BLOCK_SECTOR_SIZE)
+    return NULL;
+  return e;
+}
+
+/* Returns true if the LEN-byte NAME is "." or "..". */
 static bool
+is_dot (const char *name, size_t len)
+{
+  return name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'));
+}
+
+/* Searches DIR for a file with the given NAME, reading DIR's
+   blocks into BLOCK, which must have room for BLOCK_SECTOR_SIZE
+   bytes.  If successful, returns the entry, within BLOCK, which
+   then holds the block that contains it, and sets *BLOCK_OFSP to
+   the byte offset of that block if BLOCK_OFSP is non-null.
+   Otherwise, returns a null pointer.
+   The caller must hold DIR's inode lock. */
+static struct dir_entry *
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        uint8_t *block, off_t *block_ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  size_t len = strlen (name);
+  off_t block_ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  for (block_ofs = 0; read_block (dir->inode, block_ofs, block);
+       block_ofs += BLOCK_SECTOR_SIZE)
+    {
+      struct dir_entry *e;
+      size_t ofs;
+
+      for (ofs = 0; (e = entry_at (block, ofs)) != NULL; ofs += e->rec_len)
+        if (e->in_use && e->name_len == len && !memcmp (e->name, name, len))
+          {
+            if (block_ofsp != NULL)
+              *block_ofsp = block_ofs;
+            return e;
+          }
+    }
+  return NULL;
+}
+
+/* Returns true if directory INODE has no entries besides "." and
+   "..", false if it has others or if memory is short.
+   The caller must hold INODE's lock. */
+static bool
+is_empty (struct inode *inode)
+{
+  uint8_t *block = malloc (BLOCK_SECTOR_SIZE);
+  off_t block_ofs;
+  bool empty = block != NULL;
+
+  for (block_ofs = 0; empty && read_block (inode, block_ofs, block);
+       block_ofs += BLOCK_SECTOR_SIZE)
+    {
+      struct dir_entry *e;
+      size_t ofs;
+
+      for (ofs = 0; (e = entry_at (block, ofs)) != NULL; ofs += e->rec_len)
+        if (e->in_use && !is_dot (e->name, e->name_len))
+          empty = false;
+    }
+  free (block);
+  return empty;
+}
+
+/* Finds room in DIR for an entry NEED bytes long, reading DIR's
+   blocks into BLOCK, and returns the free entry, within BLOCK,
+   that the new entry may fill, after splitting it off the end of
+   an entry in use if necessary.  Sets *BLOCK_OFSP to the byte
+   offset of the block.  If no block has room, starts a new block
+   in BLOCK, to go at the end of DIR, and returns its only entry.
+   The caller must hold DIR's inode lock. */
+static struct dir_entry *
+find_room (const struct dir *dir, size_t need,
+           uint8_t *block, off_t *block_ofsp)
+{
+  struct dir_entry *e;
+  off_t block_ofs;
+
+  for (block_ofs = 0; read_block (dir->inode, block_ofs, block);
+       block_ofs += BLOCK_SECTOR_SIZE)
+    {
+      size_t ofs;
+
+      for (ofs = 0; (e = entry_at (block, ofs)) != NULL; ofs += e->rec_len)
+        {
+          size_t used = e->in_use ? ENTRY_SIZE (e->name_len) : 0;
+          if (e->rec_len - used >= need)
+            {
+              if (used > 0)
+                {
+                  struct dir_entry *next;
+
+                  next = (struct dir_entry *) (block + ofs + used);
+                  next->rec_len = e->rec_len - used;
+                  next->in_use = false;
+                  e->rec_len = used;
+                  e = next;
+                }
+              *block_ofsp = block_ofs;
+              return e;
+            }
+        }
+    }
+
+  memset (block, 0, BLOCK_SECTOR_SIZE);
+  e = (struct dir_entry *) block;
+  e->rec_len = BLOCK_SECTOR_SIZE;
+  *block_ofsp = block_ofs;
+  return e;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Fails if DIR has been removed or if memory is short. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t dir_sector, sector;
+  struct rwlock *rw;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  rw = inode_get_rwlock (dir->inode);
+  rwlock_acquire_read (rw);
+  *inode = NULL;
+  if (!inode_is_removed (dir->inode))
+    {
+      if (!dcache_lookup (dir_sector, name, &sector))
+        {
+          uint8_t *block = malloc (BLOCK_SECTOR_SIZE);
+          struct dir_entry *e;
+
+          sector = DCACHE_NONE;
+          if (block != NULL)
+            {
+              e = lookup (dir, name, block, NULL);
+              if (e != NULL)
+                sector = e->inode_sector;
+              dcache_insert (dir_sector, name, sector);
+              free (block);
+            }
+        }
+      if (sector != DCACHE_NONE)
+        *inode = inode_open (sector);
+    }
+  rwlock_release_read (rw);
 
   return *inode != NULL;
 }
@@ -136,13 +366,15 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct rwlock *rw;
+  struct dir_entry *e;
+  uint8_t *block;
+  off_t block_ofs;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,85 +384,146 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  block = malloc (BLOCK_SECTOR_SIZE);
+  if (block == NULL)
+    return false;
+
+  rw = inode_get_rwlock (dir->inode);
+  rwlock_acquire_write (rw);
+
+  /* Check that DIR still exists and that NAME is not in use. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, block, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  /* Fill in an entry and write its block. */
+  e = find_room (dir, ENTRY_SIZE (strlen (name)), block, &block_ofs);
+  set_entry (e, name, inode_sector, e->rec_len);
+  success = (inode_write_at (dir->inode, block, BLOCK_SECTOR_SIZE, block_ofs)
+             == BLOCK_SECTOR_SIZE);
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  rwlock_release_write (rw);
+  free (block);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME,
+   if NAME is "." or "..", if NAME is a directory that is not
+   empty, or if memory is short. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
-  struct dir_entry e;
+  struct rwlock *rw, *child_rw = NULL;
+  struct dir_entry *e, *prev;
   struct inode *inode = NULL;
+  uint8_t *block;
   bool success = false;
-  off_t ofs;
+  off_t block_ofs;
+  size_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  block = malloc (BLOCK_SECTOR_SIZE);
+  if (block == NULL)
+    return false;
+
+  rw = inode_get_rwlock (dir->inode);
+  rwlock_acquire_write (rw);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (is_dot (name, strlen (name))
+      || (e = lookup (dir, name, block, &block_ofs)) == NULL)
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (e->inode_sector);
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  /* Only an empty directory may be removed.  Keep it locked, so
+     that nothing can be added to it in the meantime. */
+  if (inode_is_dir (inode))
+    {
+      child_rw = inode_get_rwlock (inode);
+      rwlock_acquire_write (child_rw);
+      if (!is_empty (inode))
+        goto done;
+    }
+
+  /* Erase directory entry, giving its space to the entry before
+     it in the block, if any. */
+  prev = NULL;
+  for (ofs = 0; block + ofs != (uint8_t *) e; ofs += prev->rec_len)
+    prev = entry_at (block, ofs);
+  if (prev != NULL)
+    prev->rec_len += e->rec_len;
+  else
+    e->in_use = false;
+  if (inode_write_at (dir->inode, block, BLOCK_SECTOR_SIZE, block_ofs)
+      != BLOCK_SECTOR_SIZE) 
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NONE);
 
-  /* Remove inode. */
+  /* Remove inode.  A directory's sector may be reused for another
+     directory, so forget the names cached for it. */
   inode_remove (inode);
+  if (child_rw != NULL)
+    dcache_invalidate_dir (inode_get_inumber (inode));
   success = true;
 
  done:
+  if (child_rw != NULL)
+    rwlock_release_write (child_rw);
+  rwlock_release_write (rw);
   inode_close (inode);
+  free (block);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries or if memory is short.  Skips "." and
+   "..". */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct rwlock *rw = inode_get_rwlock (dir->inode);
+  uint8_t *block = malloc (BLOCK_SECTOR_SIZE);
+  off_t block_ofs;
+  bool success = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  if (block == NULL)
+    return false;
+
+  rwlock_acquire_read (rw);
+  for (block_ofs = ROUND_DOWN (dir->pos, BLOCK_SECTOR_SIZE);
+       !success && read_block (dir->inode, block_ofs, block);
+       block_ofs += BLOCK_SECTOR_SIZE)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+      struct dir_entry *e;
+      size_t ofs;
+
+      /* Entries may have moved since the last call, so start from
+         the first entry at or past DIR's position. */
+      for (ofs = 0; (e = entry_at (block, ofs)) != NULL; ofs += e->rec_len)
+        if (block_ofs + (off_t) ofs >= dir->pos && e->in_use
+            && !is_dot (e->name, e->name_len))
+          {
+            memcpy (name, e->name, e->name_len);
+            name[e->name_len] = '\0';
+            dir->pos = block_ofs + ofs + e->rec_len;
+            success = true;
+            break;
+          }
+      if (!success)
+        dir->pos = block_ofs + BLOCK_SECTOR_SIZE;
     }
-  return false;
+  rwlock_release_read (rw);
+  free (block);
+  return success;
 }
@@ -2,14 +2,20 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+static bool create (const char *name, off_t initial_size, bool is_dir);
+static bool resolve (const char *path, struct dir **dirp,
+                     char name[NAME_MAX + 1]);
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,8 +27,12 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
@@ -36,6 +46,7 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -44,16 +55,65 @@ filesys_done (void)
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
+{
+  return create (name, initial_size, false);
+}
+
+/* Creates an empty directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
+}
+
+/* Creates a file or, if IS_DIR is true, a directory named NAME,
+   with the given INITIAL_SIZE. */
+static bool
+create (const char *name, off_t initial_size, bool is_dir)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+  char base[NAME_MAX + 1];
+  struct dir *dir = NULL;
+  block_sector_t parent;
+  bool created;
+  bool success = false;
+
+  journal_begin ();
+  if (!resolve (name, &dir, base))
+    goto done;
+
+  /* Put the new inode near its directory's. */
+  parent = inode_get_inumber (dir_get_inode (dir));
+  if (free_map_allocate_near (parent, 1, &inode_sector))
+    {
+      if (is_dir)
+        created = dir_create (inode_sector, parent);
+      else
+        {
+          created = inode_create (inode_sector, initial_size, false);
+          if (!created)
+            free_map_release (inode_sector, 1);
+        }
+      if (created && dir_add (dir, base, inode_sector))
+        success = true;
+      else if (created)
+        {
+          /* Free the new inode, its data, and its cached copy. */
+          struct inode *inode = inode_open (inode_sector);
+          if (inode != NULL)
+            {
+              inode_remove (inode);
+              inode_close (inode);
+            }
+        }
+    }
+
+ done:
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -66,12 +126,18 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir;
   struct inode *inode = NULL;
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
+  /* "/" has no last component to look up. */
+  if (name[0] == '/' && name[strspn (name, "/")] == '\0')
+    inode = inode_open (ROOT_DIR_SECTOR);
+  else if (resolve (name, &dir, base))
+    {
+      dir_lookup (dir, base, &inode);
+      dir_close (dir);
+    }
 
   return file_open (inode);
 }
@@ -83,12 +149,127 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
-  dir_close (dir); 
+  char base[NAME_MAX + 1];
+  struct dir *dir;
+  bool success = false;
+
+  journal_begin ();
+  if (resolve (name, &dir, base))
+    {
+      success = dir_remove (dir, base);
+      dir_close (dir); 
+    }
+  journal_end ();
 
   return success;
 }
+
+/* Makes the directory named NAME the current process's working
+   directory.  Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_process ();
+  struct file *file = filesys_open (name);
+  struct dir *dir = NULL;
+
+  if (file != NULL && inode_is_dir (file_get_inode (file)))
+    dir = dir_open (inode_reopen (file_get_inode (file)));
+  file_close (file);
+  if (dir == NULL)
+    return false;
+
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX characters from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Looks up PATH, relative to the current process's working
+   directory unless it starts with "/", up to its last component.
+   On success, stores the directory that should hold the last
+   component into *DIRP, which the caller must close, and the
+   component itself into NAME, and returns true.  Fails if PATH
+   has no last component, as for "" and "/", if a component is
+   too long, or if one of the others does not name a directory. */
+static bool
+resolve (const char *path, struct dir **dirp, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_process ()->cwd;
+  char next[NAME_MAX + 1];
+  struct dir *dir;
+  int result;
+
+  if (path[0] == '/' || cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (cwd);
+  if (dir == NULL)
+    return false;
+
+  if (get_next_part (name, &path) != 1)
+    goto error;
+  while ((result = get_next_part (next, &path)) == 1)
+    {
+      struct inode *inode;
+
+      /* NAME is not the last component, so it must be a
+         directory. */
+      if (!dir_lookup (dir, name, &inode))
+        goto error;
+      dir_close (dir);
+      if (!inode_is_dir (inode))
+        {
+          inode_close (inode);
+          return false;
+        }
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return false;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+  if (result < 0)
+    goto error;
+
+  *dirp = dir;
+  return true;
+
+ error:
+  dir_close (dir);
+  return false;
+}
 
 /* Formats the file system. */
 static void
@@ -96,8 +277,9 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_flush ();
   printf ("done.\n");
 }
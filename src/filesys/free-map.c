@@ -1,68 +1,274 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <rbtree.h>
+#include <round.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+
+/* Free map.
+
+   On disk, the free map is a file that holds a bitmap with one
+   bit per sector of the file system device, set if the sector is
+   in use.  In memory, the free sectors are also kept as
+   "extents", maximal runs of consecutive free sectors, each of
+   which is in two red-black trees: one sorted by first sector,
+   and one sorted by length.  The first finds the free space
+   around a given sector and the neighbors that a released run
+   merges with; the second finds the shortest run that is long
+   enough for a request ("best fit").  Both take O(lg n) time in
+   the number of runs, however full the device.
+
+   free_map_allocate_near() keeps related data together: it
+   takes the first run that fits among the few that follow a
+   "goal" sector, such as a file's inode or its last data sector,
+   or failing that the nearest of the few that precede it, before
+   it falls back to best fit.
+
+   Sectors may also be "reserved" for file data that is not
+   written out yet (see inode.c), so that there is space for it
+   when it is.  Ordinary allocations leave reserved sectors
+   alone, and free_map_allocate_reserved() uses them up.
+
+   Released sectors are marked free in the bitmap at once, but
+   kept out of the extents, where allocations could find them,
+   for a while (see journal.c).  Until the journal commits the
+   release, a crash would bring back the file that owned them, so
+   they wait for free_map_commit().  A sector that held metadata
+   may also have copies in the journal, which recovery would
+   write over whatever the sector holds next, so it waits for
+   free_map_checkpoint(), which says that the journal has been
+   emptied.
+
+   After each change, only the sectors of the bitmap file that
+   hold changed bits are written back. */
+
+/* Number of extents on each side of a goal that
+   free_map_allocate_near() considers. */
+#define NEAR_SEARCH 8
+
+/* A run of free sectors. */
+struct extent
+  {
+    block_sector_t start;       /* First sector. */
+    block_sector_t length;      /* Number of sectors, at least 1. */
+    struct rb_elem start_elem;  /* Element in by_start. */
+    struct rb_elem length_elem; /* Element in by_length. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects everything above and
+                                        below. */
+
+static struct rbtree by_start;       /* Extents by first sector. */
+static struct rbtree by_length;      /* Extents by length, then first
+                                        sector. */
+static struct rbtree held_data;      /* Sectors released since the last
+                                        commit, by first sector. */
+static struct rbtree held_meta;      /* Metadata sectors released since
+                                        the last checkpoint, likewise. */
+static size_t held_data_cnt;         /* Number of sectors in held_data. */
+static struct kmem_cache *extent_cache;
+static size_t free_cnt;              /* Number of free sectors in the
+                                        extents. */
+static size_t reserved_cnt;          /* Number of them reserved. */
+
+static rb_less_func start_less, length_less;
+static bool allocate_near (block_sector_t goal, size_t cnt,
+                           block_sector_t *sectorp, bool reserved);
+static bool allocate (struct extent *, block_sector_t sector, size_t cnt);
+static struct extent *find_near (block_sector_t goal, size_t cnt,
+                                 block_sector_t *sectorp);
+static struct extent *find_best (size_t cnt, block_sector_t *sectorp);
+static void take (struct extent *, block_sector_t sector, size_t cnt);
+static void add_extent (block_sector_t sector, size_t cnt);
+static void hold (struct rbtree *, block_sector_t sector, size_t cnt);
+static void unhold (struct rbtree *);
+static void build_extents (void);
+static bool write_bits (block_sector_t sector, size_t cnt);
 
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+  lock_init (&free_map_lock);
+  lock_set_name (&free_map_lock, "free map");
+  extent_cache = kmem_cache_create ("extent", sizeof (struct extent), NULL);
+  if (extent_cache == NULL)
+    PANIC ("can't create free map extent cache");
+  rb_init (&by_start, start_less, NULL);
+  rb_init (&by_length, length_less, NULL);
+  rb_init (&held_data, start_less, NULL);
+  rb_init (&held_meta, start_less, NULL);
+  build_extents ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors from the free map, choosing
+   the shortest run of free sectors that is long enough, and
+   stores the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct extent *e;
+  block_sector_t sector;
+  bool success;
+
+  if (cnt == 0)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      *sectorp = 0;
+      return true;
     }
-  if (sector != BITMAP_ERROR)
+
+  lock_acquire (&free_map_lock);
+  e = free_cnt - reserved_cnt >= cnt ? find_best (cnt, &sector) : NULL;
+  success = e != NULL && allocate (e, sector, cnt);
+  lock_release (&free_map_lock);
+  if (success)
     *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  return success;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after GOAL as possible, and stores the first into *SECTORP.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  return allocate_near (goal, cnt, sectorp, false);
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Like free_map_allocate_near(), but takes CNT sectors that were
+   reserved with free_map_reserve().  On success, they are no
+   longer reserved. */
+bool
+free_map_allocate_reserved (block_sector_t goal, size_t cnt,
+                            block_sector_t *sectorp)
+{
+  return allocate_near (goal, cnt, sectorp, true);
+}
+
+/* Reserves CNT free sectors, so that other allocations do not
+   take them.  Returns true if successful, false if fewer than
+   CNT sectors are free and unreserved. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Cancels the reservation of CNT sectors. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Frees the CNT sectors starting at SECTOR, making them
+   available for use after the next call to free_map_commit(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  if (cnt == 0)
+    return;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, false);
+  write_bits (sector, cnt);
+  hold (&held_data, sector, cnt);
+  held_data_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Frees the CNT sectors starting at SECTOR, which held
+   metadata, making them available for use after the next call
+   to free_map_checkpoint(). */
+void
+free_map_release_metadata (block_sector_t sector, size_t cnt)
+{
+  if (cnt == 0)
+    return;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  write_bits (sector, cnt);
+  hold (&held_meta, sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Returns true if more sectors are waiting for free_map_commit()
+   than are free to allocate now. */
+bool
+free_map_short (void)
+{
+  return held_data_cnt > free_cnt - reserved_cnt;
+}
+
+/* Makes the sectors released with free_map_release() available
+   for use, once the journal has committed their release. */
+void
+free_map_commit (void)
+{
+  lock_acquire (&free_map_lock);
+  unhold (&held_data);
+  held_data_cnt = 0;
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released with free_map_release_metadata()
+   available for use, once the journal holds no copies of them. */
+void
+free_map_checkpoint (void)
+{
+  lock_acquire (&free_map_lock);
+  unhold (&held_meta);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  build_extents ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
   file_close (free_map_file);
 }
@@ -70,10 +276,10 @@ free_map_close (void)
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -83,3 +289,304 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Orders extents by first sector. */
+static bool
+start_less (const struct rb_elem *a_, const struct rb_elem *b_,
+            void *aux UNUSED)
+{
+  const struct extent *a = rb_entry (a_, struct extent, start_elem);
+  const struct extent *b = rb_entry (b_, struct extent, start_elem);
+
+  return a->start < b->start;
+}
+
+/* Orders extents by length, then by first sector. */
+static bool
+length_less (const struct rb_elem *a_, const struct rb_elem *b_,
+             void *aux UNUSED)
+{
+  const struct extent *a = rb_entry (a_, struct extent, length_elem);
+  const struct extent *b = rb_entry (b_, struct extent, length_elem);
+
+  if (a->length != b->length)
+    return a->length < b->length;
+  return a->start < b->start;
+}
+
+/* Allocates CNT sectors near GOAL, as described for
+   free_map_allocate_near(), taking them from those reserved if
+   RESERVED is true or from those not reserved otherwise. */
+static bool
+allocate_near (block_sector_t goal, size_t cnt, block_sector_t *sectorp,
+               bool reserved)
+{
+  struct extent *e = NULL;
+  block_sector_t sector;
+  bool success;
+
+  if (cnt == 0)
+    {
+      *sectorp = 0;
+      return true;
+    }
+
+  lock_acquire (&free_map_lock);
+  if (reserved ? reserved_cnt >= cnt : free_cnt - reserved_cnt >= cnt)
+    {
+      e = find_near (goal, cnt, &sector);
+      if (e == NULL)
+        e = find_best (cnt, &sector);
+    }
+  success = e != NULL && allocate (e, sector, cnt);
+  if (success && reserved)
+    reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+  if (success)
+    *sectorp = sector;
+  return success;
+}
+
+/* Marks the CNT free sectors starting at SECTOR, which must
+   all be in extent E, as in use, and writes them to the free map
+   file.  Returns true if successful.  On failure, leaves the
+   sectors free. */
+static bool
+allocate (struct extent *e, block_sector_t sector, size_t cnt)
+{
+  take (e, sector, cnt);
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (!write_bits (sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      add_extent (sector, cnt);
+      return false;
+    }
+  free_cnt -= cnt;
+  return true;
+}
+
+/* Looks for CNT free sectors close to GOAL: at the start of the
+   first of the NEAR_SEARCH extents at or after GOAL that is long
+   enough, or else at the end of the nearest such extent of the
+   NEAR_SEARCH before GOAL.  If successful, stores the first
+   sector into *SECTORP and returns its extent; otherwise,
+   returns a null pointer. */
+static struct extent *
+find_near (block_sector_t goal, size_t cnt, block_sector_t *sectorp)
+{
+  struct extent key;
+  struct rb_elem *after, *before;
+  int i;
+
+  key.start = goal;
+  after = rb_lower_bound (&by_start, &key.start_elem);
+  before = after != NULL ? rb_prev (after) : rb_last (&by_start);
+
+  for (i = 0; i < NEAR_SEARCH && after != NULL; i++)
+    {
+      struct extent *e = rb_entry (after, struct extent, start_elem);
+      if (e->length >= cnt)
+        {
+          *sectorp = e->start;
+          return e;
+        }
+      after = rb_next (after);
+    }
+  for (i = 0; i < NEAR_SEARCH && before != NULL; i++)
+    {
+      struct extent *e = rb_entry (before, struct extent, start_elem);
+      if (e->length >= cnt)
+        {
+          *sectorp = e->start + e->length - cnt;
+          return e;
+        }
+      before = rb_prev (before);
+    }
+  return NULL;
+}
+
+/* Looks for the shortest extent with at least CNT sectors,
+   preferring the lowest-numbered among equals.  If successful,
+   stores its first sector into *SECTORP and returns it;
+   otherwise, returns a null pointer. */
+static struct extent *
+find_best (size_t cnt, block_sector_t *sectorp)
+{
+  struct extent key;
+  struct rb_elem *elem;
+  struct extent *e;
+
+  key.length = cnt;
+  key.start = 0;
+  elem = rb_lower_bound (&by_length, &key.length_elem);
+  if (elem == NULL)
+    return NULL;
+
+  e = rb_entry (elem, struct extent, length_elem);
+  *sectorp = e->start;
+  return e;
+}
+
+/* Removes the CNT sectors starting at SECTOR, which must be at
+   the beginning or the end of extent E, from E.  Frees E if
+   that leaves it empty. */
+static void
+take (struct extent *e, block_sector_t sector, size_t cnt)
+{
+  ASSERT (cnt <= e->length);
+  ASSERT (sector == e->start || sector + cnt == e->start + e->length);
+
+  /* Taking sectors from the beginning of E moves its start, but
+     not past the next extent, so E stays in order in by_start. */
+  rb_remove (&by_length, &e->length_elem);
+  if (sector == e->start)
+    e->start += cnt;
+  e->length -= cnt;
+  if (e->length > 0)
+    rb_insert (&by_length, &e->length_elem);
+  else
+    {
+      rb_remove (&by_start, &e->start_elem);
+      kmem_cache_free (extent_cache, e);
+    }
+}
+
+/* Adds the CNT free sectors starting at SECTOR to the extents,
+   merging them with the extents just before and after, if they
+   are adjacent.  If memory for a new extent is not available,
+   the sectors stay free in the bitmap, but are not allocated
+   again until the free map is next read. */
+static void
+add_extent (block_sector_t sector, size_t cnt)
+{
+  struct extent key, *prev = NULL, *next = NULL, *e;
+  struct rb_elem *elem;
+
+  memset (&key, 0, sizeof key);
+  key.start = sector;
+  elem = rb_lower_bound (&by_start, &key.start_elem);
+  if (elem != NULL)
+    {
+      next = rb_entry (elem, struct extent, start_elem);
+      elem = rb_prev (elem);
+    }
+  else
+    elem = rb_last (&by_start);
+  if (elem != NULL)
+    prev = rb_entry (elem, struct extent, start_elem);
+
+  if (prev != NULL && prev->start + prev->length == sector)
+    {
+      /* Extend PREV, and absorb NEXT if the sectors close the
+         gap between them. */
+      rb_remove (&by_length, &prev->length_elem);
+      prev->length += cnt;
+      if (next != NULL && sector + cnt == next->start)
+        {
+          prev->length += next->length;
+          rb_remove (&by_length, &next->length_elem);
+          rb_remove (&by_start, &next->start_elem);
+          kmem_cache_free (extent_cache, next);
+        }
+      rb_insert (&by_length, &prev->length_elem);
+    }
+  else if (next != NULL && sector + cnt == next->start)
+    {
+      /* Extend NEXT backward, which keeps it in order in
+         by_start. */
+      rb_remove (&by_length, &next->length_elem);
+      next->start = sector;
+      next->length += cnt;
+      rb_insert (&by_length, &next->length_elem);
+    }
+  else
+    {
+      e = kmem_cache_alloc (extent_cache);
+      if (e == NULL)
+        return;
+      e->start = sector;
+      e->length = cnt;
+      rb_insert (&by_start, &e->start_elem);
+      rb_insert (&by_length, &e->length_elem);
+    }
+}
+
+/* Adds the CNT sectors starting at SECTOR, which are free in the
+   bitmap, to TREE, to keep them out of the extents for now.
+   Without memory to remember them, they are not allocated again
+   until the free map is next read, as in add_extent(). */
+static void
+hold (struct rbtree *tree, block_sector_t sector, size_t cnt)
+{
+  struct extent *e = kmem_cache_alloc (extent_cache);
+  if (e != NULL)
+    {
+      e->start = sector;
+      e->length = cnt;
+      rb_insert (tree, &e->start_elem);
+    }
+}
+
+/* Moves the sectors in TREE into the extents. */
+static void
+unhold (struct rbtree *tree)
+{
+  struct rb_elem *elem;
+
+  while ((elem = rb_first (tree)) != NULL)
+    {
+      struct extent *e = rb_entry (elem, struct extent, start_elem);
+      rb_remove (tree, elem);
+      add_extent (e->start, e->length);
+      free_cnt += e->length;
+      kmem_cache_free (extent_cache, e);
+    }
+}
+
+/* Discards any extents and creates them anew from the bitmap. */
+static void
+build_extents (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t start, end;
+  struct rb_elem *elem;
+
+  while ((elem = rb_first (&by_start)) != NULL)
+    {
+      struct extent *e = rb_entry (elem, struct extent, start_elem);
+      rb_remove (&by_start, &e->start_elem);
+      rb_remove (&by_length, &e->length_elem);
+      kmem_cache_free (extent_cache, e);
+    }
+
+  free_cnt = 0;
+  for (start = 0; start < sector_cnt; start = end)
+    {
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+      add_extent (start, end - start);
+      free_cnt += end - start;
+    }
+}
+
+/* Writes the sectors of the free map file that hold the bits for
+   the CNT sectors starting at SECTOR.  Returns true if
+   successful or if the free map file is not open yet, false on
+   failure. */
+static bool
+write_bits (block_sector_t sector, size_t cnt)
+{
+  size_t ofs, end;
+
+  if (free_map_file == NULL)
+    return true;
+
+  ofs = ROUND_DOWN (sector / 8, BLOCK_SECTOR_SIZE);
+  end = ROUND_UP (DIV_ROUND_UP (sector + cnt, 8), BLOCK_SECTOR_SIZE);
+  return bitmap_write_part (free_map, free_map_file, ofs, end - ofs);
+}
@@ -12,6 +12,16 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, size_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_metadata (block_sector_t, size_t);
+bool free_map_short (void);
+void free_map_commit (void);
+void free_map_checkpoint (void);
+
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+bool free_map_allocate_reserved (block_sector_t goal, size_t,
+                                 block_sector_t *);
 
 #endif /* filesys/free-map.h */
@@ -1,23 +1,118 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
+#include <rhash.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A file's data lies in "extents", runs of blocks of the file
+   stored in consecutive sectors.  A block not in any extent is a
+   "hole" that reads as zeros.
+
+   A file grows without allocating sectors at first: its new
+   blocks wait in the buffer cache as "delayed" blocks, with only
+   a sector reserved in the free map for each one.  Once the file
+   is closed, or the cache holds CACHE_DELAYED_MAX delayed blocks,
+   allocate_delayed() gives each run of them consecutive sectors,
+   just after the sectors of the blocks before them, so that a
+   file written from start to end, a little at a time, still ends
+   up in a single extent that the cache can write out in a few
+   large requests.  Allocating sectors for delayed blocks must not
+   fail, because by then their data has been accepted, so room for
+   the extents they may need is set aside before each one is
+   written; if memory runs short, the write stops there instead.
+
+   The extents that do not fit in the inode's own sector go in a
+   chain of extent blocks.  The inode and each extent block say
+   how many extents they hold, and need not be full, so adding an
+   extent changes only the block it goes in, or that block and a
+   new one if it was full, however many blocks follow.  A run of
+   delayed blocks that needs several extents gets them in several
+   journal operations (see journal.c), so that the changes to the
+   free map and to the extent blocks stay within what a single
+   operation may make.  For the same reason, deleting a file
+   whose sectors have their bits in many sectors of the free map
+   frees them in several operations.
+
+   Directories and the free map are metadata, and their blocks go
+   through the journal along with inodes and extent blocks.  They
+   get sectors as soon as they are written, because the journal
+   must know where each block belongs, and the sectors they leave
+   behind are freed with free_map_release_metadata(). */
+struct extent
+  {
+    uint32_t block;                     /* First block within file. */
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of blocks. */
+  };
+
+/* Number of extents in an on-disk inode. */
+#define INODE_EXTENTS 41
+
+/* Number of extents in an extent block. */
+#define BLOCK_EXTENTS 42
+
+/* Number of sectors whose bits lie in one sector of the free
+   map. */
+#define MAP_SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* Most sectors that inode_create() allocates for a file, so that
+   their bits lie in at most two sectors of the free map. */
+#define CREATE_MAX MAP_SECTOR_BITS
+
+/* Most sectors of the free map that deleting a file changes in
+   one operation. */
+#define RELEASE_MAPS 4
+
+/* Sectors of a deleted file being freed. */
+struct release
+  {
+    size_t maps[RELEASE_MAPS];          /* Free map sectors changed
+                                           in this operation. */
+    size_t map_cnt;                     /* Number of them. */
+  };
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents here. */
+    block_sector_t extent_block;        /* First extent block, or 0. */
+    struct extent extents[INODE_EXTENTS]; /* First extents, by block. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
+  };
+
+/* The extents that do not fit in an inode, in a chain of
+   sectors.  Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next extent block, or 0. */
+    uint32_t extent_cnt;                /* Number of extents here. */
+    struct extent extents[BLOCK_EXTENTS]; /* More extents, by block. */
+  };
+
+/* In memory, where a run of an inode's extents is kept on disk:
+   in the inode's own sector for the first, in an extent block
+   for each of the rest. */
+struct extent_node
+  {
+    block_sector_t sector;              /* Inode or extent block. */
+    size_t cnt;                         /* Number of extents. */
+    bool changed;                       /* Changed since written? */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,46 +126,138 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool is_dir;                        /* Directory? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    struct rwlock rwlock;               /* Guards directory contents. */
+    struct lock lock;                   /* Guards members below. */
+    off_t length;                       /* File size in bytes. */
+    struct extent *extents;             /* Extents, in order by block. */
+    size_t extent_cnt;                  /* Number of extents. */
+    size_t extent_cap;                  /* Number of extents allocated. */
+    size_t unallocated_cnt;             /* Blocks reserved, not allocated. */
+    struct extent_node *nodes;          /* Where the extents are kept. */
+    size_t node_cnt;                    /* Number of nodes, at least 1. */
+    size_t node_cap;                    /* Number of nodes allocated. */
+    size_t extent_block_reserve;        /* Sectors reserved for more
+                                           extent blocks. */
+    bool dirty;                         /* Changed since written? */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Returns true if INODE's data is metadata, which goes through
+   the journal. */
+static inline bool
+is_metadata (const struct inode *inode)
+{
+  return inode->is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Returns the number of INODE's extents that start at or before
+   BLOCK. */
+static size_t
+find_extent (const struct inode *inode, block_sector_t block)
+{
+  size_t lo = 0, hi = inode->extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (inode->extents[mid].block <= block)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Returns the sector that holds block BLOCK of INODE, or
+   CACHE_UNMAPPED if it has none.  If RUN is nonnull, stores into
+   *RUN the number of blocks, starting at BLOCK, that lie in
+   consecutive sectors, or 0 if BLOCK has no sector.
+   INODE's lock must be held. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+lookup (const struct inode *inode, block_sector_t block,
+        block_sector_t *run)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  size_t i = find_extent (inode, block);
+
+  if (i > 0)
+    {
+      const struct extent *e = &inode->extents[i - 1];
+      if (block - e->block < e->length)
+        {
+          if (run != NULL)
+            *run = e->length - (block - e->block);
+          return e->start + (block - e->block);
+        }
+    }
+  if (run != NULL)
+    *run = 0;
+  return CACHE_UNMAPPED;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, indexed by sector number, so that opening a
+   single inode twice returns the same `struct inode'.
+   Searching the table requires open_inodes_lock for reading;
+   adding or removing an inode requires it for writing. */
+static struct rhash open_inodes;
+static struct rwlock open_inodes_lock;
+
+/* Cache of struct inode. */
+static struct kmem_cache *inode_cache;
+static kmem_ctor_func inode_ctor;
+
+static struct inode *find_open_inode (block_sector_t);
+static rhash_match_func inode_matches;
+static bool read_inode (struct inode *);
+static void write_inode (struct inode *);
+static void restart_operation (struct inode *);
+static void mark_changed (struct inode *, size_t idx);
+static void extend (struct inode *, off_t length);
+static bool reserve_extents (struct inode *, size_t cnt);
+static bool reserve_extent_blocks (struct inode *, size_t cnt);
+static void allocate_delayed (struct inode *);
+static size_t allocate_blocks (struct inode *, block_sector_t block,
+                               size_t cnt);
+static void release_run (struct release *, block_sector_t sector,
+                         size_t cnt, bool metadata);
+static void release_sector (block_sector_t);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  ASSERT (sizeof (struct inode_disk) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  if (!rhash_init (&open_inodes, inode_matches, NULL))
+    PANIC ("cannot create open inode table");
+  rwlock_init (&open_inodes_lock);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode),
+                                   inode_ctor);
+  if (inode_cache == NULL)
+    PANIC ("cannot create inode cache");
+}
+
+/* Constructor for inode_cache. */
+static void
+inode_ctor (void *inode_) 
+{
+  struct inode *inode = inode_;
+
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  IS_DIR says whether it is a directory.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -85,21 +272,40 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      block_sector_t start;
+
+      /* Past CREATE_MAX sectors, the file is a hole, which reads
+         as zeros and gets sectors when it is written. */
+      if (sectors > CREATE_MAX)
+        sectors = CREATE_MAX;
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->is_dir = is_dir;
+      journal_begin ();
+      if (free_map_allocate_near (sector + 1, sectors, &start))
         {
-          block_write (fs_device, sector, disk_inode);
           if (sectors > 0) 
             {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
+              static char zeros[BLOCK_SECTOR_SIZE * 8];
+              size_t ofs, cnt;
+
+              disk_inode->extent_cnt = 1;
+              disk_inode->extents[0].block = 0;
+              disk_inode->extents[0].start = start;
+              disk_inode->extents[0].length = sectors;
+              for (ofs = 0; ofs < sectors; ofs += cnt)
+                {
+                  cnt = sectors - ofs;
+                  if (cnt > sizeof zeros / BLOCK_SECTOR_SIZE)
+                    cnt = sizeof zeros / BLOCK_SECTOR_SIZE;
+                  block_write_multiple (fs_device, start + ofs, zeros, cnt);
+                }
             }
+          cache_write (CACHE_DEVICE, sector, sector, disk_inode,
+                       0, BLOCK_SECTOR_SIZE, true);
           success = true; 
-        } 
+        }
+      journal_end ();
       free (disk_inode);
     }
   return success;
@@ -111,45 +317,100 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open.  This is the common
+     case, so it only needs a read lock. */
+  rwlock_acquire_read (&open_inodes_lock);
+  inode = inode_reopen (find_open_inode (sector));
+  rwlock_release_read (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
+
+  /* Check again with the write lock held, in case another thread
+     opened it in the meantime. */
+  rwlock_acquire_write (&open_inodes_lock);
+  inode = inode_reopen (find_open_inode (sector));
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      rwlock_release_write (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      rwlock_release_write (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  if (!read_inode (inode))
+    {
+      rwlock_release_write (&open_inodes_lock);
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
+  if (rhash_insert (&open_inodes, hash_int (sector), &sector, inode) != NULL)
+    {
+      rwlock_release_write (&open_inodes_lock);
+      free (inode->extents);
+      free (inode->nodes);
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
+  rwlock_release_write (&open_inodes_lock);
   return inode;
 }
 
-/* Reopens and returns INODE. */
+/* Returns the open inode for SECTOR, or a null pointer if there
+   is none.  open_inodes_lock must be held. */
+static struct inode *
+find_open_inode (block_sector_t sector) 
+{
+  return rhash_find (&open_inodes, hash_int (sector), &sector);
+}
+
+/* Returns true if INODE's sector is *SECTOR.  Used as the match
+   function of open_inodes. */
+static bool
+inode_matches (const void *inode_, const void *sector_, void *aux UNUSED) 
+{
+  const struct inode *inode = inode_;
+  const block_sector_t *sector = sector_;
+
+  return inode->sector == *sector;
+}
+
+/* Reopens and returns INODE.
+   Several readers of open_inodes_lock may reopen the same inode
+   at once, so the count is updated with interrupts off. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      enum intr_level old_level = intr_disable ();
+      inode->open_cnt++;
+      intr_set_level (old_level);
+    }
   return inode;
 }
 
+/* Returns INODE's readers-writer lock.  The directory code holds
+   it for reading while searching a directory and for writing
+   while changing one. */
+struct rwlock *
+inode_get_rwlock (struct inode *inode)
+{
+  return &inode->rwlock;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -159,30 +420,87 @@ inode_get_inumber (const struct inode *inode)
 
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If INODE was also a removed inode, frees its blocks, which may
+   take several journal operations (see journal_restart()). */
 void
 inode_close (struct inode *inode) 
 {
+  enum intr_level old_level;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* The cache cannot find sectors for delayed blocks on its
+     own, so the last opener gives them sectors first.  That may
+     take several operations, between which INODE may be
+     reopened, and then this is not the last opener after all. */
+  journal_begin ();
+  for (;;)
+    {
+      rwlock_acquire_write (&open_inodes_lock);
+      if (inode->open_cnt > 1 || inode->removed
+          || inode->unallocated_cnt == 0)
+        break;
+      rwlock_release_write (&open_inodes_lock);
+
+      lock_acquire (&inode->lock);
+      allocate_delayed (inode);
+      lock_release (&inode->lock);
+    }
+
+  /* Release resources if this was the last opener.  Holding the
+     write lock keeps inode_open() from finding and reopening
+     INODE while it is being freed. */
+  old_level = intr_disable ();
+  last = --inode->open_cnt == 0;
+  intr_set_level (old_level);
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      /* Write out the inode before another thread can read it
+         afresh. */
+      if (!inode->removed)
+        {
+          lock_acquire (&inode->lock);
+          ASSERT (inode->unallocated_cnt == 0);
+          if (inode->dirty)
+            write_inode (inode);
+          lock_release (&inode->lock);
+        }
+
+      /* Remove from inode table and release lock. */
+      rhash_delete (&open_inodes, hash_int (inode->sector), &inode->sector);
+      rwlock_release_write (&open_inodes_lock);
+
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          /* Deallocate blocks, throwing away cached data. */
+          struct release r;
+          size_t i;
+
+          r.map_cnt = 0;
+          free_map_unreserve (cache_discard (inode->sector));
+          for (i = 0; i < inode->extent_cnt; i++)
+            release_run (&r, inode->extents[i].start,
+                         inode->extents[i].length, is_metadata (inode));
+          for (i = 1; i < inode->node_cnt; i++)
+            {
+              cache_discard_sector (inode->nodes[i].sector);
+              release_run (&r, inode->nodes[i].sector, 1, true);
+            }
+          cache_discard_sector (inode->sector);
+          release_run (&r, inode->sector, 1, true);
         }
 
-      free (inode); 
+      free_map_unreserve (inode->extent_block_reserve);
+      free (inode->extents);
+      free (inode->nodes);
+      kmem_cache_free (inode_cache, inode);
     }
+  else
+    rwlock_release_write (&open_inodes_lock);
+  journal_end ();
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,6 +512,20 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->is_dir;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,117 +534,131 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
-  while (size > 0) 
+  lock_acquire (&inode->lock);
+  while (size > 0)
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      /* Block to read, starting byte offset within block. */
+      block_sector_t block = offset / BLOCK_SECTOR_SIZE;
+      int block_ofs = offset % BLOCK_SECTOR_SIZE;
+      block_sector_t sector, run;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      /* Bytes left in inode, bytes left in block, lesser of the two. */
+      off_t inode_left = inode->length - offset;
+      int block_left = BLOCK_SECTOR_SIZE - block_ofs;
+      int min_left = inode_left < block_left ? inode_left : block_left;
 
-      /* Number of bytes to actually copy out of this sector. */
+      /* Number of bytes to actually copy out of this block. */
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
-      
+      sector = lookup (inode, block, &run);
+      cache_read (inode->sector, block, sector, run, buffer + bytes_read,
+                  block_ofs, chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  lock_release (&inode->lock);
 
   return bytes_read;
 }
 
+/* Makes INODE at least LENGTH bytes long.
+   INODE's lock must be held. */
+static void
+extend (struct inode *inode, off_t length)
+{
+  if (length > inode->length)
+    {
+      inode->length = length;
+      inode->dirty = true;
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or an error occurs.
+   Writing past end of file extends INODE; blocks that did not
+   exist before become delayed blocks (see the top of this
+   file). */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
-  while (size > 0) 
+  journal_begin ();
+  lock_acquire (&inode->lock);
+  while (size > 0)
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      /* Block to write, starting byte offset within block. */
+      block_sector_t block = offset / BLOCK_SECTOR_SIZE;
+      int block_ofs = offset % BLOCK_SECTOR_SIZE;
+      block_sector_t sector = lookup (inode, block, NULL);
+      bool new_block = (sector == CACHE_UNMAPPED
+                        && !cache_contains (inode->sector, block));
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      /* Number of bytes to actually write into this block. */
+      int block_left = BLOCK_SECTOR_SIZE - block_ofs;
+      int chunk_size = size < block_left ? size : block_left;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (new_block && cache_delayed_cnt () >= CACHE_DELAYED_MAX)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Make room for another delayed block.  INODE's lock is
+             released meanwhile, so look the block up again. */
+          allocate_delayed (inode);
+          sector = lookup (inode, block, NULL);
+          new_block = (sector == CACHE_UNMAPPED
+                       && !cache_contains (inode->sector, block));
         }
-      else 
+      if (new_block)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          /* Reserve a sector for the new block, but put off
+             choosing one, and room for the extent it may need. */
+          if (!reserve_extents (inode, inode->unallocated_cnt + 1)
+              || !reserve_extent_blocks (inode, inode->unallocated_cnt + 1)
+              || !free_map_reserve (1))
+            break;
+          inode->unallocated_cnt++;
+        }
+      cache_write (inode->sector, block, sector, buffer + bytes_written,
+                   block_ofs, chunk_size, is_metadata (inode));
+      if (new_block && (is_metadata (inode)
+                        || cache_delayed_cnt () > CACHE_DELAYED_MAX))
+        {
+          /* The journal needs a sector for a metadata block, and
+             otherwise other files' delayed blocks fill the cache's
+             quota, so this one cannot wait. */
+          allocate_blocks (inode, block, 1);
         }
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
+
+      /* Allocating sectors changed the free map and the extents.
+         Record them in an operation of their own, so that a long
+         write does not outgrow a transaction. */
+      if (inode->dirty && size > 0)
+        {
+          extend (inode, offset);
+          restart_operation (inode);
+        }
     }
-  free (bounce);
+  extend (inode, offset);
+  if (inode->dirty)
+    write_inode (inode);
+  lock_release (&inode->lock);
+  journal_end ();
 
   return bytes_written;
 }
@@ -341,5 +687,477 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
+}
+
+/* Reads INODE's length and extents from its sector and its
+   extent blocks.  Returns true if successful, false if memory
+   allocation fails. */
+static bool
+read_inode (struct inode *inode)
+{
+  void *buffer = malloc (BLOCK_SECTOR_SIZE);
+  struct inode_disk *disk = buffer;
+  struct extent_block *eb = buffer;
+  const struct extent *extents;
+  block_sector_t sector, next;
+  size_t cnt;
+
+  inode->extents = NULL;
+  inode->extent_cnt = inode->extent_cap = 0;
+  inode->unallocated_cnt = 0;
+  inode->nodes = NULL;
+  inode->node_cnt = inode->node_cap = 0;
+  inode->extent_block_reserve = 0;
+  inode->dirty = false;
+  if (buffer == NULL)
+    return false;
+
+  cache_read (CACHE_DEVICE, inode->sector, inode->sector, 1, disk,
+              0, BLOCK_SECTOR_SIZE);
+  inode->length = disk->length;
+  inode->is_dir = disk->is_dir != 0;
+  sector = inode->sector;
+  next = disk->extent_block;
+  cnt = disk->extent_cnt;
+  extents = disk->extents;
+  for (;;)
+    {
+      struct extent_node *node;
+
+      if (!reserve_extents (inode, cnt + 1))
+        goto error;
+      memcpy (inode->extents + inode->extent_cnt, extents,
+              cnt * sizeof *extents);
+      inode->extent_cnt += cnt;
+      node = &inode->nodes[inode->node_cnt++];
+      node->sector = sector;
+      node->cnt = cnt;
+      node->changed = false;
+      if (next == 0)
+        break;
+
+      sector = next;
+      cache_read (CACHE_DEVICE, sector, sector, 1, eb, 0, BLOCK_SECTOR_SIZE);
+      next = eb->next;
+      cnt = eb->extent_cnt;
+      extents = eb->extents;
+    }
+  free (buffer);
+  return true;
+
+ error:
+  free (inode->extents);
+  free (inode->nodes);
+  free (buffer);
+  return false;
+}
+
+/* Writes INODE's length, and the extents that it holds itself,
+   to its sector, and the extents in each extent block changed
+   since the last write to that block.  Leaves INODE dirty, to
+   try again later, if memory runs short.
+   INODE's lock must be held. */
+static void
+write_inode (struct inode *inode)
+{
+  void *buffer = malloc (BLOCK_SECTOR_SIZE);
+  struct inode_disk *disk = buffer;
+  struct extent_block *eb = buffer;
+  size_t first, i;
+
+  if (buffer == NULL)
+    return;
+
+  memset (disk, 0, BLOCK_SECTOR_SIZE);
+  disk->length = inode->length;
+  if (inode->extent_cnt == 0)
+    disk->length = 0;
+  else
+    {
+      /* Record no more of the file than has sectors, so that
+         after a crash the file does not end in delayed blocks
+         that never reached the disk. */
+      const struct extent *last = &inode->extents[inode->extent_cnt - 1];
+      off_t end = (off_t) (last->block + last->length) * BLOCK_SECTOR_SIZE;
+      if (disk->length > end)
+        disk->length = end;
+    }
+  disk->magic = INODE_MAGIC;
+  disk->is_dir = inode->is_dir;
+  disk->extent_cnt = inode->nodes[0].cnt;
+  disk->extent_block = inode->node_cnt > 1 ? inode->nodes[1].sector : 0;
+  memcpy (disk->extents, inode->extents,
+          inode->nodes[0].cnt * sizeof *inode->extents);
+  cache_write (CACHE_DEVICE, inode->sector, inode->sector, disk,
+               0, BLOCK_SECTOR_SIZE, true);
+  inode->nodes[0].changed = false;
+
+  first = inode->nodes[0].cnt;
+  for (i = 1; i < inode->node_cnt; i++)
+    {
+      struct extent_node *node = &inode->nodes[i];
+      if (node->changed)
+        {
+          memset (eb, 0, BLOCK_SECTOR_SIZE);
+          eb->next = i + 1 < inode->node_cnt ? inode->nodes[i + 1].sector : 0;
+          eb->extent_cnt = node->cnt;
+          memcpy (eb->extents, inode->extents + first,
+                  node->cnt * sizeof *eb->extents);
+          cache_write (CACHE_DEVICE, node->sector, node->sector, eb,
+                       0, BLOCK_SECTOR_SIZE, true);
+          node->changed = false;
+        }
+      first += node->cnt;
+    }
+  free (buffer);
+  inode->dirty = false;
+}
+
+/* Writes INODE if it has changed and ends the current operation,
+   then begins another, so that a long series of changes to
+   INODE's sectors and extents does not outgrow a transaction.
+   Another operation may have to end before the next one begins,
+   so INODE's lock is released while waiting.
+   INODE's lock must be held. */
+static void
+restart_operation (struct inode *inode)
+{
+  if (inode->dirty)
+    write_inode (inode);
+  lock_release (&inode->lock);
+  journal_end ();
+  journal_begin ();
+  lock_acquire (&inode->lock);
+}
+
+/* Returns the number of extents that node IDX of an inode can
+   hold. */
+static size_t
+node_capacity (size_t idx)
+{
+  return idx == 0 ? INODE_EXTENTS : BLOCK_EXTENTS;
+}
+
+/* Returns the index of INODE's node that holds extent IDX, or of
+   its last node if IDX is the number of extents, and stores the
+   index of the node's first extent into *FIRSTP. */
+static size_t
+find_node (const struct inode *inode, size_t idx, size_t *firstp)
+{
+  size_t first = 0;
+  size_t i;
+
+  for (i = 0; i + 1 < inode->node_cnt; i++)
+    {
+      if (idx < first + inode->nodes[i].cnt)
+        break;
+      first += inode->nodes[i].cnt;
+    }
+  *firstp = first;
+  return i;
+}
+
+/* Records that INODE's extent IDX has changed. */
+static void
+mark_changed (struct inode *inode, size_t idx)
+{
+  size_t first;
+
+  inode->nodes[find_node (inode, idx, &first)].changed = true;
+  inode->dirty = true;
+}
+
+/* Counts a new extent, to be inserted into INODE's extents at
+   index IDX, in the node that will hold it.  If that node is
+   full, it is split in two, and the new half gets an extent
+   block from the sectors reserved for them.  The caller must
+   have made room for another node. */
+static void
+grow_node (struct inode *inode, size_t idx)
+{
+  size_t first;
+  size_t i = find_node (inode, idx, &first);
+  struct extent_node *node = &inode->nodes[i];
+
+  ASSERT (inode->node_cnt < inode->node_cap);
+
+  if (idx == first && i > 0 && node[-1].cnt < node_capacity (i - 1))
+    {
+      /* The start of one node is also the end of the one before,
+         which has room. */
+      node--;
+    }
+  else if (node->cnt == node_capacity (i))
+    {
+      /* Keep the first half here and move the rest to a new node
+         after it, or, if the extent goes at the end of the file,
+         as when a file grows, keep them all and start a new node
+         with just the new extent. */
+      size_t keep = idx - first == node->cnt ? node->cnt : node->cnt / 2;
+      struct extent_node *half = node + 1;
+
+      memmove (half + 1, half, (inode->node_cnt - i - 1) * sizeof *half);
+      inode->node_cnt++;
+      ASSERT (inode->extent_block_reserve > 0);
+      if (!free_map_allocate_reserved (inode->sector + 1, 1, &half->sector))
+        NOT_REACHED ();
+      inode->extent_block_reserve--;
+      half->cnt = node->cnt - keep;
+      half->changed = true;
+      node->cnt = keep;
+      node->changed = true;
+      if (idx - first > keep || keep == node_capacity (i))
+        node = half;
+    }
+  node->cnt++;
+  node->changed = true;
+  inode->dirty = true;
+}
+
+/* Stops counting INODE's extent IDX, which is being removed, in
+   the node that holds it, and frees that node if it is an extent
+   block and has no extents left. */
+static void
+shrink_node (struct inode *inode, size_t idx)
+{
+  size_t first;
+  size_t i = find_node (inode, idx, &first);
+  struct extent_node *node = &inode->nodes[i];
+
+  node->cnt--;
+  node->changed = true;
+  if (node->cnt == 0 && i > 0)
+    {
+      release_sector (node->sector);
+      memmove (node, node + 1, (inode->node_cnt - i - 1) * sizeof *node);
+      inode->node_cnt--;
+      inode->nodes[i - 1].changed = true;
+    }
+  inode->dirty = true;
+}
+
+/* Adds an extent to INODE that maps the LENGTH blocks starting
+   at BLOCK, which must not be mapped yet, to the sectors
+   starting at START, merging it with its neighbors where it
+   continues them.  The caller must have made room for one more
+   extent. */
+static void
+add_extent (struct inode *inode, block_sector_t block, block_sector_t start,
+            size_t length)
+{
+  size_t i = find_extent (inode, block);
+  struct extent *prev = i > 0 ? &inode->extents[i - 1] : NULL;
+  struct extent *next = (i < inode->extent_cnt
+                         ? &inode->extents[i] : NULL);
+  bool join_prev = (prev != NULL && prev->block + prev->length == block
+                    && prev->start + prev->length == start);
+  bool join_next = (next != NULL && block + length == next->block
+                    && start + length == next->start);
+
+  ASSERT (inode->extent_cnt < inode->extent_cap);
+
+  if (join_prev)
+    {
+      mark_changed (inode, i - 1);
+      prev->length += length;
+      if (join_next)
+        {
+          prev->length += next->length;
+          shrink_node (inode, i);
+          memmove (next, next + 1,
+                   (inode->extent_cnt - i - 1) * sizeof *next);
+          inode->extent_cnt--;
+        }
+    }
+  else if (join_next)
+    {
+      mark_changed (inode, i);
+      next->block = block;
+      next->start = start;
+      next->length += length;
+    }
+  else
+    {
+      struct extent *e = &inode->extents[i];
+      grow_node (inode, i);
+      memmove (e + 1, e, (inode->extent_cnt - i) * sizeof *e);
+      e->block = block;
+      e->start = start;
+      e->length = length;
+      inode->extent_cnt++;
+    }
+}
+
+/* Makes sure that INODE has room for CNT extents beyond those
+   it has, and for as many more nodes.  Returns true if
+   successful, false if memory runs short.
+   INODE's lock must be held. */
+static bool
+reserve_extents (struct inode *inode, size_t cnt)
+{
+  if (inode->extent_cnt + cnt > inode->extent_cap)
+    {
+      size_t cap = inode->extent_cap * 2;
+      struct extent *extents;
+
+      if (cap < inode->extent_cnt + cnt)
+        cap = inode->extent_cnt + cnt;
+      extents = realloc (inode->extents, cap * sizeof *extents);
+      if (extents == NULL)
+        return false;
+      inode->extents = extents;
+      inode->extent_cap = cap;
+    }
+  if (inode->node_cnt + cnt > inode->node_cap)
+    {
+      size_t cap = inode->node_cap * 2;
+      struct extent_node *nodes;
+
+      if (cap < inode->node_cnt + cnt)
+        cap = inode->node_cnt + cnt;
+      nodes = realloc (inode->nodes, cap * sizeof *nodes);
+      if (nodes == NULL)
+        return false;
+      inode->nodes = nodes;
+      inode->node_cap = cap;
+    }
+  return true;
+}
+
+/* Makes INODE's reservation of sectors for new extent blocks
+   match what CNT more extents could need: one apiece, since
+   each may split a full node, unless all of them fit in the
+   inode itself.  Returns true if successful, false if the disk
+   is full.
+   INODE's lock must be held. */
+static bool
+reserve_extent_blocks (struct inode *inode, size_t cnt)
+{
+  size_t need = (inode->node_cnt == 1
+                 && inode->extent_cnt + cnt <= INODE_EXTENTS ? 0 : cnt);
+
+  if (need > inode->extent_block_reserve)
+    {
+      if (!free_map_reserve (need - inode->extent_block_reserve))
+        return false;
+    }
+  else
+    free_map_unreserve (inode->extent_block_reserve - need);
+  inode->extent_block_reserve = need;
+  return true;
+}
+
+/* Gives up to CNT blocks of INODE starting at BLOCK, which have
+   sectors reserved but not allocated, consecutive sectors, right
+   after the sectors of the blocks before them if possible, and
+   tells the cache where they are.  Returns the number of blocks
+   given sectors, at least 1.  Adds at most one extent, and
+   inode_write_at() made room for one per unallocated block, so
+   this cannot fail.
+   INODE's lock must be held. */
+static size_t
+allocate_blocks (struct inode *inode, block_sector_t block, size_t cnt)
+{
+  size_t i = find_extent (inode, block);
+  block_sector_t goal, start;
+  size_t j;
+
+  ASSERT (cnt > 0 && cnt <= inode->unallocated_cnt);
+
+  if (i > 0)
+    goal = inode->extents[i - 1].start + inode->extents[i - 1].length;
+  else
+    goal = inode->sector + 1;
+
+  /* The sectors are reserved, so some of them, if not all
+     together, can always be had. */
+  while (!free_map_allocate_reserved (goal, cnt, &start))
+    {
+      cnt /= 2;
+      ASSERT (cnt > 0);
+    }
+
+  add_extent (inode, block, start, cnt);
+  for (j = 0; j < cnt; j++)
+    cache_set_sector (inode->sector, block + j, start + j);
+  inode->unallocated_cnt -= cnt;
+
+  /* Fewer blocks wait for sectors now, so this only gives back
+     sectors reserved for extent blocks, and cannot fail. */
+  reserve_extent_blocks (inode, inode->unallocated_cnt);
+  return cnt;
+}
+
+/* Allocates sectors for all of INODE's delayed blocks, a run of
+   consecutive blocks at a time, each in an operation of its own.
+   INODE's lock is released between operations, so another
+   thread may give some of the blocks sectors meanwhile.
+   INODE's lock must be held, within an operation. */
+static void
+allocate_delayed (struct inode *inode)
+{
+  block_sector_t blocks[CACHE_DELAYED_MAX];
+  size_t cnt;
+
+  while ((cnt = cache_get_delayed (inode->sector, blocks,
+                                   CACHE_DELAYED_MAX)) > 0)
+    {
+      size_t run;
+
+      for (run = 1; run < cnt && blocks[run] == blocks[run - 1] + 1; run++)
+        continue;
+      allocate_blocks (inode, blocks[0], run);
+      restart_operation (inode);
+    }
+}
+
+/* Frees the CNT sectors starting at SECTOR for R, with
+   free_map_release_metadata() if METADATA is true, otherwise
+   with free_map_release().  If that would change more than
+   RELEASE_MAPS sectors of the free map in the current journal
+   operation, starts another one first.  The deleted file is in
+   no directory, so a crash between them only leaves the sectors
+   not yet freed in use. */
+static void
+release_run (struct release *r, block_sector_t sector, size_t cnt,
+             bool metadata)
+{
+  while (cnt > 0)
+    {
+      size_t map = sector / MAP_SECTOR_BITS;
+      size_t part = (map + 1) * MAP_SECTOR_BITS - sector;
+      size_t i;
+
+      if (part > cnt)
+        part = cnt;
+      for (i = 0; i < r->map_cnt; i++)
+        if (r->maps[i] == map)
+          break;
+      if (i == r->map_cnt)
+        {
+          if (r->map_cnt == RELEASE_MAPS)
+            {
+              journal_restart ();
+              r->map_cnt = 0;
+            }
+          r->maps[r->map_cnt++] = map;
+        }
+
+      if (metadata)
+        free_map_release_metadata (sector, part);
+      else
+        free_map_release (sector, part);
+      sector += part;
+      cnt -= part;
+    }
+}
+
+/* Frees SECTOR, which holds an inode or an extent block, and
+   drops it from the cache. */
+static void
+release_sector (block_sector_t sector)
+{
+  cache_discard_sector (sector);
+  free_map_release_metadata (sector, 1);
 }
@@ -0,0 +1,464 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/rtc.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Creating or deleting a file changes several sectors of
+   metadata: the free map, an inode, a directory.  A crash that
+   leaves only some of them on disk would leave the file system
+   inconsistent, so changes to metadata go to disk in
+   "transactions", all or nothing.  Each operation that changes
+   metadata runs between journal_begin() and journal_end(), and
+   its changes stay in the buffer cache, where they cannot be
+   evicted (see cache.c), until the journal commits them.
+
+   The journal lives in JOURNAL_SECTORS sectors starting at
+   JOURNAL_SECTOR.  The first sector is a header; the rest form a
+   circular log.  To commit, the journal first writes back dirty
+   file data, so that committed metadata never points to blocks
+   that hold something old, then writes a descriptor that lists
+   the sectors of the uncommitted metadata blocks, copies of the
+   blocks themselves, and a commit record with a checksum of the
+   rest, all in a single request.  After that, the blocks may be
+   written to their own sectors whenever the cache likes.
+
+   Commits are grouped: one happens only when no operation is in
+   progress, and then only once GROUP_BLOCKS blocks are waiting
+   or GROUP_TICKS have passed since the last, so that a burst of
+   creates and removes costs one log write instead of one per
+   sector.  (Or sooner, if the free map is short of sectors:
+   sectors freed by a transaction cannot be used again until it
+   commits; see free-map.c.)
+
+   A transaction must fit in TXN_MAX blocks, but while operations
+   overlap, none of them ends with no other in progress, so
+   nothing commits.  Each operation therefore counts on making at
+   most OP_MAX blocks uncommitted (journal_count_block() checks
+   that it keeps to this), and journal_begin() makes a new
+   one wait until the transaction has room for that on top of
+   what is uncommitted and what the operations in progress may
+   still add.  Once no operation is in progress, the last to end
+   commits and lets the waiters in.  An operation nested in
+   another, on the same thread, counts as part of it.
+
+   When the log runs short of space, a "checkpoint" writes every
+   dirty block to its sector and empties the log, recording in
+   the header where the next transaction goes.  At boot,
+   journal_init() writes the blocks of every transaction from
+   there on that committed in full back to their sectors, in
+   order, and so brings the metadata to the state after the last
+   commit. */
+
+/* Identifies the journal header, a descriptor, and a commit
+   record. */
+#define HEADER_MAGIC 0x4a524e4c
+#define DESCRIPTOR_MAGIC 0x4a445343
+#define COMMIT_MAGIC 0x4a434d54
+
+/* The log. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_SECTORS (JOURNAL_SECTORS - 1)
+
+/* Most blocks in a transaction.  Uncommitted blocks cannot be
+   evicted, so this and CACHE_DELAYED_MAX together must stay
+   below CACHE_SIZE. */
+#define TXN_MAX 24
+
+/* Most blocks a single operation may make uncommitted.  Making a
+   directory entry that grows its directory comes closest. */
+#define OP_MAX 10
+
+/* A commit happens once this many blocks are uncommitted... */
+#define GROUP_BLOCKS 8
+
+/* ...or this many timer ticks after the last commit. */
+#define GROUP_TICKS TIMER_FREQ
+
+/* Journal header, in JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    uint32_t magic;                     /* HEADER_MAGIC. */
+    uint32_t id;                        /* Set when formatted. */
+    uint32_t seq;                       /* Number of next transaction. */
+    uint32_t tail;                      /* Where it goes in the log. */
+    uint32_t unused[124];               /* Not used. */
+  };
+
+/* First sector of a transaction.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct descriptor
+  {
+    uint32_t magic;                     /* DESCRIPTOR_MAGIC. */
+    uint32_t id;                        /* Journal's id. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t cnt;                       /* Number of blocks. */
+    block_sector_t sectors[124];        /* Where each block belongs. */
+  };
+
+/* Last sector of a transaction.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct commit_record
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t id;                        /* Journal's id. */
+    uint32_t seq;                       /* Transaction number. */
+    unsigned checksum;                  /* Of descriptor and blocks. */
+    uint32_t unused[124];               /* Not used. */
+  };
+
+static struct lock journal_lock;    /* Protects everything here. */
+static struct condition txn_room;   /* Signaled when an operation ends. */
+static int op_cnt;                  /* Outermost operations in progress. */
+static uint32_t id;                 /* Journal's id. */
+static uint32_t seq;                /* Number of next transaction. */
+static uint32_t head;               /* Where it goes in the log. */
+static uint32_t used;               /* Log sectors used since the
+                                       last checkpoint. */
+static int64_t commit_time;         /* Timer ticks at last commit. */
+static uint8_t *buffer;             /* TXN_MAX + 2 sectors. */
+
+/* Statistics. */
+static long long txn_cnt;           /* Transactions committed. */
+static long long committed_cnt;     /* Blocks committed. */
+static long long checkpoint_cnt;    /* Checkpoints. */
+
+static void start_op (void);
+static void end_op (void);
+static bool replay (void);
+static void commit (void);
+static void checkpoint (void);
+static void write_header (void);
+static void write_log (uint32_t pos, const void *, size_t cnt);
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise, recovers the metadata from the journal on
+   disk. */
+void
+journal_init (bool format)
+{
+  size_t replayed = 0;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct descriptor) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct commit_record) == BLOCK_SECTOR_SIZE);
+  ASSERT (TXN_MAX + CACHE_DELAYED_MAX < CACHE_SIZE);
+  ASSERT (TXN_MAX + 2 <= LOG_SECTORS);
+  ASSERT (GROUP_BLOCKS + OP_MAX <= TXN_MAX);
+
+  lock_init (&journal_lock);
+  lock_set_name (&journal_lock, "journal");
+  cond_init (&txn_room);
+  buffer = palloc_get_multiple (PAL_ASSERT,
+                                DIV_ROUND_UP ((TXN_MAX + 2)
+                                              * BLOCK_SECTOR_SIZE, PGSIZE));
+
+  if (format)
+    {
+      /* A new id keeps transactions left in the log by an earlier
+         file system on the same disk from being replayed. */
+      id = rtc_get_time ();
+      seq = 1;
+      head = 0;
+    }
+  else
+    {
+      struct journal_header *h = (struct journal_header *) buffer;
+
+      block_read (fs_device, JOURNAL_SECTOR, h);
+      if (h->magic != HEADER_MAGIC)
+        PANIC ("file system has no journal");
+      id = h->id;
+      seq = h->seq;
+      head = h->tail % LOG_SECTORS;
+      while (replay ())
+        replayed++;
+      if (replayed > 0)
+        printf ("Journal: replayed %zu transactions.\n", replayed);
+    }
+  write_header ();
+  commit_time = timer_ticks ();
+}
+
+/* Starts an operation that changes metadata, which may make up
+   to OP_MAX blocks uncommitted.  Operations may nest.  An
+   outermost operation may have to wait for a commit, so the
+   caller must not hold any lock that an operation in progress
+   might need, such as an inode's. */
+void
+journal_begin (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_depth++ > 0)
+    return;
+  cur->journal_blocks = 0;
+
+  lock_acquire (&journal_lock);
+  start_op ();
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation that changes metadata, and commits its
+   changes, along with any others waiting, if it is time.
+   The caller must not hold any lock that a commit might need,
+   such as the free map's or the buffer cache's. */
+void
+journal_end (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth > 0);
+  if (--cur->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  end_op ();
+  lock_release (&journal_lock);
+}
+
+/* Ends the current thread's operation, even if it is nested in
+   others, and begins another in its place, so that a change too
+   big for one operation can be made a piece at a time.  What has
+   been done so far may commit without the rest, so each piece
+   must leave the file system consistent.  Like an outermost
+   journal_begin(), this may wait for a commit, so the caller
+   must not hold any lock that an operation in progress might
+   need. */
+void
+journal_restart (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->journal_depth > 0);
+  cur->journal_blocks = 0;
+
+  lock_acquire (&journal_lock);
+  end_op ();
+  start_op ();
+  lock_release (&journal_lock);
+}
+
+/* Counts a block that the current thread's operation has made
+   uncommitted, and panics if that makes more than OP_MAX, which
+   would let a transaction outgrow TXN_MAX.  Blocks changed
+   outside any operation, while the file system is formatted or
+   recovered, are not counted. */
+void
+journal_count_block (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->journal_depth > 0)
+    {
+      cur->journal_blocks++;
+      ASSERT (cur->journal_blocks <= OP_MAX);
+    }
+}
+
+/* Waits for the operations in progress to end, then commits any
+   changes still waiting and writes everything in the cache to its
+   sectors, leaving the journal empty.  The caller must not be in
+   an operation. */
+void
+journal_flush (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (op_cnt > 0)
+    cond_wait (&txn_room, &journal_lock);
+  commit ();
+  checkpoint ();
+  lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld transactions, %lld blocks committed, "
+          "%lld checkpoints\n", txn_cnt, committed_cnt, checkpoint_cnt);
+}
+
+/* Waits until the transaction has room for another operation,
+   committing it if no operation is in progress, and counts the
+   new one in.
+   journal_lock must be held. */
+static void
+start_op (void)
+{
+  while (cache_uncommitted_cnt () + (op_cnt + 1) * OP_MAX > TXN_MAX)
+    {
+      if (op_cnt == 0)
+        commit ();
+      else
+        cond_wait (&txn_room, &journal_lock);
+    }
+  op_cnt++;
+}
+
+/* Counts an operation out, commits if it was the last in
+   progress and it is time, and lets waiting operations in.
+   journal_lock must be held. */
+static void
+end_op (void)
+{
+  ASSERT (op_cnt > 0);
+  if (--op_cnt == 0)
+    {
+      size_t cnt = cache_uncommitted_cnt ();
+      if (cnt >= GROUP_BLOCKS
+          || (cnt > 0 && (timer_elapsed (commit_time) >= GROUP_TICKS
+                          || free_map_short ())))
+        commit ();
+    }
+  cond_broadcast (&txn_room, &journal_lock);
+}
+
+/* Reads the log sector at POS, modulo the size of the log, into
+   BUF. */
+static void
+read_log (uint32_t pos, void *buf)
+{
+  block_read (fs_device, LOG_START + pos % LOG_SECTORS, buf);
+}
+
+/* If the transaction at the head of the log is the next one and
+   committed in full, writes its blocks to their sectors, moves
+   past it, and returns true.  Otherwise, returns false. */
+static bool
+replay (void)
+{
+  struct descriptor *d = (struct descriptor *) buffer;
+  struct commit_record *c;
+  uint32_t i;
+
+  read_log (head, d);
+  if (d->magic != DESCRIPTOR_MAGIC || d->id != id || d->seq != seq
+      || d->cnt == 0 || d->cnt > TXN_MAX)
+    return false;
+  for (i = 0; i <= d->cnt; i++)
+    read_log (head + 1 + i, buffer + (i + 1) * BLOCK_SECTOR_SIZE);
+  c = (struct commit_record *) (buffer + (d->cnt + 1) * BLOCK_SECTOR_SIZE);
+  if (c->magic != COMMIT_MAGIC || c->id != id || c->seq != seq
+      || c->checksum != hash_bytes (buffer,
+                                    (d->cnt + 1) * BLOCK_SECTOR_SIZE))
+    return false;
+
+  for (i = 0; i < d->cnt; i++)
+    block_write (fs_device, d->sectors[i],
+                 buffer + (i + 1) * BLOCK_SECTOR_SIZE);
+  head = (head + d->cnt + 2) % LOG_SECTORS;
+  seq++;
+  return true;
+}
+
+/* Commits the uncommitted blocks in the cache as a transaction,
+   and checkpoints if the log is running short of space.
+   journal_lock must be held and no operation in progress. */
+static void
+commit (void)
+{
+  struct descriptor *d = (struct descriptor *) buffer;
+  struct commit_record *c;
+  size_t cnt;
+
+  ASSERT (op_cnt == 0);
+  if (cache_uncommitted_cnt () > TXN_MAX)
+    PANIC ("journal: %zu blocks in one transaction",
+           cache_uncommitted_cnt ());
+
+  /* Write file data first ("ordered" mode). */
+  cache_flush (true);
+
+  memset (d, 0, BLOCK_SECTOR_SIZE);
+  cnt = cache_get_uncommitted (d->sectors, buffer + BLOCK_SECTOR_SIZE,
+                               TXN_MAX);
+  commit_time = timer_ticks ();
+  if (cnt == 0)
+    return;
+  d->magic = DESCRIPTOR_MAGIC;
+  d->id = id;
+  d->seq = seq;
+  d->cnt = cnt;
+
+  c = (struct commit_record *) (buffer + (cnt + 1) * BLOCK_SECTOR_SIZE);
+  memset (c, 0, BLOCK_SECTOR_SIZE);
+  c->magic = COMMIT_MAGIC;
+  c->id = id;
+  c->seq = seq;
+  c->checksum = hash_bytes (buffer, (cnt + 1) * BLOCK_SECTOR_SIZE);
+
+  write_log (head, buffer, cnt + 2);
+  cache_commit ();
+  free_map_commit ();
+  head = (head + cnt + 2) % LOG_SECTORS;
+  used += cnt + 2;
+  seq++;
+  txn_cnt++;
+  committed_cnt += cnt;
+
+  if (LOG_SECTORS - used < TXN_MAX + 2)
+    checkpoint ();
+}
+
+/* Writes every committed block to its sector and empties the
+   log.  Sectors freed since the last checkpoint that held
+   metadata can then be used again.
+   journal_lock must be held. */
+static void
+checkpoint (void)
+{
+  cache_flush (false);
+  used = 0;
+  write_header ();
+  free_map_checkpoint ();
+  checkpoint_cnt++;
+}
+
+/* Writes the journal header, which says that the log starts at
+   its current head. */
+static void
+write_header (void)
+{
+  struct journal_header *h = (struct journal_header *) buffer;
+
+  memset (h, 0, BLOCK_SECTOR_SIZE);
+  h->magic = HEADER_MAGIC;
+  h->id = id;
+  h->seq = seq;
+  h->tail = head;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+}
+
+/* Writes the CNT sectors in BUF to the log starting at POS,
+   wrapping around at the end of the log. */
+static void
+write_log (uint32_t pos, const void *buf, size_t cnt)
+{
+  size_t first = LOG_SECTORS - pos;
+
+  if (first > cnt)
+    first = cnt;
+  block_write_multiple (fs_device, LOG_START + pos, buf, first);
+  if (cnt > first)
+    block_write_multiple (fs_device, LOG_START,
+                          (const uint8_t *) buf + first * BLOCK_SECTOR_SIZE,
+                          cnt - first);
+}
@@ -0,0 +1,14 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_restart (void);
+void journal_count_block (void);
+void journal_flush (void);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -60,6 +60,38 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns an elem_type with the CNT bits starting at bit OFS
+   turned on.  OFS + CNT must be at most ELEM_BITS, and CNT must
+   be nonzero. */
+static inline elem_type
+span_mask (size_t ofs, size_t cnt) 
+{
+  elem_type mask = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1 : (elem_type) -1;
+  return mask << ofs;
+}
+
+/* Returns the index of the least significant 1-bit in X, which
+   must be nonzero.  See the description of the BSF instruction
+   in [IA32-v2a]. */
+static inline size_t
+first_set (elem_type x) 
+{
+  size_t idx;
+
+  asm ("bsfl %1, %0" : "=r" (idx) : "rm" (x) : "cc");
+  return idx;
+}
+
+/* Returns the number of 1-bits in X. */
+static inline size_t
+count_set (elem_type x) 
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -213,18 +245,36 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* The functions below work an element at a time: each step
+   handles the part of the range that falls within one element,
+   using a mask from span_mask(). */
+
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, as by bitmap_set(), but
+   not the range as a whole. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t i, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start, end = start + cnt; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+      elem_type mask = span_mask (ofs, n);
+      elem_type *e = &b->bits[elem_idx (i)];
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "+m" (*e) : "r" (~mask) : "cc");
+      i += n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +282,22 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t i, end, set_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  set_cnt = 0;
+  for (i = start, end = start + cnt; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+
+      set_cnt += count_set (b->bits[elem_idx (i)] & span_mask (ofs, n));
+      i += n;
+    }
+  return value ? set_cnt : cnt - set_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,15 +305,22 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t i, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  for (i = start, end = start + cnt; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+
+      if (((b->bits[elem_idx (i)] ^ flip) & span_mask (ofs, n)) != 0)
+        return true;
+      i += n;
+    }
   return false;
 }
 
@@ -288,10 +350,43 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or the size of B if there is none.  Skips
+   elements with no such bit whole, then uses first_set() on the
+   element that has one. */
+static size_t
+next_match (const struct bitmap *b, size_t start, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx = elem_idx (start);
+  size_t cnt = elem_cnt (b->bit_cnt);
+  elem_type bits;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  /* Ignore the bits before START in its element. */
+  bits = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (bits == 0)
+    {
+      if (++idx >= cnt)
+        return b->bit_cnt;
+      bits = b->bits[idx] ^ flip;
+    }
+
+  /* Bits past the end of B may match when VALUE is false. */
+  start = idx * ELEM_BITS + first_set (bits);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works run by run: finds the next bit set to VALUE, then the
+   next bit after it set to !VALUE, and checks whether the run
+   between them is long enough. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
@@ -301,10 +396,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return start;
+      while (i <= last)
+        {
+          size_t run_end;
+
+          i = next_match (b, i, value);
+          if (i > last)
+            break;
+          run_end = next_match (b, i, !value);
+          if (run_end - i >= cnt)
+            return i;
+          i = run_end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +465,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B that start at byte offset OFS, or
+   as many of them as B has, to the same offset in FILE.  Returns
+   true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,383 @@
+/* Red-black tree, following Cormen, Leiserson, Rivest and
+   Stein, "Introduction to Algorithms", chapter 13, with null
+   pointers in place of the book's sentinel leaves.
+
+   Every element is red or black; the root is black; a red
+   element has no red child; and every path from an element down
+   to a null child passes through the same number of black
+   elements.  Together these keep the longest path from the root
+   no more than twice as long as the shortest, so the tree's
+   height is O(lg n). */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void rotate_left (struct rbtree *, struct rb_elem *);
+static void rotate_right (struct rbtree *, struct rb_elem *);
+static void replace_child (struct rbtree *, struct rb_elem *old,
+                           struct rb_elem *new);
+static void insert_fixup (struct rbtree *, struct rb_elem *);
+static void remove_fixup (struct rbtree *, struct rb_elem *,
+                          struct rb_elem *parent);
+
+/* Returns true if E is non-null and red. */
+static inline bool
+is_red (const struct rb_elem *e)
+{
+  return e != NULL && e->red;
+}
+
+/* Returns the leftmost element in the subtree rooted at E. */
+static inline struct rb_elem *
+leftmost (struct rb_elem *e)
+{
+  while (e->left != NULL)
+    e = e->left;
+  return e;
+}
+
+/* Returns the rightmost element in the subtree rooted at E. */
+static inline struct rb_elem *
+rightmost (struct rb_elem *e)
+{
+  while (e->right != NULL)
+    e = e->right;
+  return e;
+}
+
+/* Initializes T as an empty tree ordered by LESS, given
+   auxiliary data AUX. */
+void
+rb_init (struct rbtree *t, rb_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E into T, after any elements equal to it. */
+void
+rb_insert (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem **link = &t->root;
+  struct rb_elem *parent = NULL;
+
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = t->less (e, parent, t->aux) ? &parent->left : &parent->right;
+    }
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->red = true;
+  *link = e;
+
+  insert_fixup (t, e);
+  t->elem_cnt++;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+rb_remove (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *child, *parent;
+  bool removed_red;
+
+  ASSERT (e != NULL);
+  ASSERT (t->elem_cnt > 0);
+
+  if (e->left == NULL || e->right == NULL)
+    {
+      /* E has at most one child, which takes its place. */
+      child = e->left != NULL ? e->left : e->right;
+      parent = e->parent;
+      removed_red = e->red;
+      replace_child (t, e, child);
+    }
+  else
+    {
+      /* E's successor, which has no left child, takes its place
+         and color, so the successor's old position is where the
+         tree loses an element. */
+      struct rb_elem *next = leftmost (e->right);
+
+      child = next->right;
+      removed_red = next->red;
+      if (next->parent == e)
+        parent = next;
+      else
+        {
+          parent = next->parent;
+          replace_child (t, next, child);
+          next->right = e->right;
+          next->right->parent = next;
+        }
+      replace_child (t, e, next);
+      next->left = e->left;
+      next->left->parent = next;
+      next->red = e->red;
+    }
+
+  if (!removed_red)
+    remove_fixup (t, child, parent);
+  t->elem_cnt--;
+}
+
+/* Returns the first element in T that is not less than KEY, or a
+   null pointer if every element is less than KEY.  KEY need not
+   be in T; typically it is a local variable that holds only what
+   the comparison function looks at. */
+struct rb_elem *
+rb_lower_bound (const struct rbtree *t, const struct rb_elem *key)
+{
+  struct rb_elem *e = t->root;
+  struct rb_elem *found = NULL;
+
+  while (e != NULL)
+    if (!t->less (e, key, t->aux))
+      {
+        found = e;
+        e = e->left;
+      }
+    else
+      e = e->right;
+  return found;
+}
+
+/* Returns the first element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_first (const struct rbtree *t)
+{
+  return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the last element in T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_last (const struct rbtree *t)
+{
+  return t->root != NULL ? rightmost (t->root) : NULL;
+}
+
+/* Returns the element after E in its tree, or a null pointer if
+   E is the last. */
+struct rb_elem *
+rb_next (struct rb_elem *e)
+{
+  ASSERT (e != NULL);
+
+  if (e->right != NULL)
+    return leftmost (e->right);
+  while (e->parent != NULL && e == e->parent->right)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the element before E in its tree, or a null pointer if
+   E is the first. */
+struct rb_elem *
+rb_prev (struct rb_elem *e)
+{
+  ASSERT (e != NULL);
+
+  if (e->left != NULL)
+    return rightmost (e->left);
+  while (e->parent != NULL && e == e->parent->left)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rb_size (const struct rbtree *t)
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+rb_empty (const struct rbtree *t)
+{
+  return t->root == NULL;
+}
+
+/* Puts NEW, which may be null, in the place of OLD as the child
+   of OLD's parent, or as T's root.  Does not change OLD. */
+static void
+replace_child (struct rbtree *t, struct rb_elem *old, struct rb_elem *new)
+{
+  if (old->parent == NULL)
+    t->root = new;
+  else if (old == old->parent->left)
+    old->parent->left = new;
+  else
+    old->parent->right = new;
+  if (new != NULL)
+    new->parent = old->parent;
+}
+
+/* Rotates E's right child into E's place, making E its left
+   child. */
+static void
+rotate_left (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *r = e->right;
+
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  replace_child (t, e, r);
+  r->left = e;
+  e->parent = r;
+}
+
+/* Rotates E's left child into E's place, making E its right
+   child. */
+static void
+rotate_right (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *l = e->left;
+
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  replace_child (t, e, l);
+  l->right = e;
+  e->parent = l;
+}
+
+/* Restores the red-black properties of T after red element E
+   has been inserted. */
+static void
+insert_fixup (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *parent;
+
+  while (is_red (parent = e->parent))
+    {
+      /* PARENT is red, so it is not the root. */
+      struct rb_elem *grandparent = parent->parent;
+
+      if (parent == grandparent->left)
+        {
+          struct rb_elem *uncle = grandparent->right;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grandparent->red = true;
+              e = grandparent;
+              continue;
+            }
+          if (e == parent->right)
+            {
+              rotate_left (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          parent->red = false;
+          grandparent->red = true;
+          rotate_right (t, grandparent);
+        }
+      else
+        {
+          struct rb_elem *uncle = grandparent->left;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grandparent->red = true;
+              e = grandparent;
+              continue;
+            }
+          if (e == parent->left)
+            {
+              rotate_right (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          parent->red = false;
+          grandparent->red = true;
+          rotate_left (t, grandparent);
+        }
+    }
+  t->root->red = false;
+}
+
+/* Restores the red-black properties of T after a black element
+   has been removed from the place now held by E, which may be
+   null, below PARENT. */
+static void
+remove_fixup (struct rbtree *t, struct rb_elem *e, struct rb_elem *parent)
+{
+  /* Paths through E are one black element short. */
+  while (e != t->root && !is_red (e))
+    {
+      if (e == parent->left)
+        {
+          struct rb_elem *sibling = parent->right;
+          if (sibling->red)
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              sibling = parent->right;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right))
+            {
+              sibling->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (sibling->right))
+            {
+              sibling->left->red = false;
+              sibling->red = true;
+              rotate_right (t, sibling);
+              sibling = parent->right;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->right->red = false;
+          rotate_left (t, parent);
+        }
+      else
+        {
+          struct rb_elem *sibling = parent->left;
+          if (sibling->red)
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              sibling = parent->left;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right))
+            {
+              sibling->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (sibling->left))
+            {
+              sibling->right->red = false;
+              sibling->red = true;
+              rotate_left (t, sibling);
+              sibling = parent->left;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->left->red = false;
+          rotate_right (t, parent);
+        }
+      e = t->root;
+    }
+  if (e != NULL)
+    e->red = false;
+}
@@ -0,0 +1,77 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+
+   A balanced binary search tree that keeps its elements in the
+   order given by a comparison function, so that insertion,
+   deletion, and finding the first element not less than a given
+   key each take O(lg n) time, and the elements can be visited in
+   order.  Elements that compare equal are allowed; each new one
+   goes after the equal ones already in the tree.
+
+   Like the list and hash table implementations, the tree does
+   not use dynamic allocation.  Each structure that can be in a
+   tree embeds a struct rb_elem member for that tree, and the
+   rb_entry macro converts a pointer to that member back to a
+   pointer to the structure.  A structure may embed several
+   struct rb_elem members to be in several trees at once, sorted
+   differently in each.  Refer to lib/kernel/list.h for a
+   detailed explanation of the technique. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct rb_elem
+  {
+    struct rb_elem *parent;     /* Parent, or null for the root. */
+    struct rb_elem *left;       /* Left child, or null. */
+    struct rb_elem *right;      /* Right child, or null. */
+    bool red;                   /* Red (true) or black (false)? */
+  };
+
+/* Converts pointer to tree element RB_ELEM into a pointer to the
+   structure that RB_ELEM is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree element. */
+#define rb_entry(RB_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) (RB_ELEM)          \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_elem *a,
+                           const struct rb_elem *b, void *aux);
+
+/* Red-black tree. */
+struct rbtree
+  {
+    struct rb_elem *root;       /* Root, or null if empty. */
+    size_t elem_cnt;            /* Number of elements. */
+    rb_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+/* Basic life cycle. */
+void rb_init (struct rbtree *, rb_less_func *, void *aux);
+
+/* Insertion, deletion, search. */
+void rb_insert (struct rbtree *, struct rb_elem *);
+void rb_remove (struct rbtree *, struct rb_elem *);
+struct rb_elem *rb_lower_bound (const struct rbtree *,
+                                const struct rb_elem *key);
+
+/* Traversal in order. */
+struct rb_elem *rb_first (const struct rbtree *);
+struct rb_elem *rb_last (const struct rbtree *);
+struct rb_elem *rb_next (struct rb_elem *);
+struct rb_elem *rb_prev (struct rb_elem *);
+
+/* Information. */
+size_t rb_size (const struct rbtree *);
+bool rb_empty (const struct rbtree *);
+
+#endif /* lib/kernel/rbtree.h */
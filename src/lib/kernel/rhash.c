@@ -0,0 +1,365 @@
+/* Open-addressing hash table with Robin Hood probing.
+
+   Each element goes in the first free slot at or after its "home"
+   slot, its hash value modulo the number of slots.  Its distance
+   from home is its probe length.  Robin Hood hashing (Celis,
+   Larson and Munro, 1985) keeps probe lengths short and even:
+   while looking for a free slot, an element being inserted takes
+   the place of any element that is closer to its own home than
+   the new one is, and that element moves on in its stead.  As a
+   result, a search can stop as soon as it reaches an element
+   closer to home than the key would be at that slot, and
+   unsuccessful searches are about as fast as successful ones.
+   Deletion from the current array shifts the following elements
+   back one slot, instead of leaving a marker behind (but see
+   below for the old array during a resize).
+
+   Each slot holds the element's full hash value as well as a
+   pointer to it, so the probe length of any slot can be computed
+   without touching the element, and the match function is only
+   called for elements whose hash value is equal to the key's.
+
+   The table doubles when it becomes 3/4 full.  Instead of moving
+   every element at once, it keeps the old array around and moves
+   MIGRATE_STEP of its slots into the new array on each insertion
+   or deletion, so no single call pays for the whole resize.
+   Until then, searches look in both arrays.  The old array is
+   never reorganized: elements that are moved out of it or
+   deleted from it are replaced by TOMBSTONE, keeping their hash
+   value so that probe lengths there stay correct. */
+
+#include "rhash.h"
+#include <debug.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+
+/* Minimum number of slots.  Must be a power of 2. */
+#define MIN_SLOT_CNT 16
+
+/* Number of old slots moved on each insertion or deletion while
+   the table grows. */
+#define MIGRATE_STEP 16
+
+/* Marks a slot of the old array whose element is gone. */
+static char tombstone;
+#define TOMBSTONE ((void *) &tombstone)
+
+static void migrate (struct rhash *, size_t slot_cnt);
+static bool grow (struct rhash *);
+static void place (struct rhash_slot *, size_t slot_cnt,
+                   unsigned hash, void *elem);
+static struct rhash_slot *find_slot (struct rhash *,
+                                     struct rhash_slot *, size_t slot_cnt,
+                                     unsigned hash, const void *key);
+static void remove_slot (struct rhash_slot *, size_t slot_cnt,
+                         struct rhash_slot *);
+
+/* Returns the number of slots that SLOT, in an array of
+   SLOT_CNT slots, is past its element's home slot. */
+static inline size_t
+probe_len (const struct rhash_slot *slots, size_t slot_cnt,
+           const struct rhash_slot *slot)
+{
+  return ((size_t) (slot - slots) - slot->hash) & (slot_cnt - 1);
+}
+
+/* Initializes hash table H to compare elements against keys
+   with MATCH, given auxiliary data AUX.  Returns true if
+   successful, false if memory is not available. */
+bool
+rhash_init (struct rhash *h, rhash_match_func *match, void *aux)
+{
+  h->elem_cnt = 0;
+  h->slot_cnt = MIN_SLOT_CNT;
+  h->slots = calloc (h->slot_cnt, sizeof *h->slots);
+  h->match = match;
+  h->aux = aux;
+  h->old_slots = NULL;
+  h->old_slot_cnt = 0;
+  h->old_pos = 0;
+  return h->slots != NULL;
+}
+
+/* Destroys hash table H, first calling DESTRUCTOR, if it is
+   nonnull, for each element in it.  DESTRUCTOR may free the
+   element's memory. */
+void
+rhash_destroy (struct rhash *h, rhash_action_func *destructor)
+{
+  if (destructor != NULL)
+    {
+      struct rhash_iterator i;
+      void *elem;
+
+      rhash_first (&i, h);
+      while ((elem = rhash_next (&i)) != NULL)
+        destructor (elem, h->aux);
+    }
+  free (h->slots);
+  free (h->old_slots);
+}
+
+/* Inserts ELEM, whose key is KEY and whose hash value is HASH,
+   into H, if no element in H matches KEY, and returns a null
+   pointer.  If an element in H already matches KEY, returns it
+   without inserting ELEM.  If H is full and memory to grow it is
+   not available, returns ELEM without inserting it. */
+void *
+rhash_insert (struct rhash *h, unsigned hash, const void *key, void *elem)
+{
+  void *old;
+
+  ASSERT (elem != NULL);
+
+  migrate (h, MIGRATE_STEP);
+  old = rhash_find (h, hash, key);
+  if (old != NULL)
+    return old;
+
+  if ((h->elem_cnt + 1) * 4 > h->slot_cnt * 3 && !grow (h)
+      && h->elem_cnt + 1 >= h->slot_cnt)
+    return elem;
+
+  place (h->slots, h->slot_cnt, hash, elem);
+  h->elem_cnt++;
+  return NULL;
+}
+
+/* Returns the element in H that matches KEY, whose hash value is
+   HASH, or a null pointer if there is none. */
+void *
+rhash_find (struct rhash *h, unsigned hash, const void *key)
+{
+  struct rhash_slot *s = find_slot (h, h->slots, h->slot_cnt, hash, key);
+
+  if (s == NULL && h->old_slots != NULL)
+    s = find_slot (h, h->old_slots, h->old_slot_cnt, hash, key);
+  return s != NULL ? s->elem : NULL;
+}
+
+/* Removes and returns the element in H that matches KEY, whose
+   hash value is HASH, or returns a null pointer if there is
+   none.  Does not free the element. */
+void *
+rhash_delete (struct rhash *h, unsigned hash, const void *key)
+{
+  struct rhash_slot *s;
+  void *elem;
+
+  migrate (h, MIGRATE_STEP);
+  s = find_slot (h, h->slots, h->slot_cnt, hash, key);
+  if (s != NULL)
+    {
+      elem = s->elem;
+      remove_slot (h->slots, h->slot_cnt, s);
+    }
+  else if (h->old_slots != NULL
+           && (s = find_slot (h, h->old_slots, h->old_slot_cnt,
+                              hash, key)) != NULL)
+    {
+      elem = s->elem;
+      s->elem = TOMBSTONE;
+    }
+  else
+    return NULL;
+
+  h->elem_cnt--;
+  return elem;
+}
+
+/* Initializes I for iterating hash table H.
+
+   Iteration idiom:
+
+      struct rhash_iterator i;
+      void *elem;
+
+      rhash_first (&i, h);
+      while ((elem = rhash_next (&i)) != NULL)
+        {
+          ...do something with elem...
+        }
+
+   Modifying hash table H during iteration, using any of the
+   functions rhash_insert() or rhash_delete(), invalidates all
+   iterators. */
+void
+rhash_first (struct rhash_iterator *i, struct rhash *h)
+{
+  ASSERT (i != NULL);
+  ASSERT (h != NULL);
+
+  i->rhash = h;
+  i->next = 0;
+}
+
+/* Advances I to the next element in the hash table and returns
+   it.  Returns a null pointer when no elements are left.
+   Elements are returned in arbitrary order. */
+void *
+rhash_next (struct rhash_iterator *i)
+{
+  struct rhash *h = i->rhash;
+
+  while (i->next < h->slot_cnt + h->old_slot_cnt)
+    {
+      size_t idx = i->next++;
+      struct rhash_slot *s = (idx < h->slot_cnt
+                              ? &h->slots[idx]
+                              : &h->old_slots[idx - h->slot_cnt]);
+
+      if (s->elem != NULL && s->elem != TOMBSTONE)
+        return s->elem;
+    }
+  return NULL;
+}
+
+/* Returns the number of elements in H. */
+size_t
+rhash_size (struct rhash *h)
+{
+  return h->elem_cnt;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+rhash_empty (struct rhash *h)
+{
+  return h->elem_cnt == 0;
+}
+
+/* Moves the elements in up to SLOT_CNT slots of H's old array,
+   if any, into its current array.  Frees the old array once it
+   has been entirely moved. */
+static void
+migrate (struct rhash *h, size_t slot_cnt)
+{
+  if (h->old_slots == NULL)
+    return;
+
+  for (; slot_cnt > 0 && h->old_pos < h->old_slot_cnt; slot_cnt--)
+    {
+      struct rhash_slot *s = &h->old_slots[h->old_pos++];
+
+      if (s->elem != NULL && s->elem != TOMBSTONE)
+        {
+          place (h->slots, h->slot_cnt, s->hash, s->elem);
+          s->elem = TOMBSTONE;
+        }
+    }
+
+  if (h->old_pos >= h->old_slot_cnt)
+    {
+      free (h->old_slots);
+      h->old_slots = NULL;
+      h->old_slot_cnt = 0;
+    }
+}
+
+/* Starts doubling the size of H.  If H's previous growth has not
+   finished, finishes it first.  Returns true if successful,
+   false if memory is not available. */
+static bool
+grow (struct rhash *h)
+{
+  struct rhash_slot *slots = calloc (h->slot_cnt * 2, sizeof *slots);
+
+  if (slots == NULL)
+    return false;
+
+  migrate (h, SIZE_MAX);
+  h->old_slots = h->slots;
+  h->old_slot_cnt = h->slot_cnt;
+  h->old_pos = 0;
+  h->slots = slots;
+  h->slot_cnt *= 2;
+  return true;
+}
+
+/* Puts ELEM, with hash value HASH, into SLOTS, an array of
+   SLOT_CNT slots that must have at least one free slot.
+   Does not check for a matching element. */
+static void
+place (struct rhash_slot *slots, size_t slot_cnt, unsigned hash, void *elem)
+{
+  struct rhash_slot cur;
+  size_t mask = slot_cnt - 1;
+  size_t pos = hash & mask;
+  size_t dist = 0;
+
+  cur.hash = hash;
+  cur.elem = elem;
+  for (;;)
+    {
+      struct rhash_slot *s = &slots[pos];
+      size_t s_dist;
+
+      if (s->elem == NULL)
+        {
+          *s = cur;
+          return;
+        }
+
+      /* Robin Hood: take the slot from an element that is closer
+         to home, and go on to find a place for it instead. */
+      s_dist = probe_len (slots, slot_cnt, s);
+      if (s_dist < dist)
+        {
+          struct rhash_slot tmp = *s;
+          *s = cur;
+          cur = tmp;
+          dist = s_dist;
+        }
+      pos = (pos + 1) & mask;
+      dist++;
+    }
+}
+
+/* Returns the slot in SLOTS, an array of SLOT_CNT slots of H,
+   whose element matches KEY, whose hash value is HASH, or a null
+   pointer if there is none. */
+static struct rhash_slot *
+find_slot (struct rhash *h, struct rhash_slot *slots, size_t slot_cnt,
+           unsigned hash, const void *key)
+{
+  size_t mask = slot_cnt - 1;
+  size_t pos = hash & mask;
+  size_t dist;
+
+  for (dist = 0; dist < slot_cnt; dist++)
+    {
+      struct rhash_slot *s = &slots[pos];
+
+      /* Stop at a free slot, or at an element closer to its home
+         than an element with hash value HASH would be here. */
+      if (s->elem == NULL || probe_len (slots, slot_cnt, s) < dist)
+        return NULL;
+      if (s->hash == hash && s->elem != TOMBSTONE
+          && h->match (s->elem, key, h->aux))
+        return s;
+      pos = (pos + 1) & mask;
+    }
+  return NULL;
+}
+
+/* Empties slot S in SLOTS, an array of SLOT_CNT slots, shifting
+   back the elements that follow it until one that is in its home
+   slot, or a free slot, is reached. */
+static void
+remove_slot (struct rhash_slot *slots, size_t slot_cnt, struct rhash_slot *s)
+{
+  size_t mask = slot_cnt - 1;
+  size_t pos = s - slots;
+
+  for (;;)
+    {
+      size_t next = (pos + 1) & mask;
+
+      if (slots[next].elem == NULL || probe_len (slots, slot_cnt,
+                                                 &slots[next]) == 0)
+        break;
+      slots[pos] = slots[next];
+      pos = next;
+    }
+  slots[pos].elem = NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef __LIB_KERNEL_RHASH_H
+#define __LIB_KERNEL_RHASH_H
+
+/* Open-addressing hash table.
+
+   This is an alternative to the chained hash table in hash.h
+   for tables that are searched often.  It keeps pointers to its
+   elements, along with their hash values, in a single array of
+   slots, so a search reads consecutive memory and compares hash
+   values before it ever looks at an element.  Elements need not
+   embed any member for the table's sake.
+
+   The table does not know how to hash an element or extract its
+   key.  Instead, the caller supplies the hash value with each
+   call, and a match function that compares an element against a
+   key of the caller's choosing.  For example, a table of inodes
+   indexed by sector number can be searched with the sector
+   number itself as the key, with no dummy inode needed:
+
+       static bool
+       inode_matches (const void *inode_, const void *sector_,
+                      void *aux UNUSED)
+       {
+         const struct inode *inode = inode_;
+         const block_sector_t *sector = sector_;
+         return inode->sector == *sector;
+       }
+
+       ...rhash_find (&inodes, hash_int (sector), &sector)...
+
+   Collisions are resolved with Robin Hood linear probing, and
+   the table grows incrementally.  See rhash.c for details. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Returns true if element ELEM has key KEY, given auxiliary data
+   AUX. */
+typedef bool rhash_match_func (const void *elem, const void *key, void *aux);
+
+/* Performs some operation on element ELEM, given auxiliary data
+   AUX. */
+typedef void rhash_action_func (void *elem, void *aux);
+
+/* Slot in a table. */
+struct rhash_slot
+  {
+    unsigned hash;              /* Hash value of ELEM. */
+    void *elem;                 /* Element, or null if empty. */
+  };
+
+/* Hash table. */
+struct rhash
+  {
+    size_t elem_cnt;            /* Number of elements in table. */
+    size_t slot_cnt;            /* Number of slots, a power of 2. */
+    struct rhash_slot *slots;   /* Array of `slot_cnt' slots. */
+    rhash_match_func *match;    /* Match function. */
+    void *aux;                  /* Auxiliary data for `match'. */
+
+    /* While the table grows, the elements not yet moved into
+       SLOTS from the old array.  See rhash.c. */
+    struct rhash_slot *old_slots;       /* Old array, or null. */
+    size_t old_slot_cnt;        /* Number of slots in OLD_SLOTS. */
+    size_t old_pos;             /* Next slot in OLD_SLOTS to move. */
+  };
+
+/* A hash table iterator. */
+struct rhash_iterator
+  {
+    struct rhash *rhash;        /* The hash table. */
+    size_t next;                /* Next slot, counting old slots last. */
+  };
+
+/* Basic life cycle. */
+bool rhash_init (struct rhash *, rhash_match_func *, void *aux);
+void rhash_destroy (struct rhash *, rhash_action_func *);
+
+/* Search, insertion, deletion. */
+void *rhash_insert (struct rhash *, unsigned hash, const void *key,
+                    void *elem);
+void *rhash_find (struct rhash *, unsigned hash, const void *key);
+void *rhash_delete (struct rhash *, unsigned hash, const void *key);
+
+/* Iteration. */
+void rhash_first (struct rhash_iterator *, struct rhash *);
+void *rhash_next (struct rhash_iterator *);
+
+/* Information. */
+size_t rhash_size (struct rhash *);
+bool rhash_empty (struct rhash *);
+
+#endif /* lib/kernel/rhash.h */
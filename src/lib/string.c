@@ -1,5 +1,40 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* string.h wraps these in macros that inline small constant-size
+   calls.  Here we want the functions themselves. */
+#undef memcpy
+#undef memset
+
+/* Blocks shorter than this are copied or set a byte at a time;
+   longer ones a 32-bit word at a time, with the string
+   instructions.  See [IA32-v2b] "REP" and "MOVS". */
+#define WORD_MIN 16
+
+/* Copies SIZE bytes forward from SRC to DST, which may overlap
+   only if DST < SRC.  The direction flag must be clear, as it
+   is outside of this file. */
+static inline void
+copy_forward (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  if (size >= WORD_MIN)
+    {
+      /* Copy bytes until DST is word-aligned, then words, then
+         the remaining bytes. */
+      size_t head = -(uintptr_t) dst & 3;
+      size_t word_cnt = (size - head) / 4;
+      size_t tail = (size - head) & 3;
+
+      asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (head)
+                    : : "memory");
+      asm volatile ("rep movsl" : "+D" (dst), "+S" (src), "+c" (word_cnt)
+                    : : "memory");
+      size = tail;
+    }
+  while (size-- > 0)
+    *dst++ = *src++;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,9 +47,7 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
-
+  copy_forward (dst, src, size);
   return dst_;
 }
 
@@ -29,20 +62,34 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
+  if (dst <= src || dst >= src + size) 
+    copy_forward (dst, src, size);
   else 
     {
+      /* DST overlaps the end of SRC, so copy backward: the bytes
+         past the last whole word, then words, with the direction
+         flag set. */
       dst += size;
       src += size;
+      if (size >= WORD_MIN)
+        {
+          size_t word_cnt = size / 4;
+
+          for (size &= 3; size > 0; size--)
+            *--dst = *--src;
+          dst -= 4;
+          src -= 4;
+          asm volatile ("std; rep movsl; cld"
+                        : "+D" (dst), "+S" (src), "+c" (word_cnt)
+                        : : "memory", "cc");
+          dst += 4;
+          src += 4;
+        }
       while (size-- > 0)
         *--dst = *--src;
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -281,7 +328,21 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= WORD_MIN)
+    {
+      /* Set bytes until DST is word-aligned, then words, then
+         the remaining bytes. */
+      uint32_t word = (unsigned char) value * 0x01010101u;
+      size_t head = -(uintptr_t) dst & 3;
+      size_t word_cnt = (size - head) / 4;
+
+      size = (size - head) & 3;
+      asm volatile ("rep stosb" : "+D" (dst), "+c" (head) : "a" (word)
+                    : "memory");
+      asm volatile ("rep stosl" : "+D" (dst), "+c" (word_cnt) : "a" (word)
+                    : "memory");
+    }
   while (size-- > 0)
     *dst++ = value;
 
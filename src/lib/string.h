@@ -25,6 +25,18 @@ size_t strlcat (char *, const char *, size_t);
 char *strtok_r (char *, const char *, char **);
 size_t strnlen (const char *, size_t);
 
+/* Inline calls with small constant sizes, which the compiler can
+   turn into a few moves, instead of calling the functions in
+   string.c. */
+#define memcpy(DST, SRC, SIZE)                                  \
+        (__builtin_constant_p (SIZE) && (SIZE) <= 16            \
+         ? __builtin_memcpy (DST, SRC, SIZE)                    \
+         : memcpy (DST, SRC, SIZE))
+#define memset(DST, VALUE, SIZE)                                \
+        (__builtin_constant_p (SIZE) && (SIZE) <= 16            \
+         ? __builtin_memset (DST, VALUE, SIZE)                  \
+         : memset (DST, VALUE, SIZE))
+
 /* Try to be helpful. */
 #define strcpy dont_use_strcpy_use_strlcpy
 #define strncpy dont_use_strncpy_use_strlcpy
@@ -0,0 +1,134 @@
+#include <synch.h>
+#include <limits.h>
+#include <syscall.h>
+
+/* See "Futexes Are Tricky" by Ulrich Drepper for the design of
+   these mutexes and condition variables. */
+
+/* Atomically sets *P to NEW if it is OLD.  Returns the value of
+   *P before the operation. */
+static inline int
+atomic_cmpxchg (int *p, int old, int new)
+{
+  int prev;
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p)
+                : "r" (new), "0" (old)
+                : "memory");
+  return prev;
+}
+
+/* Atomically sets *P to NEW and returns its previous value. */
+static inline int
+atomic_xchg (int *p, int new)
+{
+  asm volatile ("xchgl %0, %1"
+                : "+r" (new), "+m" (*p)
+                :
+                : "memory");
+  return new;
+}
+
+/* Atomically adds DELTA to *P and returns its previous value. */
+static inline int
+atomic_fetch_add (int *p, int delta)
+{
+  asm volatile ("lock xaddl %0, %1"
+                : "+r" (delta), "+m" (*p)
+                :
+                : "memory");
+  return delta;
+}
+
+/* Initializes MUTEX as unlocked. */
+void
+mutex_init (struct mutex *mutex)
+{
+  mutex->value = 0;
+}
+
+/* Locks MUTEX, sleeping until it is available if necessary. */
+void
+mutex_lock (struct mutex *mutex)
+{
+  int c = atomic_cmpxchg (&mutex->value, 0, 1);
+  if (c != 0)
+    {
+      /* Contended.  Mark the mutex as having waiters, then sleep
+         until it is unlocked. */
+      if (c != 2)
+        c = atomic_xchg (&mutex->value, 2);
+      while (c != 0)
+        {
+          futex_wait (&mutex->value, 2);
+          c = atomic_xchg (&mutex->value, 2);
+        }
+    }
+}
+
+/* Locks MUTEX if it is available and returns true, otherwise
+   returns false without sleeping. */
+bool
+mutex_trylock (struct mutex *mutex)
+{
+  return atomic_cmpxchg (&mutex->value, 0, 1) == 0;
+}
+
+/* Unlocks MUTEX, which must be locked by the caller. */
+void
+mutex_unlock (struct mutex *mutex)
+{
+  /* Only enter the kernel if there may be waiters. */
+  if (atomic_fetch_add (&mutex->value, -1) != 1)
+    {
+      mutex->value = 0;
+      futex_wake (&mutex->value, 1);
+    }
+}
+
+/* Initializes COND. */
+void
+condvar_init (struct condvar *cond)
+{
+  cond->seq = 0;
+}
+
+/* Atomically unlocks MUTEX and waits for COND to be signaled,
+   then relocks MUTEX.  As with any condition variable, the
+   caller must recheck its condition after waking up. */
+void
+condvar_wait (struct condvar *cond, struct mutex *mutex)
+{
+  int seq = cond->seq;
+  int c;
+
+  mutex_unlock (mutex);
+
+  /* Returns at once if COND was signaled since we read SEQ. */
+  futex_wait (&cond->seq, seq);
+
+  /* Relock, assuming that there are other waiters, since we
+     cannot tell whether a broadcast woke others too. */
+  c = atomic_xchg (&mutex->value, 2);
+  while (c != 0)
+    {
+      futex_wait (&mutex->value, 2);
+      c = atomic_xchg (&mutex->value, 2);
+    }
+}
+
+/* Wakes one thread waiting on COND, if any. */
+void
+condvar_signal (struct condvar *cond)
+{
+  atomic_fetch_add (&cond->seq, 1);
+  futex_wake (&cond->seq, 1);
+}
+
+/* Wakes all threads waiting on COND. */
+void
+condvar_broadcast (struct condvar *cond)
+{
+  atomic_fetch_add (&cond->seq, 1);
+  futex_wake (&cond->seq, INT_MAX);
+}
@@ -0,0 +1,42 @@
+#ifndef __LIB_USER_SYNCH_H
+#define __LIB_USER_SYNCH_H
+
+#include <stdbool.h>
+
+/* User-level mutual exclusion built on the futex_wait() and
+   futex_wake() system calls.
+
+   A mutex that is not contended is locked and unlocked with a
+   single atomic instruction each, without entering the kernel.
+   Objects may be shared by any threads that can see the same
+   memory; they need no destruction. */
+
+/* Mutex.  VALUE is 0 if unlocked, 1 if locked with no waiters,
+   or 2 if locked and other threads may be waiting. */
+struct mutex
+  {
+    int value;
+  };
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_init (struct mutex *);
+void mutex_lock (struct mutex *);
+bool mutex_trylock (struct mutex *);
+void mutex_unlock (struct mutex *);
+
+/* Condition variable.  SEQ changes each time the condition is
+   signaled. */
+struct condvar
+  {
+    int seq;
+  };
+
+#define CONDVAR_INITIALIZER { 0 }
+
+void condvar_init (struct condvar *);
+void condvar_wait (struct condvar *, struct mutex *);
+void condvar_signal (struct condvar *);
+void condvar_broadcast (struct condvar *);
+
+#endif /* lib/user/synch.h */
@@ -182,3 +182,43 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+futex_wait (int *addr, int val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+/* Entry point of threads started by uthread_create().  The
+   kernel calls it with the arguments passed to
+   uthread_create(). */
+static void
+uthread_start (uthread_func *func, void *aux) 
+{
+  uthread_exit (func (aux));
+}
+
+pid_t
+uthread_create (uthread_func *func, void *aux) 
+{
+  return (pid_t) syscall3 (SYS_THREAD_CREATE, uthread_start, func, aux);
+}
+
+void
+uthread_exit (int status) 
+{
+  syscall1 (SYS_THREAD_EXIT, status);
+  NOT_REACHED ();
+}
+
+int
+uthread_join (pid_t tid) 
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
@@ -13,7 +13,7 @@ typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
 /* Maximum characters in a filename written by readdir(). */
-#define READDIR_MAX_LEN 14
+#define READDIR_MAX_LEN 255
 
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
@@ -45,4 +45,17 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int futex_wait (int *addr, int val);
+int futex_wake (int *addr, int cnt);
+
+/* A function run by a thread started with uthread_create().
+   Returning from it ends the thread with the returned value as
+   its exit status. */
+typedef int uthread_func (void *aux);
+
+pid_t uthread_create (uthread_func *, void *aux);
+void uthread_exit (int status) NO_RETURN;
+int uthread_join (pid_t);
+
 #endif /* lib/user/syscall.h */
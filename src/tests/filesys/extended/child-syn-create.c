@@ -0,0 +1,53 @@
+/* Child process for syn-create.
+   Makes a directory of its own, fills it with files, each full
+   of one byte that depends on the child's index, and removes
+   some of them again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-create.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-syn-create";
+
+int
+main (int argc, const char *argv[]) 
+{
+  char buf[FILE_SIZE];
+  char dir[16];
+  int child_idx;
+  int j;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  memset (buf, 'a' + child_idx, sizeof buf);
+
+  snprintf (dir, sizeof dir, "d%d", child_idx);
+  CHECK (mkdir (dir), "mkdir \"%s\"", dir);
+  for (j = 0; j < FILE_CNT; j++)
+    {
+      char name[32];
+      int fd;
+
+      snprintf (name, sizeof name, "%s/f%d", dir, j);
+      CHECK (create (name, 0), "create \"%s\"", name);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+             "write \"%s\"", name);
+      close (fd);
+    }
+  for (j = 0; j < FILE_CNT; j++)
+    if (!KEPT (j))
+      {
+        char name[32];
+
+        snprintf (name, sizeof name, "%s/f%d", dir, j);
+        CHECK (remove (name), "remove \"%s\"", name);
+      }
+
+  return child_idx;
+}
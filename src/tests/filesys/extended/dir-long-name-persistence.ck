@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($long) = {};
+for my $i (0...9) {
+    my ($name) = "s$i" . join ('', map (chr (ord ('a') + $_ % 26), 2...89));
+    $long->{$name} = ["\0" x $i];
+}
+check_archive ({"long" => $long});
+pass;
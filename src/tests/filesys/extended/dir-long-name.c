@@ -0,0 +1,165 @@
+/* Creates, looks up, lists, and removes files whose names are
+   up to READDIR_MAX_LEN bytes long, enough of them to fill
+   several directory blocks.  Removing a name gives its space to
+   the entry before it in the block, and creating one splits the
+   room left behind an entry, so each is done with names that
+   just fit. */
+
+#include <stdbool.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Names READDIR_MAX_LEN bytes long, each in a block of its own
+   but the first. */
+#define LONG_CNT 6
+
+/* Names that just fit in what a long name leaves of a block. */
+#define FILL_CNT 5
+#define FILL_LEN 240
+
+/* Names that stay for the persistence check, short enough for
+   tar, which allows 99-byte paths. */
+#define SHORT_CNT 10
+#define SHORT_LEN 90
+
+static char long_names[LONG_CNT][READDIR_MAX_LEN + 1];
+static char fill_names[FILL_CNT][READDIR_MAX_LEN + 1];
+static char short_names[SHORT_CNT][READDIR_MAX_LEN + 1];
+
+static void make_name (char *name, char tag, int idx, size_t len);
+static void check_size (const char *name, int size);
+static void check_dir (char *names[], int cnt);
+
+void
+test_main (void)
+{
+  char *names[LONG_CNT + FILL_CNT];
+  char too_long[READDIR_MAX_LEN + 2];
+  int i;
+
+  CHECK (mkdir ("long"), "mkdir \"long\"");
+  CHECK (chdir ("long"), "chdir \"long\"");
+
+  make_name (too_long, 't', 0, READDIR_MAX_LEN + 1);
+  CHECK (!create (too_long, 0),
+         "create name of %d bytes (must return false)", READDIR_MAX_LEN + 1);
+
+  msg ("creating %d names of %d bytes and %d of %d bytes...",
+       LONG_CNT, READDIR_MAX_LEN, FILL_CNT, FILL_LEN);
+  quiet = true;
+  for (i = 0; i < LONG_CNT; i++)
+    {
+      make_name (long_names[i], 'l', i, READDIR_MAX_LEN);
+      CHECK (create (long_names[i], i + 1), "create \"%s\"", long_names[i]);
+      names[i] = long_names[i];
+    }
+  for (i = 0; i < FILL_CNT; i++)
+    {
+      make_name (fill_names[i], 'f', i, FILL_LEN);
+      CHECK (create (fill_names[i], LONG_CNT + i + 1),
+             "create \"%s\"", fill_names[i]);
+      names[LONG_CNT + i] = fill_names[i];
+    }
+  for (i = 0; i < LONG_CNT + FILL_CNT; i++)
+    check_size (names[i], i + 1);
+  check_dir (names, LONG_CNT + FILL_CNT);
+  quiet = false;
+
+  msg ("removing the %d-byte names...", FILL_LEN);
+  quiet = true;
+  for (i = 0; i < FILL_CNT; i++)
+    CHECK (remove (fill_names[i]), "remove \"%s\"", fill_names[i]);
+  for (i = 0; i < FILL_CNT; i++)
+    CHECK (open (fill_names[i]) == -1,
+           "open \"%s\" (must return -1)", fill_names[i]);
+  for (i = 0; i < LONG_CNT; i++)
+    check_size (long_names[i], i + 1);
+  check_dir (names, LONG_CNT);
+  quiet = false;
+
+  msg ("creating them again...");
+  quiet = true;
+  for (i = 0; i < FILL_CNT; i++)
+    CHECK (create (fill_names[i], LONG_CNT + i + 1),
+           "create \"%s\"", fill_names[i]);
+  for (i = 0; i < LONG_CNT + FILL_CNT; i++)
+    check_size (names[i], i + 1);
+  check_dir (names, LONG_CNT + FILL_CNT);
+  quiet = false;
+
+  msg ("replacing them with %d names of %d bytes...", SHORT_CNT, SHORT_LEN);
+  quiet = true;
+  for (i = 0; i < LONG_CNT + FILL_CNT; i++)
+    CHECK (remove (names[i]), "remove \"%s\"", names[i]);
+  for (i = 0; i < SHORT_CNT; i++)
+    {
+      make_name (short_names[i], 's', i, SHORT_LEN);
+      CHECK (create (short_names[i], i), "create \"%s\"", short_names[i]);
+      names[i] = short_names[i];
+    }
+  for (i = 0; i < LONG_CNT; i++)
+    CHECK (open (long_names[i]) == -1,
+           "open \"%s\" (must return -1)", long_names[i]);
+  for (i = 0; i < SHORT_CNT; i++)
+    check_size (short_names[i], i);
+  check_dir (names, SHORT_CNT);
+  quiet = false;
+}
+
+/* Stores in NAME a LEN-byte name that starts with TAG and the
+   digit IDX. */
+static void
+make_name (char *name, char tag, int idx, size_t len)
+{
+  size_t i;
+
+  name[0] = tag;
+  name[1] = '0' + idx;
+  for (i = 2; i < len; i++)
+    name[i] = 'a' + i % 26;
+  name[len] = '\0';
+}
+
+/* Checks that NAME is a file of SIZE bytes, which tells it from
+   the other files in the test. */
+static void
+check_size (const char *name, int size)
+{
+  int fd;
+
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  CHECK (filesize (fd) == size, "filesize \"%s\" is %d", name, size);
+  msg ("close \"%s\"", name);
+  close (fd);
+}
+
+/* Checks that readdir on the current directory returns each of
+   the CNT NAMES once, and nothing else. */
+static void
+check_dir (char *names[], int cnt)
+{
+  char name[READDIR_MAX_LEN + 1];
+  bool seen[LONG_CNT + FILL_CNT];
+  int fd, i;
+
+  memset (seen, 0, sizeof seen);
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  while (readdir (fd, name))
+    {
+      for (i = 0; i < cnt; i++)
+        if (!strcmp (name, names[i]))
+          break;
+      if (i == cnt)
+        fail ("readdir returned unexpected \"%s\"", name);
+      if (seen[i])
+        fail ("readdir returned \"%s\" twice", name);
+      seen[i] = true;
+    }
+  for (i = 0; i < cnt; i++)
+    if (!seen[i])
+      fail ("readdir did not return \"%s\"", names[i]);
+  msg ("close \".\"");
+  close (fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-long-name) begin
+(dir-long-name) mkdir "long"
+(dir-long-name) chdir "long"
+(dir-long-name) create name of 256 bytes (must return false)
+(dir-long-name) creating 6 names of 255 bytes and 5 of 240 bytes...
+(dir-long-name) removing the 240-byte names...
+(dir-long-name) creating them again...
+(dir-long-name) replacing them with 10 names of 90 bytes...
+(dir-long-name) end
+EOF
+pass;
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($a) = random_bytes (40000);
+my ($b) = random_bytes (40000);
+my ($c) = random_bytes (40000);
+check_archive ({"a" => [$a], "b" => [$b], "c" => [$c]});
+pass;
@@ -0,0 +1,60 @@
+/* Grows three files in turn, a little at a time, to many more
+   blocks than the buffer cache lets wait for sectors, then
+   closes them in a different order and checks their contents.
+   Sectors are chosen for the waiting blocks of one file while
+   the others still have some, and the rest when each file is
+   closed. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 3
+#define FILE_SIZE 40000
+static char bufs[FILE_CNT][FILE_SIZE];
+static const char *names[FILE_CNT] = {"a", "b", "c"};
+
+void
+test_main (void) 
+{
+  int fds[FILE_CNT];
+  size_t ofs[FILE_CNT];
+  size_t left = FILE_CNT * FILE_SIZE;
+  int i;
+
+  random_init (0);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      random_bytes (bufs[i], sizeof bufs[i]);
+      CHECK (create (names[i], 0), "create \"%s\"", names[i]);
+      CHECK ((fds[i] = open (names[i])) > 1, "open \"%s\"", names[i]);
+      ofs[i] = 0;
+    }
+
+  msg ("write \"a\", \"b\", and \"c\" in turn");
+  for (i = 0; left > 0; i = (i + 1) % FILE_CNT)
+    if (ofs[i] < FILE_SIZE)
+      {
+        size_t block_size = random_ulong () % 1000 + 1;
+        size_t ret_val;
+        if (block_size > FILE_SIZE - ofs[i])
+          block_size = FILE_SIZE - ofs[i];
+
+        ret_val = write (fds[i], bufs[i] + ofs[i], block_size);
+        if (ret_val != block_size)
+          fail ("write %zu bytes at offset %zu in \"%s\" returned %zu",
+                block_size, ofs[i], names[i], ret_val);
+        ofs[i] += block_size;
+        left -= block_size;
+      }
+
+  for (i = FILE_CNT - 1; i >= 0; i--)
+    {
+      msg ("close \"%s\"", names[i]);
+      close (fds[i]);
+    }
+
+  for (i = 0; i < FILE_CNT; i++)
+    check_file (names[i], bufs[i], FILE_SIZE);
+}
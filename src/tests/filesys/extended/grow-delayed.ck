@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-delayed) begin
+(grow-delayed) create "a"
+(grow-delayed) open "a"
+(grow-delayed) create "b"
+(grow-delayed) open "b"
+(grow-delayed) create "c"
+(grow-delayed) open "c"
+(grow-delayed) write "a", "b", and "c" in turn
+(grow-delayed) close "c"
+(grow-delayed) close "b"
+(grow-delayed) close "a"
+(grow-delayed) open "a" for verification
+(grow-delayed) verified contents of "a"
+(grow-delayed) close "a"
+(grow-delayed) open "b" for verification
+(grow-delayed) verified contents of "b"
+(grow-delayed) close "b"
+(grow-delayed) open "c" for verification
+(grow-delayed) verified contents of "c"
+(grow-delayed) close "c"
+(grow-delayed) end
+EOF
+pass;
@@ -0,0 +1,55 @@
+/* Writes every other block of a file, which leaves it with
+   hundreds of extents, too many for its inode alone, then fills
+   in the holes between them from the start of the file to the
+   end, so that each new block adds an extent ahead of nearly all
+   the others.  Checks the file's contents. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 1000
+static char buf[BLOCK_CNT * BLOCK_SIZE];
+
+static void
+write_block (int fd, size_t block) 
+{
+  size_t ofs = block * BLOCK_SIZE;
+  size_t ret_val;
+
+  seek (fd, ofs);
+  ret_val = write (fd, buf + ofs, BLOCK_SIZE);
+  if (ret_val != BLOCK_SIZE)
+    fail ("write %d bytes at offset %zu in \"holes\" returned %zu",
+          BLOCK_SIZE, ofs, ret_val);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+  size_t block;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("holes", 0), "create \"holes\"");
+  CHECK ((fd = open ("holes")) > 1, "open \"holes\"");
+  msg ("write every other block");
+  for (block = 0; block < BLOCK_CNT; block += 2)
+    write_block (fd, block);
+  write_block (fd, BLOCK_CNT - 1);
+  msg ("close \"holes\"");
+  close (fd);
+
+  CHECK ((fd = open ("holes")) > 1, "open \"holes\"");
+  msg ("fill in the holes");
+  for (block = 1; block < BLOCK_CNT - 1; block += 2)
+    write_block (fd, block);
+  msg ("close \"holes\"");
+  close (fd);
+
+  check_file ("holes", buf, sizeof buf);
+}
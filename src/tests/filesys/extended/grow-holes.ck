@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-holes) begin
+(grow-holes) create "holes"
+(grow-holes) open "holes"
+(grow-holes) write every other block
+(grow-holes) close "holes"
+(grow-holes) open "holes"
+(grow-holes) fill in the holes
+(grow-holes) close "holes"
+(grow-holes) open "holes" for verification
+(grow-holes) verified contents of "holes"
+(grow-holes) close "holes"
+(grow-holes) end
+EOF
+pass;
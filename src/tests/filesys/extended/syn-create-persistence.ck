@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($tree) = {"child-syn-create" => "tests/filesys/extended/child-syn-create"};
+for my $i (0...3) {
+    $tree->{"d$i"} = {};
+    for my $j (0...29) {
+	$tree->{"d$i"}{"f$j"} = [chr (ord ('a') + $i) x 600] if $j % 3 != 0;
+    }
+}
+check_archive ($tree);
+pass;
@@ -0,0 +1,47 @@
+/* Creates, writes, and removes files in several subprocesses at
+   once, so that many operations on the file system are in
+   progress together, then checks what they left behind. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-create.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char expected[FILE_SIZE];
+  char buf[FILE_SIZE];
+  int i, j;
+
+  exec_children ("child-syn-create", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  msg ("check files");
+  quiet = true;
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      memset (expected, 'a' + i, FILE_SIZE);
+      for (j = 0; j < FILE_CNT; j++)
+        {
+          char name[32];
+          int fd;
+
+          snprintf (name, sizeof name, "d%d/f%d", i, j);
+          fd = open (name);
+          if (!KEPT (j))
+            {
+              CHECK (fd == -1, "\"%s\" was removed", name);
+              continue;
+            }
+          CHECK (fd > 1, "open \"%s\"", name);
+          CHECK (read (fd, buf, FILE_SIZE) == FILE_SIZE, "read \"%s\"", name);
+          compare_bytes (buf, expected, FILE_SIZE, 0, name);
+          close (fd);
+        }
+    }
+  quiet = false;
+}
@@ -0,0 +1,11 @@
+#ifndef TESTS_FILESYS_EXTENDED_SYN_CREATE_H
+#define TESTS_FILESYS_EXTENDED_SYN_CREATE_H
+
+#define CHILD_CNT 4
+#define FILE_CNT 30
+#define FILE_SIZE 600
+
+/* Every third file is removed again. */
+#define KEPT(FILE_IDX) ((FILE_IDX) % 3 != 0)
+
+#endif /* tests/filesys/extended/syn-create.h */
@@ -68,7 +68,7 @@ make_tar_archive (const char *archive_name, char *files[], size_t file_cnt)
 
   for (i = 0; i < file_cnt; i++) 
     {
-      char file_name[128];
+      char file_name[512];
       
       strlcpy (file_name, files[i], sizeof file_name);
       if (!archive_file (file_name, sizeof file_name,
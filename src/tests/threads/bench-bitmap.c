@@ -0,0 +1,105 @@
+/* Measures bitmap_scan() and bitmap_count() on a 1M-bit bitmap,
+   the size of the free map of a 512 MB disk, and checks their
+   results against a simple bit-by-bit search built on
+   bitmap_test().  The timings are printed for comparison but
+   not checked, since they depend on the machine. */
+
+#include <bitmap.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "devices/timer.h"
+
+/* Number of bits in the bitmap. */
+#define BIT_CNT (1024 * 1024)
+
+/* Number of times each operation is repeated. */
+#define ROUNDS 4
+
+static size_t slow_scan (const struct bitmap *, size_t cnt, bool value);
+static void time_scan (const struct bitmap *, const char *, size_t cnt,
+                       bool value);
+
+void
+test_bench_bitmap (void) 
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  size_t i, free_cnt;
+  uint64_t start;
+
+  if (b == NULL)
+    fail ("bitmap_create (%d) failed", BIT_CNT);
+
+  /* Nearly full: a single clear bit near the end. */
+  bitmap_set_all (b, true);
+  bitmap_reset (b, BIT_CNT - 100);
+  time_scan (b, "nearly full, 1 bit", 1, false);
+
+  /* Fragmented: short clear runs of 1 to 8 bits every 97 bits,
+     like a much-used free map, and one run of 64 clear bits
+     near the end. */
+  free_cnt = 0;
+  for (i = 0; i + 8 < BIT_CNT - 1000; i += 97)
+    {
+      size_t run = i % 8 + 1;
+      bitmap_set_multiple (b, i, run, false);
+      free_cnt += run;
+    }
+  bitmap_set_multiple (b, BIT_CNT - 1000, 64, false);
+  free_cnt += 64 + 1;
+  time_scan (b, "fragmented, 1 bit", 1, false);
+  time_scan (b, "fragmented, 8 bits", 8, false);
+  time_scan (b, "fragmented, 64 bits", 64, false);
+
+  /* Counting. */
+  start = timer_cycles ();
+  for (i = 0; i < ROUNDS; i++)
+    if (bitmap_count (b, 0, BIT_CNT, false) != free_cnt)
+      fail ("bitmap_count returned %zu, expected %zu",
+            bitmap_count (b, 0, BIT_CNT, false), free_cnt);
+  msg ("count: %"PRIu64" cycles", (timer_cycles () - start) / ROUNDS);
+
+  bitmap_destroy (b);
+  pass ();
+}
+
+/* Times bitmap_scan() for CNT bits set to VALUE in B, checks its
+   result against slow_scan(), and prints both times. */
+static void
+time_scan (const struct bitmap *b, const char *name, size_t cnt, bool value) 
+{
+  uint64_t start, fast_cycles, slow_cycles;
+  size_t expected, actual = 0;
+  int i;
+
+  start = timer_cycles ();
+  expected = slow_scan (b, cnt, value);
+  slow_cycles = timer_cycles () - start;
+
+  start = timer_cycles ();
+  for (i = 0; i < ROUNDS; i++)
+    actual = bitmap_scan (b, 0, cnt, value);
+  fast_cycles = (timer_cycles () - start) / ROUNDS;
+
+  if (actual != expected)
+    fail ("%s: bitmap_scan returned %zu, expected %zu",
+          name, actual, expected);
+  msg ("scan %s: %"PRIu64" cycles (bit by bit: %"PRIu64")",
+       name, fast_cycles, slow_cycles);
+}
+
+/* Returns the index of the first run of CNT bits set to VALUE
+   in B, found one bit at a time, or BITMAP_ERROR. */
+static size_t
+slow_scan (const struct bitmap *b, size_t cnt, bool value) 
+{
+  size_t run = 0;
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    if (bitmap_test (b, i) != value)
+      run = 0;
+    else if (++run == cnt)
+      return i + 1 - cnt;
+  return BITMAP_ERROR;
+}
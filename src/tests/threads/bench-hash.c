@@ -0,0 +1,190 @@
+/* Compares the open-addressing hash table in rhash.h with the
+   chained hash table in hash.h, inserting, finding and deleting
+   the same set of integer keys in each.  Checks that both return
+   the right elements, and prints the average cycles per
+   operation, plus the slowest single insertion, which shows the
+   cost of growing the table.  The timings are printed for
+   comparison but not checked, since they depend on the
+   machine. */
+
+#include <hash.h>
+#include <inttypes.h>
+#include <rhash.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "devices/timer.h"
+
+/* Number of elements. */
+#define ELEM_CNT 8192
+
+/* An element, which can be in both kinds of table. */
+struct bench_elem
+  {
+    int key;
+    struct hash_elem hash_elem;
+  };
+
+static struct bench_elem *elems;
+
+static hash_hash_func elem_hash;
+static hash_less_func elem_less;
+static rhash_match_func elem_matches;
+static void bench_hash (void);
+static void bench_rhash (void);
+static void report (const char *table, const char *op, uint64_t cycles);
+
+void
+test_bench_hash (void) 
+{
+  int i;
+
+  elems = malloc (ELEM_CNT * sizeof *elems);
+  if (elems == NULL)
+    fail ("out of memory");
+
+  /* Spread the keys out, but deterministically. */
+  for (i = 0; i < ELEM_CNT; i++)
+    elems[i].key = i * 2654435761u;
+
+  bench_hash ();
+  bench_rhash ();
+
+  free (elems);
+  pass ();
+}
+
+/* Runs the benchmark on a struct hash. */
+static void
+bench_hash (void) 
+{
+  struct hash h;
+  uint64_t start, max_insert = 0;
+  int i;
+
+  if (!hash_init (&h, elem_hash, elem_less, NULL))
+    fail ("hash_init failed");
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      uint64_t t = timer_cycles ();
+      if (hash_insert (&h, &elems[i].hash_elem) != NULL)
+        fail ("hash_insert found duplicate of key %d", elems[i].key);
+      t = timer_cycles () - t;
+      if (t > max_insert)
+        max_insert = t;
+    }
+  report ("hash", "insert", timer_cycles () - start);
+  msg ("hash: slowest insert %"PRIu64" cycles", max_insert);
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    if (hash_find (&h, &elems[i].hash_elem) != &elems[i].hash_elem)
+      fail ("hash_find did not find key %d", elems[i].key);
+  report ("hash", "find", timer_cycles () - start);
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      struct bench_elem missing;
+      missing.key = elems[i].key + 1;
+      if (hash_find (&h, &missing.hash_elem) != NULL)
+        fail ("hash_find found missing key %d", missing.key);
+    }
+  report ("hash", "miss", timer_cycles () - start);
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    if (hash_delete (&h, &elems[i].hash_elem) != &elems[i].hash_elem)
+      fail ("hash_delete did not find key %d", elems[i].key);
+  report ("hash", "delete", timer_cycles () - start);
+
+  if (!hash_empty (&h))
+    fail ("hash table not empty");
+  hash_destroy (&h, NULL);
+}
+
+/* Runs the benchmark on a struct rhash. */
+static void
+bench_rhash (void) 
+{
+  struct rhash h;
+  uint64_t start, max_insert = 0;
+  int i;
+
+  if (!rhash_init (&h, elem_matches, NULL))
+    fail ("rhash_init failed");
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      uint64_t t = timer_cycles ();
+      if (rhash_insert (&h, hash_int (elems[i].key), &elems[i].key,
+                        &elems[i]) != NULL)
+        fail ("rhash_insert failed for key %d", elems[i].key);
+      t = timer_cycles () - t;
+      if (t > max_insert)
+        max_insert = t;
+    }
+  report ("rhash", "insert", timer_cycles () - start);
+  msg ("rhash: slowest insert %"PRIu64" cycles", max_insert);
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    if (rhash_find (&h, hash_int (elems[i].key), &elems[i].key) != &elems[i])
+      fail ("rhash_find did not find key %d", elems[i].key);
+  report ("rhash", "find", timer_cycles () - start);
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    {
+      int missing = elems[i].key + 1;
+      if (rhash_find (&h, hash_int (missing), &missing) != NULL)
+        fail ("rhash_find found missing key %d", missing);
+    }
+  report ("rhash", "miss", timer_cycles () - start);
+
+  start = timer_cycles ();
+  for (i = 0; i < ELEM_CNT; i++)
+    if (rhash_delete (&h, hash_int (elems[i].key), &elems[i].key)
+        != &elems[i])
+      fail ("rhash_delete did not find key %d", elems[i].key);
+  report ("rhash", "delete", timer_cycles () - start);
+
+  if (!rhash_empty (&h))
+    fail ("rhash table not empty");
+  rhash_destroy (&h, NULL);
+}
+
+/* Prints the average cycles per operation, given the CYCLES
+   taken by ELEM_CNT operations OP on TABLE. */
+static void
+report (const char *table, const char *op, uint64_t cycles) 
+{
+  msg ("%s: %s %"PRIu64" cycles each", table, op, cycles / ELEM_CNT);
+}
+
+/* Hash function for struct hash. */
+static unsigned
+elem_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  return hash_int (hash_entry (e, struct bench_elem, hash_elem)->key);
+}
+
+/* Comparison function for struct hash. */
+static bool
+elem_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED) 
+{
+  return (hash_entry (a, struct bench_elem, hash_elem)->key
+          < hash_entry (b, struct bench_elem, hash_elem)->key);
+}
+
+/* Match function for struct rhash. */
+static bool
+elem_matches (const void *e, const void *key, void *aux UNUSED) 
+{
+  const struct bench_elem *elem = e;
+  return elem->key == *(const int *) key;
+}
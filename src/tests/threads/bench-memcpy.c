@@ -0,0 +1,147 @@
+/* Measures memcpy() and memset() on 16-byte, 512-byte and 4 kB
+   blocks, the sizes of small structures, disk sectors and pages,
+   and compares them with simple byte-at-a-time loops.  Also checks
+   memcpy(), memmove() and memset() on unaligned and overlapping
+   blocks.  The timings are printed for comparison but not
+   checked, since they depend on the machine. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "devices/timer.h"
+
+/* Number of bytes copied for each block size. */
+#define TOTAL_BYTES (1024 * 1024)
+
+static void check_copies (uint8_t *, uint8_t *);
+static void time_size (uint8_t *dst, const uint8_t *src, size_t size);
+static void print_rate (const char *, size_t size, uint64_t cycles,
+                        uint64_t byte_cycles);
+static void byte_copy (uint8_t *, const uint8_t *, size_t);
+static void byte_set (uint8_t *, int, size_t);
+
+void
+test_bench_memcpy (void) 
+{
+  static const size_t sizes[] = {16, 512, 4096};
+  uint8_t *src = malloc (8192);
+  uint8_t *dst = malloc (8192);
+  size_t i;
+
+  if (src == NULL || dst == NULL)
+    fail ("out of memory");
+  for (i = 0; i < 8192; i++)
+    src[i] = i * 7 + 3;
+
+  check_copies (dst, src);
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    time_size (dst, src, sizes[i]);
+
+  free (src);
+  free (dst);
+  pass ();
+}
+
+/* Checks memcpy(), memmove() and memset() against byte_copy()
+   and byte_set() for every combination of small offsets and a
+   range of sizes, using scratch buffers A and B of 8 kB each. */
+static void
+check_copies (uint8_t *a, uint8_t *b) 
+{
+  static uint8_t expect[300];
+  size_t dst_ofs, src_ofs, size;
+
+  for (size = 0; size < 100; size += size < 20 ? 1 : 13)
+    for (dst_ofs = 0; dst_ofs < 4; dst_ofs++)
+      for (src_ofs = 0; src_ofs < 8; src_ofs++)
+        {
+          size_t i;
+
+          /* memcpy between distinct buffers. */
+          byte_set (a, 0x55, sizeof expect);
+          byte_set (expect, 0x55, sizeof expect);
+          memcpy (a + dst_ofs, b + src_ofs, size);
+          byte_copy (expect + dst_ofs, b + src_ofs, size);
+          if (memcmp (a, expect, sizeof expect))
+            fail ("memcpy: dst %zu, src %zu, size %zu", dst_ofs, src_ofs, size);
+
+          /* memmove within one buffer, in both directions. */
+          for (i = 0; i < sizeof expect; i++)
+            a[i] = expect[i] = i;
+          memmove (a + dst_ofs, a + src_ofs, size);
+          for (i = 0; i < size; i++)
+            expect[dst_ofs + i] = src_ofs + i;
+          if (memcmp (a, expect, sizeof expect))
+            fail ("memmove: dst %zu, src %zu, size %zu", dst_ofs, src_ofs, size);
+
+          /* memset. */
+          byte_set (a, 0x55, sizeof expect);
+          byte_set (expect, 0x55, sizeof expect);
+          memset (a + dst_ofs, src_ofs, size);
+          byte_set (expect + dst_ofs, src_ofs, size);
+          if (memcmp (a, expect, sizeof expect))
+            fail ("memset: dst %zu, value %zu, size %zu", dst_ofs, src_ofs, size);
+        }
+  msg ("memcpy, memmove and memset agree with byte loops");
+}
+
+/* Times copying and setting TOTAL_BYTES in SIZE-byte blocks. */
+static void
+time_size (uint8_t *dst, const uint8_t *src, size_t size) 
+{
+  size_t cnt = TOTAL_BYTES / size;
+  uint64_t start, fast, slow;
+  size_t i;
+
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    memcpy (dst, src, size);
+  fast = timer_cycles () - start;
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    byte_copy (dst, src, size);
+  slow = timer_cycles () - start;
+  print_rate ("memcpy", size, fast, slow);
+
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    memset (dst, 0, size);
+  fast = timer_cycles () - start;
+  start = timer_cycles ();
+  for (i = 0; i < cnt; i++)
+    byte_set (dst, 0, size);
+  slow = timer_cycles () - start;
+  print_rate ("memset", size, fast, slow);
+}
+
+/* Prints the rate of copying TOTAL_BYTES in CYCLES, in bytes per
+   cycle, and the same for BYTE_CYCLES. */
+static void
+print_rate (const char *name, size_t size, uint64_t cycles,
+            uint64_t byte_cycles) 
+{
+  uint64_t rate = cycles > 0 ? TOTAL_BYTES * 100ULL / cycles : 0;
+  uint64_t byte_rate = byte_cycles > 0 ? TOTAL_BYTES * 100ULL / byte_cycles : 0;
+
+  msg ("%s %zu bytes: %"PRIu64".%02"PRIu64" bytes/cycle "
+       "(byte loop: %"PRIu64".%02"PRIu64")",
+       name, size, rate / 100, rate % 100, byte_rate / 100, byte_rate % 100);
+}
+
+/* Copies SIZE bytes from SRC to DST one at a time. */
+static void
+byte_copy (uint8_t *dst, const uint8_t *src, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+/* Sets SIZE bytes at DST to VALUE one at a time. */
+static void
+byte_set (uint8_t *dst, int value, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = value;
+}
@@ -0,0 +1,171 @@
+/* Checks the order in which a block device's request queue
+   carries out requests, and that it merges adjacent ones.
+
+   A fake device holds its dispatcher in the first transfer until
+   more requests have been queued behind it.  The dispatcher
+   should then serve them in C-LOOK order, merging requests that
+   continue one another in the same direction into one driver
+   call, and complete each one from its own thread. */
+
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Size of the fake device, in sectors. */
+#define SECTOR_CNT 16
+
+/* Maximum number of driver calls logged. */
+#define LOG_MAX 16
+
+/* A driver call. */
+struct call
+  {
+    block_sector_t sector;
+    block_sector_t cnt;
+    bool write;
+  };
+
+static uint8_t disk[SECTOR_CNT][BLOCK_SECTOR_SIZE];
+static struct call log[LOG_MAX];
+static int log_cnt;
+static struct semaphore started, gate, done;
+static bool in_dispatcher = true;
+
+/* Logs a driver call for the CNT sectors starting at SECTOR. */
+static void
+fake_transfer (block_sector_t sector, block_sector_t cnt, bool write)
+{
+  ASSERT (log_cnt < LOG_MAX);
+  log[log_cnt].sector = sector;
+  log[log_cnt].cnt = cnt;
+  log[log_cnt].write = write;
+
+  /* Hold the first transfer until the test has queued the
+     rest. */
+  if (log_cnt++ == 0)
+    {
+      sema_up (&started);
+      sema_down (&gate);
+    }
+}
+
+/* Driver operations for the fake device. */
+static void
+fake_read (void *aux UNUSED, block_sector_t sector, void *buffer,
+           block_sector_t cnt)
+{
+  fake_transfer (sector, cnt, false);
+  memcpy (buffer, disk[sector], cnt * BLOCK_SECTOR_SIZE);
+}
+
+static void
+fake_write (void *aux UNUSED, block_sector_t sector, const void *buffer,
+            block_sector_t cnt)
+{
+  fake_transfer (sector, cnt, true);
+  memcpy (disk[sector], buffer, cnt * BLOCK_SECTOR_SIZE);
+}
+
+static const struct block_operations fake_ops =
+  {
+    NULL,
+    NULL,
+    fake_read,
+    fake_write,
+    NULL,
+    NULL
+  };
+
+/* Completion function for the requests. */
+static void
+end_request (struct bio *b UNUSED)
+{
+  if (strcmp (thread_name (), "blkq-io"))
+    in_dispatcher = false;
+  sema_up (&done);
+}
+
+/* Requests, in the order submitted. */
+static const struct
+  {
+    block_sector_t sector;
+    block_sector_t cnt;
+    bool write;
+  }
+requests[] =
+  {
+    {4, 1, false},
+    {9, 1, false},
+    {1, 1, false},
+    {6, 1, true},
+    {7, 2, true},
+    {12, 1, false},
+    {2, 1, false},
+  };
+#define REQUEST_CNT (sizeof requests / sizeof *requests)
+
+void
+test_block_queue (void)
+{
+  static uint8_t buffers[REQUEST_CNT][2 * BLOCK_SECTOR_SIZE];
+  struct bio bios[REQUEST_CNT];
+  struct block *block;
+  size_t i;
+  int j;
+
+  sema_init (&started, 0);
+  sema_init (&gate, 0);
+  sema_init (&done, 0);
+  for (i = 0; i < SECTOR_CNT; i++)
+    memset (disk[i], i, BLOCK_SECTOR_SIZE);
+
+  block = block_register ("blkq", BLOCK_RAW, NULL, SECTOR_CNT,
+                          &fake_ops, NULL);
+
+  for (i = 0; i < REQUEST_CNT; i++)
+    {
+      if (requests[i].write)
+        memset (buffers[i], 0xa0 + requests[i].sector,
+                requests[i].cnt * BLOCK_SECTOR_SIZE);
+      bio_init (&bios[i], requests[i].sector, buffers[i], requests[i].cnt,
+                requests[i].write, end_request, NULL);
+      block_submit (block, &bios[i]);
+
+      /* Let the first request reach the driver. */
+      if (i == 0)
+        sema_down (&started);
+    }
+  sema_up (&gate);
+  for (i = 0; i < REQUEST_CNT; i++)
+    sema_down (&done);
+
+  for (j = 0; j < log_cnt; j++)
+    msg ("%s %"PRDSNu" sector(s) at %"PRDSNu,
+         log[j].write ? "write" : "read", log[j].cnt, log[j].sector);
+
+  for (i = 0; i < REQUEST_CNT; i++)
+    {
+      block_sector_t k;
+
+      for (k = 0; k < requests[i].cnt; k++)
+        {
+          block_sector_t sector = requests[i].sector + k;
+          const uint8_t *data = (requests[i].write ? disk[sector]
+                                 : buffers[i] + k * BLOCK_SECTOR_SIZE);
+          uint8_t expected = (requests[i].write ? 0xa0 + requests[i].sector
+                              : sector);
+          int ofs;
+
+          for (ofs = 0; ofs < BLOCK_SECTOR_SIZE; ofs++)
+            if (data[ofs] != expected)
+              fail ("sector %"PRDSNu" byte %d is %#x, not %#x",
+                    sector, ofs, data[ofs], expected);
+        }
+    }
+  msg ("data ok");
+  if (in_dispatcher)
+    msg ("completions ran in the dispatcher thread");
+}
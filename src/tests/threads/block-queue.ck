@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(block-queue) begin
+blkq: 16 sectors (8 kB)
+(block-queue) read 1 sector(s) at 4
+(block-queue) write 3 sector(s) at 6
+(block-queue) read 1 sector(s) at 9
+(block-queue) read 1 sector(s) at 12
+(block-queue) read 2 sector(s) at 1
+(block-queue) data ok
+(block-queue) completions ran in the dispatcher thread
+(block-queue) end
+EOF
+pass;
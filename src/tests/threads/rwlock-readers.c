@@ -0,0 +1,84 @@
+/* Checks that readers of a readers-writer lock run in parallel.
+   For increasing numbers of readers, all of them are released at
+   once and each holds the lock while sleeping.  If the readers
+   were serialized, the total time would grow with their number;
+   instead it should stay close to a single reader's hold time. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of timer ticks that each reader holds the lock. */
+#define HOLD_TICKS 20
+
+static thread_func reader_thread;
+static struct rwlock rwlock;
+static struct semaphore done;
+static int active_cnt;
+static int max_active_cnt;
+
+void
+test_rwlock_readers (void) 
+{
+  int reader_cnt;
+
+  rwlock_init (&rwlock);
+  sema_init (&done, 0);
+  for (reader_cnt = 1; reader_cnt <= 16; reader_cnt *= 2) 
+    {
+      int64_t start;
+      int i;
+
+      /* Hold the write lock while the readers start up, so that
+         they all queue behind it. */
+      active_cnt = max_active_cnt = 0;
+      rwlock_acquire_write (&rwlock);
+      for (i = 0; i < reader_cnt; i++) 
+        {
+          char name[sizeof "reader " + 11];
+          snprintf (name, sizeof name, "reader %d", i);
+          thread_create (name, PRI_DEFAULT, reader_thread, NULL);
+        }
+      timer_sleep (10);
+
+      start = timer_ticks ();
+      rwlock_release_write (&rwlock);
+      for (i = 0; i < reader_cnt; i++)
+        sema_down (&done);
+
+      if (max_active_cnt != reader_cnt)
+        fail ("only %d of %d readers held the lock at once",
+              max_active_cnt, reader_cnt);
+      if (timer_elapsed (start) >= 2 * HOLD_TICKS)
+        fail ("%d readers took %"PRId64" ticks, expected under %d",
+              reader_cnt, timer_elapsed (start), 2 * HOLD_TICKS);
+      msg ("%d readers held the lock concurrently.", reader_cnt);
+    }
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  enum intr_level old_level;
+
+  rwlock_acquire_read (&rwlock);
+
+  old_level = intr_disable ();
+  if (++active_cnt > max_active_cnt)
+    max_active_cnt = active_cnt;
+  intr_set_level (old_level);
+
+  timer_sleep (HOLD_TICKS);
+
+  old_level = intr_disable ();
+  active_cnt--;
+  intr_set_level (old_level);
+
+  rwlock_release_read (&rwlock);
+  sema_up (&done);
+}
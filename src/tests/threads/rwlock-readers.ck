@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-readers) begin
+(rwlock-readers) 1 readers held the lock concurrently.
+(rwlock-readers) 2 readers held the lock concurrently.
+(rwlock-readers) 4 readers held the lock concurrently.
+(rwlock-readers) 8 readers held the lock concurrently.
+(rwlock-readers) 16 readers held the lock concurrently.
+(rwlock-readers) end
+EOF
+pass;
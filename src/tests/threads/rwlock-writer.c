@@ -0,0 +1,74 @@
+/* Checks that a readers-writer lock prefers writers and hands
+   itself to waiters in priority order.
+
+   First, while the main thread holds a read lock and a writer
+   is waiting, a new reader must wait behind the writer.
+
+   Second, when the main thread releases a write lock, waiting
+   writers get it one at a time, highest priority first, and
+   only then do the waiting readers get it together. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func reader_thread;
+static thread_func writer_thread;
+static struct rwlock rwlock;
+static struct semaphore done;
+
+void
+test_rwlock_writer (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  rwlock_init (&rwlock);
+  sema_init (&done, 0);
+
+  /* Writer preference. */
+  rwlock_acquire_read (&rwlock);
+  thread_create ("writer", PRI_DEFAULT, writer_thread, NULL);
+  timer_sleep (10);
+  thread_create ("late reader", PRI_DEFAULT, reader_thread, NULL);
+  timer_sleep (10);
+  msg ("Main thread releasing read lock.");
+  rwlock_release_read (&rwlock);
+  for (i = 0; i < 2; i++)
+    sema_down (&done);
+
+  /* Priority order. */
+  rwlock_acquire_write (&rwlock);
+  thread_create ("reader 1", PRI_DEFAULT, reader_thread, NULL);
+  thread_create ("writer low", PRI_DEFAULT + 1, writer_thread, NULL);
+  thread_create ("writer high", PRI_DEFAULT + 3, writer_thread, NULL);
+  thread_create ("reader 2", PRI_DEFAULT, reader_thread, NULL);
+  timer_sleep (10);
+  msg ("Main thread releasing write lock.");
+  rwlock_release_write (&rwlock);
+  for (i = 0; i < 4; i++)
+    sema_down (&done);
+}
+
+static void
+reader_thread (void *aux UNUSED) 
+{
+  rwlock_acquire_read (&rwlock);
+  msg ("Thread %s acquired read lock.", thread_name ());
+  rwlock_release_read (&rwlock);
+  sema_up (&done);
+}
+
+static void
+writer_thread (void *aux UNUSED) 
+{
+  rwlock_acquire_write (&rwlock);
+  msg ("Thread %s acquired write lock.", thread_name ());
+  rwlock_release_write (&rwlock);
+  sema_up (&done);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-writer) begin
+(rwlock-writer) Main thread releasing read lock.
+(rwlock-writer) Thread writer acquired write lock.
+(rwlock-writer) Thread late reader acquired read lock.
+(rwlock-writer) Main thread releasing write lock.
+(rwlock-writer) Thread writer high acquired write lock.
+(rwlock-writer) Thread writer low acquired write lock.
+(rwlock-writer) Thread reader 1 acquired read lock.
+(rwlock-writer) Thread reader 2 acquired read lock.
+(rwlock-writer) end
+EOF
+pass;
@@ -39,6 +39,12 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"rwlock-readers", test_rwlock_readers},
+    {"rwlock-writer", test_rwlock_writer},
+    {"bench-bitmap", test_bench_bitmap},
+    {"bench-memcpy", test_bench_memcpy},
+    {"bench-hash", test_bench_hash},
+    {"block-queue", test_block_queue},
   };
 
 static const char *test_name;
@@ -33,6 +33,12 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_rwlock_readers;
+extern test_func test_rwlock_writer;
+extern test_func test_bench_bitmap;
+extern test_func test_bench_memcpy;
+extern test_func test_bench_hash;
+extern test_func test_block_queue;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
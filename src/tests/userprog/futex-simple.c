@@ -0,0 +1,33 @@
+/* Exercises futexes and the user-level mutex built on them
+   without any contention: futex_wait() must return at once when
+   the word does not hold the expected value, futex_wake() must
+   find no sleepers, and an uncontended mutex must lock and
+   unlock. */
+
+#include <syscall.h>
+#include <synch.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word;
+static struct mutex mutex = MUTEX_INITIALIZER;
+static struct condvar cond = CONDVAR_INITIALIZER;
+
+void
+test_main (void) 
+{
+  word = 1;
+  CHECK (futex_wait (&word, 0) == -1, "futex_wait on changed word");
+  CHECK (futex_wake (&word, 1) == 0, "futex_wake with no sleepers");
+
+  mutex_lock (&mutex);
+  CHECK (!mutex_trylock (&mutex), "trylock of locked mutex fails");
+  mutex_unlock (&mutex);
+  CHECK (mutex_trylock (&mutex), "trylock of unlocked mutex succeeds");
+  mutex_unlock (&mutex);
+  CHECK (mutex.value == 0, "mutex is unlocked");
+
+  condvar_signal (&cond);
+  condvar_broadcast (&cond);
+  msg ("signaled condition with no waiters");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-simple) begin
+(futex-simple) futex_wait on changed word
+(futex-simple) futex_wake with no sleepers
+(futex-simple) trylock of locked mutex fails
+(futex-simple) trylock of unlocked mutex succeeds
+(futex-simple) mutex is unlocked
+(futex-simple) signaled condition with no waiters
+(futex-simple) end
+futex-simple: exit(0)
+EOF
+pass;
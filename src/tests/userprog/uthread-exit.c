@@ -0,0 +1,37 @@
+/* Starts one thread that spins forever and another that sleeps
+   forever on a mutex, then exits the process from the main
+   thread.  Both threads must be killed so that the process can
+   exit cleanly. */
+
+#include <syscall.h>
+#include <synch.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct mutex mutex = MUTEX_INITIALIZER;
+
+static int
+spinner (void *aux UNUSED) 
+{
+  volatile int spins = 0;
+
+  for (;;)
+    spins++;
+  return 0;
+}
+
+static int
+sleeper (void *aux UNUSED) 
+{
+  mutex_lock (&mutex);
+  fail ("sleeper acquired mutex");
+  return 0;
+}
+
+void
+test_main (void) 
+{
+  mutex_lock (&mutex);
+  CHECK (uthread_create (spinner, NULL) != PID_ERROR, "create spinner");
+  CHECK (uthread_create (sleeper, NULL) != PID_ERROR, "create sleeper");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(uthread-exit) begin
+(uthread-exit) create spinner
+(uthread-exit) create sleeper
+(uthread-exit) end
+uthread-exit: exit(0)
+EOF
+pass;
@@ -0,0 +1,44 @@
+/* Starts several threads that each add to a shared counter many
+   times under a user-level mutex, then joins them.  The counter
+   must come out exact, each thread's exit status must reach its
+   joiner, and a thread can be joined only once. */
+
+#include <syscall.h>
+#include <synch.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ITER_CNT 1000
+
+static struct mutex mutex = MUTEX_INITIALIZER;
+static volatile int counter;
+
+static int
+adder (void *aux) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      mutex_lock (&mutex);
+      counter++;
+      mutex_unlock (&mutex);
+    }
+  return (int) aux;
+}
+
+void
+test_main (void) 
+{
+  pid_t tids[THREAD_CNT];
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK ((tids[i] = uthread_create (adder, (void *) (i + 10))) != PID_ERROR,
+           "create thread %d", i);
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (uthread_join (tids[i]) == i + 10, "join thread %d", i);
+  CHECK (uthread_join (tids[0]) == -1, "second join of thread 0 fails");
+  CHECK (counter == THREAD_CNT * ITER_CNT, "counter is %d", counter);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(uthread-simple) begin
+(uthread-simple) create thread 0
+(uthread-simple) create thread 1
+(uthread-simple) create thread 2
+(uthread-simple) create thread 3
+(uthread-simple) join thread 0
+(uthread-simple) join thread 1
+(uthread-simple) join thread 2
+(uthread-simple) join thread 3
+(uthread-simple) second join of thread 0 fails
+(uthread-simple) counter is 4000
+(uthread-simple) end
+uthread-simple: exit(0)
+EOF
+pass;
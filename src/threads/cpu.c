@@ -0,0 +1,406 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <packed.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#endif
+
+/* Symmetric multiprocessing.
+
+   cpu_init() looks for other CPUs in the MultiProcessor
+   Specification (MPS) configuration table that the BIOS leaves
+   in low memory, and cpu_start_aps() starts the ones it finds.
+
+   Each CPU schedules threads from its own run queue and takes
+   threads from the others' when its own runs dry (see
+   thread.c).  Mutual exclusion is unchanged from the
+   uniprocessor kernel: code that disables interrupts also
+   acquires a spinlock shared by all CPUs (see interrupt.c), so
+   everything built on intr_disable(), including all of synch.h,
+   works as before.  CPUs run in parallel whenever they have
+   interrupts enabled, as threads and user processes normally
+   do.
+
+   Device interrupts, including the timer, go only to the
+   bootstrap processor (BSP), which forwards each timer tick to
+   the other CPUs as an interprocessor interrupt (IPI) so that
+   they preempt their threads too.
+
+   A CPU caches page table entries in its TLB, and only flushes
+   them itself when it loads CR3.  A thread that unmaps a page of
+   an address space that threads on other CPUs may be using must
+   therefore call cpu_flush_tlbs() before reusing the page
+   ("TLB shootdown"). */
+
+struct cpu cpus[CPU_MAX];
+int cpu_cnt = 1;
+int cpu_found_cnt = 1;
+
+/* MPS floating pointer structure.  See [MPS] 4.1. */
+struct mp_float
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config_paddr;      /* Physical address of mp_config. */
+    uint8_t length;             /* Length in 16-byte units. */
+    uint8_t spec_rev;           /* Version of the specification. */
+    uint8_t checksum;           /* Makes all bytes sum to 0. */
+    uint8_t type;               /* Default configuration, or 0. */
+    uint8_t features;           /* Feature flags. */
+    uint8_t reserved[3];
+  }
+PACKED;
+
+/* MPS configuration table header.  See [MPS] 4.2.  It is
+   followed by ENTRY_CNT variable-length entries. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Length in bytes, with entries. */
+    uint8_t spec_rev;           /* Version of the specification. */
+    uint8_t checksum;           /* Makes all bytes sum to 0. */
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table_paddr;
+    uint16_t oem_table_size;
+    uint16_t entry_cnt;         /* Number of entries. */
+    uint32_t lapic_paddr;       /* Physical address of local APICs. */
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+  }
+PACKED;
+
+/* MPS processor entry.  See [MPS] 4.3.1.  All other types of
+   entries are 8 bytes long. */
+struct mp_processor
+  {
+    uint8_t type;               /* MP_PROCESSOR. */
+    uint8_t apic_id;            /* Local APIC ID. */
+    uint8_t apic_version;
+    uint8_t flags;              /* MP_* flags below. */
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+  }
+PACKED;
+
+#define MP_PROCESSOR 0          /* Processor entry type. */
+#define MP_ENABLED 0x01         /* Processor is usable. */
+#define MP_BSP 0x02             /* Processor is the BSP. */
+
+/* Trampoline in ap-start.S. */
+extern char ap_start[], ap_start_end[], ap_gdt[];
+extern uint32_t ap_cr3, ap_esp, ap_entry;
+
+static struct mp_float *mp_search (void);
+static struct mp_float *mp_search_range (uint32_t paddr, size_t size);
+static uint8_t checksum (const void *, size_t);
+static uint32_t *trampoline_param (uint32_t *);
+static void ap_main (void) NO_RETURN;
+static intr_handler_func reschedule_interrupt;
+static intr_handler_func tick_interrupt;
+static intr_handler_func flush_tlb_interrupt;
+static intr_handler_func spurious_interrupt;
+
+/* Initializes cpus[] with the bootstrap processor and, if SMP is
+   true, with any other CPUs listed in the MPS configuration
+   table.  Must be called before paging_init(), which maps the
+   local APIC if there is more than one CPU. */
+void
+cpu_init (bool smp)
+{
+  struct mp_float *mp;
+  struct mp_config *config;
+  uint8_t *entry, *end;
+  int i;
+
+  for (i = 0; i < CPU_MAX; i++)
+    cpus[i].id = i;
+  cpus[0].state = CPU_STARTED;
+
+  if (!smp)
+    return;
+  mp = mp_search ();
+  if (mp == NULL || mp->config_paddr == 0
+      || mp->config_paddr >= init_ram_pages * PGSIZE)
+    return;
+  config = ptov (mp->config_paddr);
+  if (memcmp (config->signature, "PCMP", 4)
+      || checksum (config, config->length) != 0)
+    return;
+
+  entry = (uint8_t *) (config + 1);
+  end = (uint8_t *) config + config->length;
+  for (i = 0; i < config->entry_cnt && entry < end; i++)
+    if (*entry == MP_PROCESSOR)
+      {
+        struct mp_processor *p = (struct mp_processor *) entry;
+        if ((p->flags & (MP_ENABLED | MP_BSP)) == MP_ENABLED)
+          {
+            if (cpu_found_cnt < CPU_MAX)
+              cpus[cpu_found_cnt++].apic_id = p->apic_id;
+            else
+              printf ("cpu: ignoring CPU with APIC ID %"PRIu8
+                      " beyond %d CPUs\n", p->apic_id, CPU_MAX);
+          }
+        entry += sizeof *p;
+      }
+    else
+      entry += 8;
+
+  if (cpu_found_cnt > 1)
+    lapic_paddr = config->lapic_paddr;
+}
+
+/* Starts the CPUs other than the BSP that cpu_init() found.
+   Must be called on the BSP with interrupts on, after
+   timer_calibrate(). */
+void
+cpu_start_aps (void)
+{
+  uint8_t *copy = ptov (AP_START_PHYS);
+  int i;
+
+  if (cpu_found_cnt <= 1)
+    return;
+  ASSERT (intr_get_level () == INTR_ON);
+  ASSERT (ap_start_end - ap_start <= PGSIZE);
+
+  lapic_init (true);
+  cpus[0].apic_id = lapic_id ();
+  intr_register_ipi (IPI_RESCHEDULE, reschedule_interrupt, "Reschedule IPI");
+  intr_register_ipi (IPI_TICK, tick_interrupt, "Timer tick IPI");
+  intr_register_ipi (IPI_FLUSH_TLB, flush_tlb_interrupt, "TLB flush IPI");
+  intr_register_int (LAPIC_SPURIOUS_VEC, 0, INTR_OFF, spurious_interrupt,
+                     "Spurious APIC interrupt");
+
+  /* From now on, disabling interrupts excludes the other CPUs
+     too. */
+  intr_start_smp ();
+
+  /* Install the trampoline.  The other CPUs turn on paging while
+     running at AP_START_PHYS, so until they are all running,
+     the first 4 MB of physical memory must also be mapped at
+     virtual address 0, as start.S does for the BSP. */
+  memcpy (copy, ap_start, ap_start_end - ap_start);
+  *trampoline_param (&ap_cr3) = vtop (init_page_dir);
+  *trampoline_param (&ap_entry) = (uint32_t) ap_main;
+  init_page_dir[0] = init_page_dir[pd_no (PHYS_BASE)];
+
+  for (i = 1; i < cpu_found_cnt; i++)
+    {
+      struct cpu *cpu = &cpus[i];
+      struct thread *idle = palloc_get_page (PAL_ZERO);
+      int ms;
+
+      if (idle == NULL)
+        break;
+
+      /* The new CPU starts out running its idle thread, on the
+         idle thread's stack. */
+      thread_init_idle (idle, cpu);
+      *trampoline_param (&ap_esp) = (uint32_t) idle + PGSIZE;
+      lapic_start_ap (cpu->apic_id, AP_START_PHYS);
+
+      for (ms = 0; ms < 100 && cpu->state == CPU_WAITING; ms++)
+        timer_mdelay (1);
+      if (!__sync_bool_compare_and_swap (&cpu->state, CPU_WAITING,
+                                         CPU_ABANDONED))
+        cpu_cnt++;
+      else
+        {
+          printf ("cpu: CPU with APIC ID %"PRIu8" did not start\n",
+                  cpu->apic_id);
+          break;
+        }
+    }
+
+  init_page_dir[0] = 0;
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+  printf ("%d of %d CPUs started.\n", cpu_cnt, cpu_found_cnt);
+}
+
+/* Forwards a timer tick to the other CPUs.  Called by the BSP's
+   timer interrupt handler. */
+void
+cpu_broadcast_tick (void)
+{
+  if (cpu_cnt > 1)
+    lapic_broadcast_ipi (IPI_TICK);
+}
+
+/* Flushes the TLB of every other CPU that has page directory PD
+   loaded, and waits until all of them have done so.  Call after
+   unmapping pages in PD and before freeing them.  Must be called
+   with interrupts on, because the other CPUs cannot handle the
+   IPI while this one holds the interrupt lock. */
+void
+cpu_flush_tlbs (uint32_t *pd) 
+{
+  unsigned seen[CPU_MAX];
+  bool sent[CPU_MAX];
+  enum intr_level old_level;
+  int i;
+
+  if (cpu_cnt <= 1)
+    return;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  /* Acquiring the interrupt lock is a full memory barrier, so
+     the caller's page table changes are visible before we look
+     at which page directories the other CPUs have loaded.  A CPU
+     that loads PD after this point sees those changes. */
+  old_level = intr_disable ();
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *cpu = &cpus[i];
+      sent[i] = cpu != cpu_current () && cpu->pagedir == pd;
+      if (sent[i])
+        {
+          seen[i] = cpu->flush_cnt;
+          lapic_send_ipi (cpu->apic_id, IPI_FLUSH_TLB);
+        }
+    }
+  intr_set_level (old_level);
+
+  /* Any flush counted after we sent the IPI will do, even one
+     that another CPU asked for. */
+  for (i = 0; i < cpu_cnt; i++)
+    if (sent[i])
+      while (cpus[i].flush_cnt == seen[i])
+        asm volatile ("pause");
+}
+
+/* Returns the MPS floating pointer structure, or a null pointer
+   if there is none.  It is in the first kB of the extended BIOS
+   data area, in the last kB of base memory, or in the BIOS ROM.
+   See [MPS] 4. */
+static struct mp_float *
+mp_search (void)
+{
+  const uint8_t *bda = ptov (0x400);
+  uint32_t ebda = *(const uint16_t *) (bda + 0x0e) << 4;
+  uint32_t base_kb = *(const uint16_t *) (bda + 0x13);
+  struct mp_float *mp = NULL;
+
+  if (ebda != 0)
+    mp = mp_search_range (ebda, 1024);
+  if (mp == NULL && base_kb > 0)
+    mp = mp_search_range (base_kb * 1024 - 1024, 1024);
+  if (mp == NULL)
+    mp = mp_search_range (0xf0000, 0x10000);
+  return mp;
+}
+
+/* Looks for the MPS floating pointer structure in the SIZE bytes
+   of physical memory starting at PADDR.  Returns it, or a null
+   pointer if it is not found. */
+static struct mp_float *
+mp_search_range (uint32_t paddr, size_t size)
+{
+  uint8_t *p = ptov (paddr);
+  uint8_t *end = p + size;
+
+  /* The structure is aligned on a 16-byte boundary. */
+  for (; p + sizeof (struct mp_float) <= end; p += 16)
+    if (!memcmp (p, "_MP_", 4)
+        && checksum (p, sizeof (struct mp_float)) == 0)
+      return (struct mp_float *) p;
+  return NULL;
+}
+
+/* Returns the sum of the SIZE bytes in BUF, modulo 256. */
+static uint8_t
+checksum (const void *buf_, size_t size)
+{
+  const uint8_t *buf = buf_;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *buf++;
+  return sum;
+}
+
+/* Returns the address of trampoline parameter PARAM in the copy
+   at AP_START_PHYS. */
+static uint32_t *
+trampoline_param (uint32_t *param)
+{
+  return (uint32_t *) ((uint8_t *) ptov (AP_START_PHYS)
+                       + ((char *) param - ap_start));
+}
+
+/* C entry point of the CPUs other than the BSP, called by
+   ap-start.S on the CPU's idle thread's stack. */
+static void
+ap_main (void)
+{
+  struct cpu *cpu = cpu_current ();
+
+  /* Give up if cpu_start_aps() already did. */
+  if (!__sync_bool_compare_and_swap (&cpu->state, CPU_WAITING, CPU_STARTED))
+    for (;;)
+      asm volatile ("cli; hlt");
+
+  intr_init_ap ();
+#ifdef USERPROG
+  gdt_load (cpu->id);
+#else
+  {
+    /* Keep using the trampoline's GDT, but at its address in the
+       kernel's mapping of physical memory. */
+    uint8_t *gdt = (uint8_t *) ptov (AP_START_PHYS) + (ap_gdt - ap_start);
+    uint64_t gdtr_operand = (3 * 8 - 1) | ((uint64_t) (uint32_t) gdt << 16);
+    asm volatile ("lgdt %0" : : "m" (gdtr_operand));
+  }
+#endif
+  lapic_init (false);
+  thread_start_ap ();
+}
+
+/* Handler for IPI_RESCHEDULE, sent when threads are put on this
+   CPU's run queue by another CPU. */
+static void
+reschedule_interrupt (struct intr_frame *f UNUSED)
+{
+  intr_yield_on_return ();
+}
+
+/* Handler for IPI_TICK. */
+static void
+tick_interrupt (struct intr_frame *f UNUSED)
+{
+  thread_tick ();
+}
+
+/* Handler for IPI_FLUSH_TLB.  Reloading CR3 flushes every TLB
+   entry for user pages.  See [IA32-v3a] 3.12 "Translation
+   Lookaside Buffers (TLBs)". */
+static void
+flush_tlb_interrupt (struct intr_frame *f UNUSED)
+{
+  uint32_t cr3;
+
+  asm volatile ("movl %%cr3, %0; movl %0, %%cr3" : "=r" (cr3) : : "memory");
+  cpu_current ()->flush_cnt++;
+}
+
+/* Handler for spurious local APIC interrupts, which need no
+   action at all. */
+static void
+spurious_interrupt (struct intr_frame *f UNUSED)
+{
+}
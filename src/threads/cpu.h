@@ -0,0 +1,85 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Maximum number of CPUs. */
+#define CPU_MAX 8
+
+/* Interprocessor interrupt vectors.  See intr_register_ipi(). */
+#define IPI_RESCHEDULE 0xf0     /* Run the scheduler. */
+#define IPI_TICK 0xf1           /* Timer tick, forwarded by the BSP. */
+#define IPI_FLUSH_TLB 0xf2      /* Flush the TLB.  See cpu_flush_tlbs(). */
+
+/* Start-up states of a CPU. */
+enum cpu_state
+  {
+    CPU_WAITING,                /* Not yet started. */
+    CPU_STARTED,                /* Running. */
+    CPU_ABANDONED               /* Took too long to start; must halt. */
+  };
+
+/* A CPU.
+
+   cpus[0] is the bootstrap processor (BSP) that runs main().
+   With more than one CPU, the others ("application processors")
+   are started by cpu_start_aps() and run only threads, beginning
+   with an idle thread of their own. */
+struct cpu
+  {
+    int id;                     /* Index in cpus[]. */
+    uint8_t apic_id;            /* Local APIC ID. */
+    volatile int state;         /* An enum cpu_state. */
+
+    /* Owned by thread.c. */
+    struct thread *idle_thread; /* This CPU's idle thread. */
+    struct list ready_list;     /* Threads ready to run here. */
+    int ready_cnt;              /* Number of threads in ready_list. */
+    unsigned thread_ticks;      /* Timer ticks since last yield. */
+    long long idle_ticks;       /* Timer ticks spent idle. */
+    long long kernel_ticks;     /* Timer ticks in kernel threads. */
+    long long user_ticks;       /* Timer ticks in user programs. */
+    long long steal_cnt;        /* Threads taken from other CPUs. */
+
+    /* Owned by userprog/pagedir.c. */
+    uint32_t *volatile pagedir; /* Page directory loaded in CR3. */
+
+    /* Owned by cpu.c. */
+    volatile unsigned flush_cnt; /* TLB flushes done for other CPUs. */
+
+    /* Owned by interrupt.c. */
+    bool in_external_intr;      /* Processing an external interrupt? */
+    bool yield_on_return;       /* Yield on interrupt return? */
+  };
+
+/* CPUs that are running. */
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+
+/* CPUs that cpu_init() found, including those not yet started. */
+extern int cpu_found_cnt;
+
+void cpu_init (bool smp);
+void cpu_start_aps (void);
+void cpu_broadcast_tick (void);
+void cpu_flush_tlbs (uint32_t *pd);
+
+/* Returns the running CPU.  Only meaningful with interrupts off:
+   otherwise the running thread may move to another CPU right
+   after the call. */
+static inline struct cpu *
+cpu_current (void)
+{
+  uintptr_t esp;
+
+  /* The running thread's struct thread is at the bottom of the
+     page that holds its stack; see running_thread(). */
+  asm ("mov %%esp, %0" : "=g" (esp));
+  return ((struct thread *) pg_round_down ((void *) esp))->cpu;
+}
+
+#endif /* threads/cpu.h */
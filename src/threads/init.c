@@ -10,11 +10,14 @@
 #include <string.h>
 #include "devices/kbd.h"
 #include "devices/input.h"
+#include "devices/lapic.h"
+#include "devices/pci.h"
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -22,6 +25,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -34,6 +38,9 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/virtio-blk.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -57,6 +64,30 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -trace: Number of pages in the event trace buffer, or 0 to
+   disable tracing.
+   -trace-file: File to dump the trace into at shutdown. */
+#define TRACE_DEFAULT_PAGES 16
+static size_t trace_pages;
+static const char *trace_file_name;
+
+/* -nosmp: Use only the first CPU? */
+static bool no_smp;
+
+#ifdef FILESYS
+/* -nodma: Use PIO for all disk transfers? */
+static bool no_dma;
+
+/* -stripe: Names of block devices to stripe together, separated
+   by commas, or null. */
+static const char *stripe_members;
+
+/* -ramdisk: Size of RAM disk in kB, or 0 for none.
+   -ramdisk-load: Copy the scratch device into the RAM disk? */
+static size_t ramdisk_kb;
+static bool ramdisk_load_scratch;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -94,10 +125,14 @@ main (void)
   printf ("Pintos booting with %'"PRIu32" kB RAM...\n",
           init_ram_pages * PGSIZE / 1024);
 
+  /* Look for other CPUs. */
+  cpu_init (!no_smp);
+
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+  trace_init (trace_pages, trace_file_name);
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -119,11 +154,24 @@ main (void)
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+  cpu_start_aps ();
 
 #ifdef FILESYS
   /* Initialize file system. */
-  ide_init ();
+  pci_init ();
+  ide_init (!no_dma);
+  virtio_blk_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb);
+  if (stripe_members != NULL)
+    stripe_init (stripe_members);
   locate_block_devices ();
+  if (ramdisk_load_scratch)
+    {
+      if (ramdisk_kb == 0 || block_get_role (BLOCK_SCRATCH) == NULL)
+        PANIC ("-ramdisk-load requires -ramdisk and a scratch device");
+      ramdisk_load (block_get_role (BLOCK_SCRATCH));
+    }
   filesys_init (format_filesys);
 #endif
 
@@ -180,6 +228,18 @@ paging_init (void)
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
     }
 
+  /* Map the local APIC's registers, which lie far above RAM, at
+     LAPIC_VADDR.  They must not be cached. */
+  if (lapic_present ())
+    {
+      size_t pde_idx = pd_no (LAPIC_VADDR);
+      if (pd[pde_idx] == 0)
+        pd[pde_idx] = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+      pt = pde_get_pt (pd[pde_idx]);
+      pt[pt_no (LAPIC_VADDR)] = ((lapic_paddr & PTE_ADDR)
+                                 | PTE_P | PTE_W | PTE_PCD | PTE_PWT);
+    }
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -247,6 +307,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-nodma"))
+        no_dma = true;
+      else if (!strcmp (name, "-stripe"))
+        stripe_members = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-ramdisk-load"))
+        ramdisk_load_scratch = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -256,6 +324,14 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-nosmp"))
+        no_smp = true;
+      else if (!strcmp (name, "-trace"))
+        trace_pages = value != NULL ? (size_t) atoi (value) : TRACE_DEFAULT_PAGES;
+#ifdef FILESYS
+      else if (!strcmp (name, "-trace-file"))
+        trace_file_name = value;
+#endif
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -373,12 +449,23 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -nodma             Transfer disk data without DMA.\n"
+          "  -stripe=BDEV,...   Create block device stripe0 striped across\n"
+          "                     the BDEVs (use with e.g. -filesys=stripe0).\n"
+          "  -ramdisk=KB        Create KB kB RAM disk ram0 (use with e.g.\n"
+          "                     -filesys=ram0 or -swap=ram0).\n"
+          "  -ramdisk-load      Copy scratch device into ram0 at startup.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -nosmp             Use only one CPU, even if there are more.\n"
+          "  -trace[=PAGES]     Record kernel events in a PAGES-page buffer.\n"
+#ifdef FILESYS
+          "  -trace-file=FILE   Dump the event trace into FILE at shutdown.\n"
+#endif
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -400,8 +487,10 @@ locate_block_devices (void)
 
 /* Figures out what block device to use for the given ROLE: the
    block device with the given NAME, if NAME is non-null,
-   otherwise the first block device in probe order of type
-   ROLE. */
+   otherwise the first block device in probe order of type ROLE
+   whose controller no other role uses yet, so that I/O for the
+   roles can overlap, or failing that the first block device of
+   type ROLE. */
 static void
 locate_block_device (enum block_type role, const char *name)
 {
@@ -415,9 +504,24 @@ locate_block_device (enum block_type role, const char *name)
     }
   else
     {
+      struct block *first = NULL;
+
       for (block = block_first (); block != NULL; block = block_next (block))
         if (block_type (block) == role)
-          break;
+          {
+            enum block_type other;
+
+            if (first == NULL)
+              first = block;
+            for (other = 0; other < BLOCK_ROLE_CNT; other++)
+              if (block_get_role (other) != NULL
+                  && block_share_controller (block, block_get_role (other)))
+                break;
+            if (other == BLOCK_ROLE_CNT)
+              break;
+          }
+      if (block == NULL)
+        block = first;
     }
 
   if (block != NULL)
@@ -3,12 +3,19 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/spinlock.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -21,6 +28,10 @@
 /* Number of x86 interrupts. */
 #define INTR_CNT 256
 
+/* Vectors for interprocessor interrupts (IPIs). */
+#define IPI_MIN 0xf0
+#define IPI_MAX 0xfe
+
 /* The Interrupt Descriptor Table (IDT).  The format is fixed by
    the CPU.  See [IA32-v3a] sections 5.10 "Interrupt Descriptor
    Table (IDT)", 5.11 "IDT Descriptors", 5.12.1.2 "Flag Usage By
@@ -43,9 +54,19 @@ static unsigned int unexpected_cnt[INTR_CNT];
    pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+   interrupt returns.  Interprocessor interrupts are handled the
+   same way.  Each CPU keeps track of its own external interrupt
+   in struct cpu's `in_external_intr' and `yield_on_return'. */
+
+/* Interrupt lock.  Once other CPUs have been started, a CPU
+   holds this lock whenever it has interrupts disabled, so that
+   disabling interrupts excludes other CPUs as well as interrupt
+   handlers.  See cpu.c. */
+static struct spinlock intr_lock;
+static bool intr_lock_enabled;  /* Set by intr_start_smp(). */
+
+static void intr_lock_acquire (void);
+static void intr_lock_release (void);
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -90,6 +111,9 @@ intr_enable (void)
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (old_level == INTR_OFF)
+    intr_lock_release ();
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -109,9 +133,59 @@ intr_disable (void)
      See [IA32-v2b] "CLI" and [IA32-v3a] 5.8.1 "Masking Maskable
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
+  if (old_level == INTR_ON)
+    intr_lock_acquire ();
 
   return old_level;
 }
+
+/* Enables interrupts and waits for the next one.  Interrupts
+   must be off on entry.  Used by the idle thread. */
+void
+intr_wait (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!intr_context ());
+
+  intr_lock_release ();
+
+  /* The `sti' instruction disables interrupts until the
+     completion of the next instruction, so these two
+     instructions are executed atomically.  This atomicity is
+     important; otherwise, an interrupt could be handled
+     between re-enabling interrupts and waiting for the next
+     one to occur, wasting as much as one clock tick worth of
+     time.
+
+     See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
+     7.11.1 "HLT Instruction". */
+  asm volatile ("sti; hlt" : : : "memory");
+}
+
+/* Makes disabling interrupts exclude other CPUs from then on.
+   Called just before starting other CPUs, with interrupts on. */
+void
+intr_start_smp (void) 
+{
+  ASSERT (intr_get_level () == INTR_ON);
+  intr_lock_enabled = true;
+}
+
+/* Acquires the interrupt lock, if other CPUs may be running. */
+static void
+intr_lock_acquire (void) 
+{
+  if (intr_lock_enabled)
+    spinlock_acquire (&intr_lock);
+}
+
+/* Releases the interrupt lock, if other CPUs may be running. */
+static void
+intr_lock_release (void) 
+{
+  if (intr_lock_enabled)
+    spinlock_release (&intr_lock);
+}
 
 /* Initializes the interrupt system. */
 void
@@ -157,6 +231,22 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Initializes interrupt handling on a CPU other than the first,
+   which starts with interrupts off. */
+void
+intr_init_ap (void) 
+{
+  uint64_t idtr_operand;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+
+  /* Like any CPU with interrupts off, hold the interrupt lock. */
+  intr_lock_acquire ();
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -203,15 +293,30 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
                    intr_handler_func *handler, const char *name)
 {
   ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT (vec_no < IPI_MIN || vec_no > IPI_MAX);
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Registers interprocessor interrupt VEC_NO to invoke HANDLER,
+   which is named NAME for debugging purposes.  The handler runs
+   like that of an external interrupt. */
+void
+intr_register_ipi (uint8_t vec_no, intr_handler_func *handler,
+                   const char *name) 
+{
+  ASSERT (vec_no >= IPI_MIN && vec_no <= IPI_MAX);
+  register_handler (vec_no, 0, INTR_OFF, handler, name);
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  /* External interrupts are always handled with interrupts off,
+     which also keeps us on the same CPU while we look. */
+  return (intr_get_level () == INTR_OFF
+          && cpu_current ()->in_external_intr);
 }
 
 /* During processing of an external interrupt, directs the
@@ -222,7 +327,7 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
-  yield_on_return = true;
+  cpu_current ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -344,21 +449,31 @@ make_idtr_operand (uint16_t limit, void *base)
 void
 intr_handler (struct intr_frame *frame) 
 {
-  bool external;
+  bool external, ipi, locked;
   intr_handler_func *handler;
+  struct cpu *cpu;
+
+  /* Entering through an interrupt gate turned interrupts off, so
+     take the interrupt lock, unless the interrupted code already
+     held it because it had interrupts off itself. */
+  locked = (frame->eflags & FLAG_IF) && intr_get_level () == INTR_OFF;
+  if (locked)
+    intr_lock_acquire ();
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
      and they need to be acknowledged on the PIC (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  ipi = frame->vec_no >= IPI_MIN && frame->vec_no <= IPI_MAX;
+  external = (frame->vec_no >= 0x20 && frame->vec_no < 0x30) || ipi;
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
-      in_external_intr = true;
-      yield_on_return = false;
+      cpu = cpu_current ();
+      cpu->in_external_intr = true;
+      cpu->yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
@@ -380,12 +495,33 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
-      in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      cpu->in_external_intr = false;
+      if (ipi)
+        lapic_eoi ();
+      else
+        pic_end_of_interrupt (frame->vec_no); 
 
-      if (yield_on_return) 
+      if (cpu->yield_on_return) 
         thread_yield (); 
+
+#ifdef USERPROG
+      /* A user thread that spins without making system calls
+         still dies promptly when its process exits.  Exiting
+         must not happen with interrupts off, but the interrupt
+         came from user mode, so this is the outermost frame on
+         the thread's kernel stack and the external interrupt is
+         done: turning them back on here is safe. */
+      if (frame->cs == SEL_UCSEG && process_killed ())
+        {
+          intr_enable ();
+          process_check_killed ();
+        }
+#endif
     }
+
+  /* Returning from the interrupt turns interrupts back on. */
+  if (locked && intr_get_level () == INTR_OFF)
+    intr_lock_release ();
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
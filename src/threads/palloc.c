@@ -7,8 +7,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <list.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,14 +24,50 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  Free pages are
+   kept in blocks of 2**ORDER pages, aligned to their size
+   relative to the pool base, on one free list per order.  A
+   request for N pages takes a block of the smallest order that
+   fits, splitting bigger blocks as needed, and gives back the
+   pages beyond N.  Freeing pages merges each free block with its
+   "buddy", the other half of the block of the next order, for as
+   long as the buddy is free too.  Both take time proportional to
+   the number of orders, not to the size of the pool.
+
+   The first page of each free block holds its free list element,
+   and the pool's order map records, for the first page of each
+   free block, the block's order.  A bitmap of pages in use is
+   kept as well, to catch double frees.
+
+   Allocating and freeing pages is done with interrupts off
+   rather than under a lock, because thread_schedule_tail() frees
+   the page of a dying thread from inside the scheduler. */
+
+/* Number of block orders.  Blocks range from 1 page up to
+   2**(ORDER_CNT - 1) pages. */
+#define ORDER_CNT 20
+
+/* Order map entry for the first page of a free block. */
+#define ORDER_FREE 0x80
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    const char *name;                   /* Name, for statistics. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *order_map;                 /* ORDER_FREE | order, or 0. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    size_t free_cnt;                    /* Number of free pages. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks, by order. */
+    size_t block_cnt[ORDER_CNT];        /* Number of blocks in each list. */
+
+    /* Statistics. */
+    unsigned long long alloc_cnt;       /* Successful allocations. */
+    unsigned long long fail_cnt;        /* Failed allocations. */
+    size_t min_free_cnt;                /* Minimum value of FREE_CNT. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +76,12 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static void free_pages (struct pool *, size_t page_idx, size_t page_cnt);
+static void free_block (struct pool *, size_t page_idx, int order);
+static struct list_elem *block_elem (struct pool *, size_t page_idx);
+static size_t block_idx (struct pool *, struct list_elem *);
+static void print_pool_stats (const struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -71,15 +114,16 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  old_level = intr_disable ();
+  page_idx = alloc_pages (pool, page_cnt);
+  intr_set_level (old_level);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -118,6 +162,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -137,8 +182,9 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  old_level = intr_disable ();
+  free_pages (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +194,27 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Prints statistics about both pools. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them and subtract it from
+     the pool's size.  This slightly overestimates, since the
+     maps need not cover their own pages. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +222,26 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->name = name;
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, 0, page_cnt);
   p->base = base + bm_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->block_cnt[order] = 0;
+    }
+  p->alloc_cnt = p->fail_cnt = 0;
+
+  /* Start out with all the pages allocated, then free them all,
+     which puts them on the free lists in the biggest blocks
+     possible. */
+  bitmap_set_all (p->used_map, true);
+  free_pages (p, 0, page_cnt);
+  p->min_free_cnt = p->free_cnt;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -180,3 +255,158 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or BITMAP_ERROR if no block is big
+   enough.  Interrupts must be off. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt) 
+{
+  size_t page_idx;
+  int order, want;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Find the smallest order that holds PAGE_CNT pages, then the
+     smallest nonempty free list of at least that order. */
+  for (want = 0; want < ORDER_CNT && ((size_t) 1 << want) < page_cnt; want++)
+    continue;
+  for (order = want; order < ORDER_CNT; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= ORDER_CNT)
+    {
+      pool->fail_cnt++;
+      return BITMAP_ERROR;
+    }
+
+  page_idx = block_idx (pool, list_pop_front (&pool->free_lists[order]));
+  pool->block_cnt[order]--;
+  pool->order_map[page_idx] = 0;
+  pool->free_cnt -= (size_t) 1 << order;
+
+  /* Split the block down to order WANT, putting the upper half
+     of each split on the free list of the next lower order. */
+  while (order > want)
+    {
+      size_t buddy;
+
+      order--;
+      buddy = page_idx + ((size_t) 1 << order);
+      pool->order_map[buddy] = ORDER_FREE | order;
+      list_push_front (&pool->free_lists[order], block_elem (pool, buddy));
+      pool->block_cnt[order]++;
+      pool->free_cnt += (size_t) 1 << order;
+    }
+
+  /* Mark the block in use, then give back any pages beyond
+     PAGE_CNT. */
+  bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << want, true);
+  if (page_cnt < (size_t) 1 << want)
+    free_pages (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  pool->alloc_cnt++;
+  if (pool->free_cnt < pool->min_free_cnt)
+    pool->min_free_cnt = pool->free_cnt;
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages starting at index PAGE_IDX in POOL,
+   which need not have been allocated together, by breaking
+   them into the largest aligned blocks possible.  Interrupts
+   must be off. */
+static void
+free_pages (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool->free_cnt += page_cnt;
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && ((size_t) 1 << (order + 1)) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Puts the free block of 2**ORDER pages at index PAGE_IDX in
+   POOL on a free list, first merging it with its buddy for as
+   long as the buddy is also free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) 
+{
+  while (order + 1 < ORDER_CNT)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy + ((size_t) 1 << order) > pool->page_cnt
+          || pool->order_map[buddy] != (ORDER_FREE | order))
+        break;
+
+      /* Merge with the buddy. */
+      list_remove (block_elem (pool, buddy));
+      pool->block_cnt[order]--;
+      pool->order_map[buddy] = 0;
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+
+  pool->order_map[page_idx] = ORDER_FREE | order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+  pool->block_cnt[order]++;
+}
+
+/* Returns the free list element stored in the first page of the
+   free block at index PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) 
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index in POOL of the free block whose free list
+   element is E. */
+static size_t
+block_idx (struct pool *pool, struct list_elem *e) 
+{
+  return ((uint8_t *) e - pool->base) / PGSIZE;
+}
+
+/* Prints statistics about POOL.  Fragmentation is the fraction
+   of free pages that are not in the largest free block, so it is
+   0% when all free memory could be had in one request. */
+static void
+print_pool_stats (const struct pool *pool) 
+{
+  size_t largest = 0;
+  size_t frag;
+  int order;
+
+  for (order = ORDER_CNT - 1; order >= 0; order--)
+    if (pool->block_cnt[order] > 0)
+      {
+        largest = (size_t) 1 << order;
+        break;
+      }
+  frag = pool->free_cnt > 0 ? (pool->free_cnt - largest) * 100 / pool->free_cnt : 0;
+
+  printf ("Palloc: %s: %zu of %zu pages free (min %zu), largest block %zu, "
+          "fragmentation %zu%%, %llu allocations, %llu failed\n",
+          pool->name, pool->free_cnt, pool->page_cnt, pool->min_free_cnt,
+          largest, frag, pool->alloc_cnt, pool->fail_cnt);
+  printf ("  free blocks by order:");
+  for (order = 0; order < ORDER_CNT; order++)
+    if (pool->block_cnt[order] > 0)
+      printf (" %d:%zu", order, pool->block_cnt[order]);
+  printf ("\n");
+}
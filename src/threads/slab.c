@@ -0,0 +1,336 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Object caches ("slab allocator").
+
+   A cache hands out objects of a single type and size.  It
+   carves them out of one-page "slabs", each of which begins with
+   a header (struct slab) followed by the objects, so unlike
+   malloc() it does not round object sizes up to a power of 2.
+   Objects are aligned to 8 bytes (4 bytes for objects smaller
+   than that).
+
+   Each object is passed to the cache's constructor once, when
+   its slab is created, not on every allocation.  Clients must
+   therefore give objects back to kmem_cache_free() in their
+   constructed state, for example with no waiters on a
+   constructed semaphore and its value back where the
+   constructor left it.  This is the scheme of Bonwick, "The Slab
+   Allocator: An Object-Caching Kernel Memory Allocator" (USENIX
+   1994).  The free objects of a slab are tracked with a stack of
+   indexes in the slab header, so that free objects are never
+   written to.
+
+   The space left over after the header and objects is used to
+   "color" slabs: each new slab starts its objects at a different
+   offset, so that objects at the same index in different slabs
+   do not all compete for the same CPU cache lines.
+
+   A cache keeps its slabs on three lists, by how many of their
+   objects are allocated.  It allocates from partially used slabs
+   first, to keep the others empty, and keeps up to
+   EMPTY_SLAB_MAX empty slabs before it gives them back to the
+   page allocator. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Number of empty slabs a cache keeps. */
+#define EMPTY_SLAB_MAX 1
+
+/* Object cache. */
+struct kmem_cache
+  {
+    struct list_elem elem;      /* Element in cache_list. */
+    char name[16];              /* Name, for statistics. */
+    size_t size;                /* Object size requested. */
+    size_t obj_size;            /* Object size, rounded up for alignment. */
+    size_t align;               /* Object alignment. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object, uncolored. */
+    size_t color_cnt;           /* Number of distinct colors. */
+    size_t next_color;          /* Color of the next slab created. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+
+    struct lock lock;           /* Protects everything below. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list empty;          /* Slabs with only free objects. */
+    size_t empty_cnt;           /* Number of slabs in EMPTY. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use;              /* Objects allocated. */
+    size_t max_in_use;          /* Maximum value of IN_USE. */
+    unsigned long long alloc_cnt;       /* Calls to kmem_cache_alloc(). */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in a list in CACHE. */
+    uint8_t *objs;              /* First object. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects. */
+  };
+
+/* All caches, for statistics. */
+static struct list cache_list = LIST_INITIALIZER (cache_list);
+
+static struct slab *slab_create (struct kmem_cache *);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+static size_t header_size (size_t objs_per_slab, size_t align);
+
+/* Creates and returns a cache for SIZE-byte objects named NAME.
+   If CTOR is nonnull, it is called on each object when the slab
+   that holds it is created.  SIZE may be up to a little less
+   than a page.  Returns a null pointer if memory is not
+   available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    return NULL;
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->size = size;
+  c->align = size >= 8 ? 8 : 4;
+  c->obj_size = ROUND_UP (size, c->align);
+  c->ctor = ctor;
+
+  /* Fit as many objects as possible after the header. */
+  n = (PGSIZE - sizeof (struct slab)) / (c->obj_size + sizeof (uint16_t));
+  while (n > 0 && header_size (n, c->align) + n * c->obj_size > PGSIZE)
+    n--;
+  ASSERT (n > 0);
+  c->objs_per_slab = n;
+  c->obj_ofs = header_size (n, c->align);
+  c->color_cnt = (PGSIZE - c->obj_ofs - n * c->obj_size) / c->align + 1;
+  c->next_color = 0;
+
+  lock_init (&c->lock);
+  lock_set_name (&c->lock, c->name);
+  list_init (&c->full);
+  list_init (&c->partial);
+  list_init (&c->empty);
+  c->empty_cnt = 0;
+  c->slab_cnt = 0;
+  c->in_use = 0;
+  c->max_in_use = 0;
+  c->alloc_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&cache_list, &c->elem);
+  intr_set_level (old_level);
+
+  return c;
+}
+
+/* Obtains and returns an object from cache C, in the state that
+   C's constructor left it in.  Returns a null pointer if memory
+   is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* Prefer a partially used slab, then an empty one, then a new
+     one. */
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      c->empty_cnt--;
+      list_push_front (&c->partial, &s->elem);
+    }
+  else
+    {
+      s = slab_create (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  ASSERT (s->free_cnt > 0);
+  obj = s->objs + s->free[--s->free_cnt] * c->obj_size;
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+
+  c->alloc_cnt++;
+  if (++c->in_use > c->max_in_use)
+    c->max_in_use = c->in_use;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C with
+   kmem_cache_alloc() and must be in its constructed state, to C.
+   Does nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+  idx = ((uint8_t *) obj - s->objs) / c->obj_size;
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = idx;
+  c->in_use--;
+
+  if (s->free_cnt == 1 && c->objs_per_slab > 1)
+    {
+      /* Was full, now partial. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  else if (s->free_cnt == c->objs_per_slab)
+    {
+      /* Now empty.  Keep it, unless there are enough already. */
+      list_remove (&s->elem);
+      if (c->empty_cnt < EMPTY_SLAB_MAX)
+        {
+          list_push_front (&c->empty, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        slab_destroy (c, s);
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache that has been used. */
+void
+kmem_cache_print_stats (void)
+{
+  struct list_elem *e;
+  bool header = false;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      if (c->alloc_cnt == 0)
+        continue;
+      if (!header)
+        {
+          printf ("Slab caches:\n");
+          header = true;
+        }
+      printf ("  %s: %zu-byte objects, %zu per slab, %zu in use (max %zu), "
+              "%zu slabs, %llu allocations\n",
+              c->name, c->size, c->objs_per_slab, c->in_use, c->max_in_use,
+              c->slab_cnt, c->alloc_cnt);
+    }
+}
+
+/* Creates a new slab for cache C, constructs its objects, and
+   returns it, or returns a null pointer if memory is not
+   available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->objs = (uint8_t *) s + c->obj_ofs + c->next_color * c->align;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      /* Hand out the lowest-addressed objects first. */
+      s->free[i] = c->objs_per_slab - i - 1;
+      if (c->ctor != NULL)
+        c->ctor (s->objs + i * c->obj_size);
+    }
+  if (++c->next_color >= c->color_cnt)
+    c->next_color = 0;
+  c->slab_cnt++;
+  return s;
+}
+
+/* Gives slab S of cache C, which must not be on any of C's
+   lists, back to the page allocator.  C's lock must be held. */
+static void
+slab_destroy (struct kmem_cache *c, struct slab *s)
+{
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (s->free_cnt == c->objs_per_slab);
+
+  s->magic = 0;
+  palloc_free_page (s);
+  c->slab_cnt--;
+}
+
+/* Returns the slab that OBJ, an object of cache C, is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid and belongs to C. */
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  /* Check that OBJ is properly aligned for the slab. */
+  ASSERT ((uint8_t *) obj >= s->objs);
+  ASSERT (((uint8_t *) obj - s->objs) % c->obj_size == 0);
+  ASSERT ((size_t) ((uint8_t *) obj - s->objs) / c->obj_size
+          < c->objs_per_slab);
+
+  return s;
+}
+
+/* Returns the number of bytes taken up by the header of a slab
+   with OBJS_PER_SLAB objects, rounded up to ALIGN. */
+static size_t
+header_size (size_t objs_per_slab, size_t align)
+{
+  return ROUND_UP (sizeof (struct slab) + objs_per_slab * sizeof (uint16_t),
+                   align);
+}
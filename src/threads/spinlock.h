@@ -0,0 +1,70 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Spinlock.
+
+   A spinlock provides mutual exclusion between CPUs by busy
+   waiting.  It does nothing to keep out interrupt handlers on
+   the CPU that holds it, so it should be held only with
+   interrupts off, and only briefly.  Code outside threads/ and
+   devices/ should use the sleeping primitives in synch.h
+   instead.
+
+   The kernel's central spinlock is the interrupt lock in
+   interrupt.c: on a multiprocessor, a CPU holds it whenever it
+   has interrupts disabled, so that turning interrupts off still
+   excludes every other CPU, as it does on a uniprocessor.  All
+   of synch.h is built on top of that. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* 1 if held, 0 if not. */
+  };
+
+#define SPINLOCK_INITIALIZER { 0 }
+
+/* Initializes L as unlocked. */
+static inline void
+spinlock_init (struct spinlock *l)
+{
+  l->locked = 0;
+}
+
+/* Tries to acquire L without waiting.  Returns true if
+   successful, false if L is held by another CPU. */
+static inline bool
+spinlock_try_acquire (struct spinlock *l)
+{
+  uint32_t old = 1;
+
+  /* XCHG with a memory operand is atomic and acts as a full
+     memory barrier.  See [IA32-v2b] "XCHG". */
+  asm volatile ("xchgl %0, %1" : "+r" (old), "+m" (l->locked) : : "memory");
+  return old == 0;
+}
+
+/* Acquires L, spinning until it is available. */
+static inline void
+spinlock_acquire (struct spinlock *l)
+{
+  while (!spinlock_try_acquire (l))
+    while (l->locked)
+      asm volatile ("pause");
+}
+
+/* Releases L, which must be held by the running CPU. */
+static inline void
+spinlock_release (struct spinlock *l)
+{
+  ASSERT (l->locked);
+
+  /* Stores are not reordered with earlier loads or stores on
+     x86, so a compiler barrier suffices. */
+  asm volatile ("" : : : "memory");
+  l->locked = 0;
+}
+
+#endif /* threads/spinlock.h */
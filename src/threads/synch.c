@@ -27,10 +27,21 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+
+/* Semaphores and locks that have been given names, whose
+   statistics are reported by sync_print_stats(). */
+static struct list named_list = LIST_INITIALIZER (named_list);
+
+static void init_stats (struct sync_stats *);
+static void set_name (struct sync_stats *, const char *name);
+static void add_time (uint64_t *total, uint64_t *max, uint64_t time);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -48,6 +59,18 @@ sema_init (struct semaphore *sema, unsigned value)
 
   sema->value = value;
   list_init (&sema->waiters);
+  init_stats (&sema->stats);
+}
+
+/* Names SEMA, so that its statistics are reported at shutdown.
+   NAME must remain valid, and SEMA must not be destroyed, for as
+   long as the kernel runs. */
+void
+sema_set_name (struct semaphore *sema, const char *name) 
+{
+  ASSERT (sema != NULL);
+
+  set_name (&sema->stats, name);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -66,10 +89,27 @@ sema_down (struct semaphore *sema)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  while (sema->value == 0) 
+  sema->stats.acquire_cnt++;
+  if (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
-      thread_block ();
+      uint64_t start = timer_cycles ();
+
+      sema->stats.contend_cnt++;
+      do
+        {
+          struct thread *cur = thread_current ();
+
+          /* Keep waiters in priority order.  If a waiter's
+             priority changes, thread.c moves it to keep the
+             order. */
+          list_insert_ordered (&sema->waiters, &cur->elem,
+                               thread_priority_more, NULL);
+          cur->waiting_sema = sema;
+          thread_block ();
+        }
+      while (sema->value == 0);
+      add_time (&sema->stats.wait_time, &sema->stats.max_wait_time,
+                timer_cycles () - start);
     }
   sema->value--;
   intr_set_level (old_level);
@@ -92,6 +132,7 @@ sema_try_down (struct semaphore *sema)
   if (sema->value > 0) 
     {
       sema->value--;
+      sema->stats.acquire_cnt++;
       success = true; 
     }
   else
@@ -102,7 +143,9 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  Yields to the woken thread if it has higher
+   priority than the running thread.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +157,16 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct thread *t = list_entry (list_pop_front (&sema->waiters),
+                                     struct thread, elem);
+      t->waiting_sema = NULL;
+      thread_unblock (t);
+    }
   sema->value++;
   intr_set_level (old_level);
+
+  thread_yield_to_higher ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -178,9 +227,21 @@ lock_init (struct lock *lock)
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
+  lock->acquire_time = 0;
   sema_init (&lock->semaphore, 1);
 }
 
+/* Names LOCK, so that its statistics are reported at shutdown.
+   NAME must remain valid, and LOCK must not be destroyed, for as
+   long as the kernel runs. */
+void
+lock_set_name (struct lock *lock, const char *name) 
+{
+  ASSERT (lock != NULL);
+
+  set_name (&lock->semaphore.stats, name);
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -192,13 +253,33 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
-  list_push_back(&thread_current()->lock_list, &lock->elem);
+  if (!sema_try_down (&lock->semaphore))
+    {
+      /* Contended: LOCK is held by another thread.  Lend it our
+         priority, so that it cannot be held up indefinitely by
+         threads of intermediate priority. */
+      TRACE (TRACE_LOCK_WAIT_BEGIN, lock,
+             lock->holder != NULL ? lock->holder->tid : TID_ERROR);
+      if (!thread_mlfqs)
+        {
+          enum intr_level old_level = intr_disable ();
+          cur->waiting_lock = lock;
+          thread_donate_priority ();
+          intr_set_level (old_level);
+        }
+      sema_down (&lock->semaphore);
+      cur->waiting_lock = NULL;
+      TRACE (TRACE_LOCK_WAIT_END, lock, 0);
+    }
+  lock->holder = cur;
+  lock->acquire_time = timer_cycles ();
+  list_push_back(&cur->lock_list, &lock->elem);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -219,6 +300,7 @@ lock_try_acquire (struct lock *lock)
   if (success)
   {
     lock->holder = thread_current ();
+    lock->acquire_time = timer_cycles ();
     list_push_back(&thread_current()->lock_list, &lock->elem);
   }
     
@@ -233,11 +315,23 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  add_time (&lock->semaphore.stats.hold_time,
+            &lock->semaphore.stats.max_hold_time,
+            timer_cycles () - lock->acquire_time);
+  old_level = intr_disable ();
   lock->holder = NULL;
   list_remove(&lock->elem);
+
+  /* Give back any priority donated for LOCK. */
+  if (!thread_mlfqs)
+    thread_update_priority ();
+  intr_set_level (old_level);
+
   sema_up (&lock->semaphore);
 }
 
@@ -257,8 +351,12 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+static bool waiter_less (const struct list_elem *,
+                         const struct list_elem *, void *aux);
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -301,6 +399,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -308,8 +407,9 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the one with the highest priority to
+   wake up from its wait.  LOCK must be held before calling this
+   function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
@@ -323,8 +423,23 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      /* Waiters' priorities may have changed since they started
+         waiting, so pick the highest one now. */
+      struct list_elem *e = list_max (&cond->waiters, waiter_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
+}
+
+/* Returns true if the thread waiting on semaphore_elem A has
+   lower priority than the one waiting on semaphore_elem B. */
+static bool
+waiter_less (const struct list_elem *a, const struct list_elem *b,
+             void *aux UNUSED) 
+{
+  return (list_entry (a, struct semaphore_elem, elem)->thread->priority
+          < list_entry (b, struct semaphore_elem, elem)->thread->priority);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -342,3 +457,259 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+static bool priority_less (const struct list_elem *,
+                           const struct list_elem *, void *aux);
+static struct thread *pop_max_priority (struct list *);
+
+/* Initializes RW as a readers-writer lock, held by nobody.  Any
+   number of threads may hold RW for reading at once, or a single
+   thread may hold it for writing.
+
+   RW prefers writers: once a writer is waiting, new readers wait
+   behind it, so that a steady stream of readers cannot starve
+   writers.  When RW becomes free it is handed directly to the
+   highest-priority waiting writer or, if no writer is waiting,
+   to all of the waiting readers at once, highest priority first.
+
+   Like locks, readers-writer locks are not recursive. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   is waiting for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && list_empty (&rw->write_waiters))
+    rw->readers++;
+  else
+    {
+      /* The releasing thread counts us as a reader before
+         unblocking us. */
+      list_push_back (&rw->read_waiters, &thread_current ()->elem);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases a read lock on RW, which the current thread must
+   hold. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0 && !list_empty (&rw->write_waiters))
+    {
+      rw->writer = pop_max_priority (&rw->write_waiters);
+      thread_unblock (rw->writer);
+    }
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->readers == 0)
+    rw->writer = thread_current ();
+  else
+    {
+      /* The releasing thread makes us the writer before
+         unblocking us. */
+      list_push_back (&rw->write_waiters, &thread_current ()->elem);
+      thread_block ();
+    }
+  ASSERT (rw->writer == thread_current ());
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  if (!list_empty (&rw->write_waiters))
+    {
+      rw->writer = pop_max_priority (&rw->write_waiters);
+      thread_unblock (rw->writer);
+    }
+  else
+    while (!list_empty (&rw->read_waiters))
+      {
+        rw->readers++;
+        thread_unblock (pop_max_priority (&rw->read_waiters));
+      }
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise.  (Readers are not tracked individually.) */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Returns true if the thread whose `elem' member is A has lower
+   priority than the one whose `elem' member is B. */
+static bool
+priority_less (const struct list_elem *a, const struct list_elem *b,
+               void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->priority
+          < list_entry (b, struct thread, elem)->priority);
+}
+
+/* Removes and returns the highest-priority thread in LIST, a
+   nonempty list of threads linked by their `elem' members.
+   Among threads of equal priority, the one waiting longest is
+   chosen. */
+static struct thread *
+pop_max_priority (struct list *list)
+{
+  struct list_elem *e = list_max (list, priority_less, NULL);
+
+  list_remove (e);
+  return list_entry (e, struct thread, elem);
+}
+
+/* Number of named objects reported by sync_print_stats(). */
+#define SYNC_REPORT_CNT 10
+
+static void print_time (uint64_t cycles, uint64_t cycles_per_sec);
+
+/* Prints contention statistics for the SYNC_REPORT_CNT named
+   semaphores and locks that spent the most time waiting. */
+void
+sync_print_stats (void) 
+{
+  const struct sync_stats *top[SYNC_REPORT_CNT];
+  size_t top_cnt = 0;
+  uint64_t cycles_per_sec = timer_cycles_per_sec ();
+  struct list_elem *e;
+  size_t i;
+
+  /* Keep TOP sorted in descending order of wait time. */
+  for (e = list_begin (&named_list); e != list_end (&named_list);
+       e = list_next (e))
+    {
+      const struct sync_stats *s = list_entry (e, struct sync_stats, elem);
+
+      if (s->acquire_cnt == 0)
+        continue;
+      if (top_cnt == SYNC_REPORT_CNT)
+        {
+          if (s->wait_time <= top[top_cnt - 1]->wait_time)
+            continue;
+          top_cnt--;
+        }
+      for (i = top_cnt++; i > 0 && top[i - 1]->wait_time < s->wait_time; i--)
+        top[i] = top[i - 1];
+      top[i] = s;
+    }
+
+  if (top_cnt == 0)
+    return;
+  printf ("Locks: %s\n", cycles_per_sec != 0 ? "times in us" : "times in cycles");
+  for (i = 0; i < top_cnt; i++)
+    {
+      const struct sync_stats *s = top[i];
+
+      printf ("  %s: %u acquired, %u contended, wait",
+              s->name, s->acquire_cnt, s->contend_cnt);
+      print_time (s->wait_time, cycles_per_sec);
+      printf (" (max");
+      print_time (s->max_wait_time, cycles_per_sec);
+      printf ("), hold");
+      print_time (s->hold_time, cycles_per_sec);
+      printf (" (max");
+      print_time (s->max_hold_time, cycles_per_sec);
+      printf (")\n");
+    }
+}
+
+/* Prints CYCLES, converted to microseconds if CYCLES_PER_SEC is
+   nonzero. */
+static void
+print_time (uint64_t cycles, uint64_t cycles_per_sec) 
+{
+  if (cycles_per_sec != 0)
+    cycles = cycles * 1000000 / cycles_per_sec;
+  printf (" %"PRIu64, cycles);
+}
+
+/* Initializes S as unnamed with zero counts. */
+static void
+init_stats (struct sync_stats *s) 
+{
+  memset (s, 0, sizeof *s);
+}
+
+/* Gives S the given NAME and adds it to the list of named
+   objects, if it is not already there. */
+static void
+set_name (struct sync_stats *s, const char *name) 
+{
+  enum intr_level old_level;
+
+  ASSERT (name != NULL);
+
+  old_level = intr_disable ();
+  if (s->name == NULL)
+    list_push_back (&named_list, &s->elem);
+  s->name = name;
+  intr_set_level (old_level);
+}
+
+/* Adds TIME to *TOTAL and raises *MAX to TIME if it is
+   larger. */
+static void
+add_time (uint64_t *total, uint64_t *max, uint64_t time) 
+{
+  *total += time;
+  if (time > *max)
+    *max = time;
+}
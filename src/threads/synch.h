@@ -3,15 +3,32 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/* Contention statistics for a semaphore or lock.
+   Times are in timer_cycles() units. */
+struct sync_stats
+  {
+    const char *name;           /* Name, or null if not reported. */
+    struct list_elem elem;      /* Element in list of named objects. */
+    unsigned acquire_cnt;       /* Number of downs or acquisitions. */
+    unsigned contend_cnt;       /* Number of those that had to wait. */
+    uint64_t wait_time;         /* Total time spent waiting. */
+    uint64_t max_wait_time;     /* Longest single wait. */
+    uint64_t hold_time;         /* Total time held (locks only). */
+    uint64_t max_hold_time;     /* Longest single hold (locks only). */
+  };
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* Waiting threads, by priority. */
+    struct sync_stats stats;    /* Contention statistics. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
+void sema_set_name (struct semaphore *, const char *name);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
@@ -23,9 +40,11 @@ struct lock
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
     struct list_elem elem;
+    uint64_t acquire_time;      /* timer_cycles() when last acquired. */
   };
 
 void lock_init (struct lock *);
+void lock_set_name (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
@@ -42,6 +61,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    unsigned readers;           /* Number of threads holding read locks. */
+    struct thread *writer;      /* Thread holding write lock, if any. */
+    struct list read_waiters;   /* Threads waiting to read. */
+    struct list write_waiters;  /* Threads waiting to write. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
+void sync_print_stats (void);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -49,4 +86,79 @@ void cond_broadcast (struct condition *, struct lock *);
    reference guide for more information.*/
 #define barrier() asm volatile ("" : : : "memory")
 
+/* Sequence lock, for small read-mostly data that may be updated
+   from an interrupt handler, such as a 64-bit counter.
+
+   Writers must already be serialized, e.g. by running in an
+   interrupt handler or holding a lock, and bracket each update
+   with seqlock_write_begin() and seqlock_write_end().  Readers
+   never block writers; instead they retry until they see a
+   consistent snapshot:
+
+        unsigned seq;
+        do
+          {
+            seq = seqlock_read_begin (&s);
+            ...copy the protected data...
+          }
+        while (seqlock_read_retry (&s, seq));
+*/
+struct seqlock
+  {
+    unsigned seq;               /* Odd while a write is in progress. */
+  };
+
+#define SEQLOCK_INITIALIZER { 0 }
+
+/* Initializes S. */
+static inline void
+seqlock_init (struct seqlock *s)
+{
+  s->seq = 0;
+}
+
+/* Begins an update of the data protected by S. */
+static inline void
+seqlock_write_begin (struct seqlock *s)
+{
+  s->seq++;
+  barrier ();
+}
+
+/* Ends an update of the data protected by S. */
+static inline void
+seqlock_write_end (struct seqlock *s)
+{
+  barrier ();
+  s->seq++;
+}
+
+/* Begins a read of the data protected by S and returns a value
+   to pass to seqlock_read_retry(). */
+static inline unsigned
+seqlock_read_begin (const struct seqlock *s)
+{
+  unsigned seq;
+
+  for (;;)
+    {
+      seq = *(const volatile unsigned *) &s->seq;
+      if ((seq & 1) == 0)
+        break;
+      asm volatile ("pause");
+    }
+  barrier ();
+  return seq;
+}
+
+/* Returns true if the data protected by S changed since the
+   seqlock_read_begin() call that returned SEQ, in which case the
+   read must be retried. */
+static inline bool
+seqlock_read_retry (const struct seqlock *s, unsigned seq)
+{
+  barrier ();
+  return *(const volatile unsigned *) &s->seq != seq;
+}
+
 #endif /* threads/synch.h */
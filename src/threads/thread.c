@@ -4,13 +4,17 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/lapic.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -22,23 +26,25 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, are kept in the
+   `ready_list' run queue of one of the CPUs in cpus[].  Run
+   queues, like the rest of the scheduler's state, are protected
+   by disabling interrupts.
 
-/* List of all processes.  Processes are added to this list
+   List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Cache of struct child_process. */
+static struct kmem_cache *child_process_cache;
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -47,14 +53,8 @@ struct kernel_thread_frame
     void *aux;                  /* Auxiliary data for function. */
   };
 
-/* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
-
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
@@ -64,9 +64,15 @@ bool thread_mlfqs;
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static kmem_ctor_func child_process_ctor;
+static void idle_loop (void) NO_RETURN;
+static struct cpu *choose_cpu (struct thread *);
+static void ready_insert (struct cpu *, struct thread *);
+static struct thread *ready_pop (struct cpu *);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static void set_effective_priority (struct thread *, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
@@ -89,16 +95,20 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < CPU_MAX; i++)
+    list_init (&cpus[i].ready_list);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
+  initial_thread->cpu = &cpus[0];
   initial_thread->tid = allocate_tid ();
 }
 
@@ -107,8 +117,16 @@ thread_init (void)
 void
 thread_start (void) 
 {
-  /* Create the idle thread. */
   struct semaphore idle_started;
+
+  /* Every thread_create() needs a child_process. */
+  child_process_cache = kmem_cache_create ("child_process",
+                                           sizeof (struct child_process),
+                                           child_process_ctor);
+  if (child_process_cache == NULL)
+    PANIC ("cannot create child_process cache");
+
+  /* Create the idle thread. */
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
 
@@ -125,28 +143,44 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct cpu *cpu = t->cpu;
 
   /* Update statistics. */
-  if (t == idle_thread)
-    idle_ticks++;
+  if (t == cpu->idle_thread)
+    cpu->idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    cpu->user_ticks++;
 #endif
   else
-    kernel_ticks++;
+    cpu->kernel_ticks++;
 
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++cpu->thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Prints thread statistics, and with more than one CPU, a
+   breakdown by CPU. */
 void
 thread_print_stats (void) 
 {
+  long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      idle_ticks += cpus[i].idle_ticks;
+      kernel_ticks += cpus[i].kernel_ticks;
+      user_ticks += cpus[i].user_ticks;
+    }
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (cpu_cnt > 1)
+    for (i = 0; i < cpu_cnt; i++)
+      printf ("CPU %d: %lld idle ticks, %lld kernel ticks, %lld user ticks, "
+              "%lld threads stolen\n", i, cpus[i].idle_ticks,
+              cpus[i].kernel_ticks, cpus[i].user_ticks, cpus[i].steal_cnt);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -161,9 +195,9 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, it preempts the running thread before thread_create()
+   returns. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -181,9 +215,10 @@ thread_create (const char *name, int priority,
   if (t == NULL)
     return TID_ERROR;
 
-  /* Initialize thread. */
+  /* Initialize thread.  It starts out on the creating CPU. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  t->cpu = thread_current ()->cpu;
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -200,12 +235,13 @@ thread_create (const char *name, int priority,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
-  t->parent = thread_tid();
+  t->parent = thread_process ()->tid;
   struct child_process *cp = add_child_process(t->tid);
   t->cp = cp;
 
   /* Add to run queue. */
   thread_unblock (t);
+  thread_yield_to_higher ();
 
   return tid;
 }
@@ -238,16 +274,46 @@ void
 thread_unblock (struct thread *t) 
 {
   enum intr_level old_level;
+  struct cpu *cpu;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  cpu = choose_cpu (t);
+  ready_insert (cpu, t);
   t->status = THREAD_READY;
+
+  /* Wake up an idle CPU to run T. */
+  if (cpu != cpu_current () && cpu->idle_thread->status == THREAD_RUNNING)
+    lapic_send_ipi (cpu->apic_id, IPI_RESCHEDULE);
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a thread with higher priority than the
+   running thread is ready to run.  Within an interrupt handler,
+   arranges to yield just before returning from the interrupt
+   instead. */
+void
+thread_yield_to_higher (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  struct list *ready_list = &cpu_current ()->ready_list;
+  bool preempt = (!list_empty (ready_list)
+                  && (list_entry (list_front (ready_list),
+                                  struct thread, elem)->priority
+                      > thread_current ()->priority));
+  intr_set_level (old_level);
+
+  if (preempt)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
+}
+
 /* Returns the name of the running thread. */
 const char *
 thread_name (void) 
@@ -281,6 +347,21 @@ thread_tid (void)
   return thread_current ()->tid;
 }
 
+/* Returns the thread that owns the state shared by all of the
+   running thread's process: its open files and its children.
+   This is the process's main thread, which is the running
+   thread itself for kernel threads and single-threaded
+   processes. */
+struct thread *
+thread_process (void) 
+{
+#ifdef USERPROG
+  return thread_current ()->leader;
+#else
+  return thread_current ();
+#endif
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void
@@ -314,8 +395,8 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+  if (cur != cur->cpu->idle_thread) 
+    ready_insert (cur->cpu, cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -338,20 +419,124 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  Its
+   effective priority stays higher while other threads donate
+   more than that.  Yields if the thread no longer has the
+   highest priority. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  old_level = intr_disable ();
+  thread_current ()->base_priority = new_priority;
+  thread_update_priority ();
+  intr_set_level (old_level);
+
+  thread_yield_to_higher ();
 }
 
-/* Returns the current thread's priority. */
+/* Returns the current thread's effective priority. */
 int
 thread_get_priority (void) 
 {
   return thread_current ()->priority;
 }
 
+/* Maximum length of a chain of donations: a thread waiting for
+   a lock held by a thread waiting for a lock held by... */
+#define DONATION_DEPTH_MAX 8
+
+/* Donates the running thread's priority to the holder of the
+   lock it is waiting for, and on down the chain of holders that
+   are themselves waiting for locks, up to DONATION_DEPTH_MAX
+   levels.  Must be called with interrupts off. */
+void
+thread_donate_priority (void) 
+{
+  struct thread *donor = thread_current ();
+  struct lock *lock = donor->waiting_lock;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+      if (holder == NULL || holder->priority >= donor->priority)
+        break;
+      set_effective_priority (holder, donor->priority);
+      lock = holder->waiting_lock;
+    }
+}
+
+/* Recomputes the running thread's effective priority as the
+   maximum of its base priority and the priorities of the
+   threads waiting for locks that it holds.  Called after it
+   releases a lock or changes its base priority.  Must be called
+   with interrupts off. */
+void
+thread_update_priority (void) 
+{
+  struct thread *cur = thread_current ();
+  int priority = cur->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&cur->lock_list); e != list_end (&cur->lock_list);
+       e = list_next (e))
+    {
+      struct list *waiters = &list_entry (e, struct lock, elem)
+                                ->semaphore.waiters;
+
+      /* Waiters are kept in descending order of priority. */
+      if (!list_empty (waiters))
+        {
+          struct thread *t = list_entry (list_front (waiters),
+                                         struct thread, elem);
+          if (t->priority > priority)
+            priority = t->priority;
+        }
+    }
+  cur->priority = priority;
+}
+
+/* Returns true if the thread whose `elem' member is A has higher
+   priority than the one whose `elem' member is B.  Inserting
+   with list_insert_ordered() by this order keeps a list in
+   descending order of priority, first-come first-served among
+   threads of equal priority. */
+bool
+thread_priority_more (const struct list_elem *a,
+                      const struct list_elem *b, void *aux UNUSED) 
+{
+  return (list_entry (a, struct thread, elem)->priority
+          > list_entry (b, struct thread, elem)->priority);
+}
+
+/* Sets T's effective priority to PRIORITY and moves T to keep
+   the ready list, or the semaphore waiters list that T is on,
+   in priority order.  Must be called with interrupts off. */
+static void
+set_effective_priority (struct thread *t, int priority) 
+{
+  struct list *list = NULL;
+
+  t->priority = priority;
+  if (t->status == THREAD_READY)
+    list = &t->cpu->ready_list;
+  else if (t->status == THREAD_BLOCKED && t->waiting_sema != NULL)
+    list = &t->waiting_sema->waiters;
+  if (list != NULL)
+    {
+      list_remove (&t->elem);
+      list_insert_ordered (list, &t->elem, thread_priority_more, NULL);
+    }
+}
+
 /* Sets the current thread's nice value to NICE. */
 void
 thread_set_nice (int nice UNUSED) 
@@ -385,40 +570,70 @@ thread_get_recent_cpu (void)
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
-   thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   The first CPU's idle thread is initially put on the ready
+   list by thread_start().  It will be scheduled once initially,
+   at which point it initializes the CPU's idle_thread, "up"s the
+   semaphore passed to it to enable thread_start() to continue,
+   and immediately blocks.  After that, the idle thread never
+   appears in the ready list.  It is returned by
+   next_thread_to_run() as a special case when there is no
+   thread to run.  The other CPUs' idle threads are set up by
+   thread_init_idle() instead. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  cpu_current ()->idle_thread = thread_current ();
+  intr_set_level (old_level);
   sema_up (idle_started);
 
+  idle_loop ();
+}
+
+/* Body of every CPU's idle thread. */
+static void
+idle_loop (void) 
+{
   for (;;) 
     {
       /* Let someone else run. */
       intr_disable ();
       thread_block ();
 
-      /* Re-enable interrupts and wait for the next one.
+      /* Re-enable interrupts and wait for the next one. */
+      intr_wait ();
+    }
+}
 
-         The `sti' instruction disables interrupts until the
-         completion of the next instruction, so these two
-         instructions are executed atomically.  This atomicity is
-         important; otherwise, an interrupt could be handled
-         between re-enabling interrupts and waiting for the next
-         one to occur, wasting as much as one clock tick worth of
-         time.
+/* Initializes the page at T as the idle thread of CPU, which
+   does not run yet.  CPU will start out running on T's stack and
+   call thread_start_ap(). */
+void
+thread_init_idle (struct thread *t, struct cpu *cpu) 
+{
+  char name[16];
 
-         See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-         7.11.1 "HLT Instruction". */
-      asm volatile ("sti; hlt" : : : "memory");
-    }
+  snprintf (name, sizeof name, "idle%d", cpu->id);
+  init_thread (t, name, PRI_MIN);
+  t->status = THREAD_RUNNING;
+  t->tid = allocate_tid ();
+  t->cpu = cpu;
+  cpu->idle_thread = t;
+}
+
+/* Starts scheduling threads on a CPU other than the first.
+   Called by the CPU in its idle thread, which was set up by
+   thread_init_idle(), with interrupts off. */
+void
+thread_start_ap (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (thread_current () == thread_current ()->cpu->idle_thread);
+
+  idle_loop ();
 }
 
 /* Function used as the basis for a kernel thread. */
@@ -468,7 +683,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable ();
@@ -483,8 +698,13 @@ init_thread (struct thread *t, const char *name, int priority)
   t->executable = NULL;
   sema_init((&t->waited_on), 0);
   t->exit_status = -1;
-
-  list_push_back(&all_list, &t->allelem);
+#ifdef USERPROG
+  t->leader = t;
+  lock_init (&t->uthread_lock);
+  list_init (&t->uthread_list);
+  sema_init (&t->uthreads_done, 0);
+  t->stack_slots = 1;         //Slot 0 is the main thread's stack
+#endif
   intr_set_level (old_level);
 }
 
@@ -501,18 +721,69 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Returns the CPU whose run queue should receive T, which is
+   about to become ready.  T stays on the CPU it last ran on,
+   where its memory is likely still cached, unless that CPU is
+   busy and another one is idle. */
+static struct cpu *
+choose_cpu (struct thread *t) 
+{
+  int i;
+
+  if (cpu_cnt == 1 || t->cpu->idle_thread->status == THREAD_RUNNING)
+    return t->cpu;
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].idle_thread->status == THREAD_RUNNING
+        && cpus[i].ready_cnt == 0)
+      return &cpus[i];
+  return t->cpu;
+}
+
+/* Puts T on CPU's run queue, in priority order. */
+static void
+ready_insert (struct cpu *cpu, struct thread *t) 
+{
+  t->cpu = cpu;
+  list_insert_ordered (&cpu->ready_list, &t->elem,
+                       thread_priority_more, NULL);
+  cpu->ready_cnt++;
+}
+
+/* Removes and returns the highest-priority thread on CPU's run
+   queue, which must not be empty. */
+static struct thread *
+ready_pop (struct cpu *cpu) 
+{
+  ASSERT (cpu->ready_cnt > 0);
+  cpu->ready_cnt--;
+  return list_entry (list_pop_front (&cpu->ready_list), struct thread, elem);
+}
+
+/* Chooses and returns the next thread to be scheduled on the
+   running CPU.  Should return a thread from its run queue,
+   unless the run queue is empty.  (If the running thread can
+   continue running, then it will be in the run queue.)  If the
+   run queue is empty, steals a thread from the CPU with the
+   most ready threads, and if there are none anywhere, returns
+   the CPU's idle thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  struct cpu *cpu = cpu_current ();
+  struct cpu *victim = NULL;
+  int i;
+
+  if (cpu->ready_cnt > 0)
+    return ready_pop (cpu);
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].ready_cnt > 0
+        && (victim == NULL || cpus[i].ready_cnt > victim->ready_cnt))
+      victim = &cpus[i];
+  if (victim == NULL)
+    return cpu->idle_thread;
+  cpu->steal_cnt++;
+  return ready_pop (victim);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -540,9 +811,11 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  if (prev != NULL)
+    TRACE (TRACE_SWITCH, prev->tid, 0);
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  cur->cpu->thread_ticks = 0;
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -579,6 +852,7 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  next->cpu = cur->cpu;
   if (cur != next)
     prev = switch_threads (cur, next);
   thread_schedule_tail (prev);
@@ -599,39 +873,69 @@ allocate_tid (void)
 }
 
 /* Traverse through every list of threads and check if thread with 
-   the desired pid is alive */
+   the desired pid is alive.  all_list is changed by threads
+   exiting with interrupts off, so it is walked with interrupts
+   off too; the walk is short and never sleeps. */
 int is_thread_alive (int pid){
   struct list_elem *e;
-  struct list_elem *next;
-  for (e = list_begin(&all_list); e != list_end(&all_list); e = next)
+  enum intr_level old_level;
+  int alive = 0;
+
+  old_level = intr_disable ();
+  for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next (e))
   {
-    next = list_next(e);
     struct thread *t = list_entry (e, struct thread, allelem);
     if (t->tid == pid)
     {
-      // pid matches return true
-      return 1;
+      // pid matches, so it is alive
+      alive = 1;
+      break;
     }
   }
-  return 0; // no tid matches then thread is no longer alive
+  intr_set_level (old_level);
+  return alive;
+}
+
+/* Constructor for child_process_cache. */
+static void
+child_process_ctor (void *cp_)
+{
+  struct child_process *cp = cp_;
+
+  sema_init (&cp->load_sema, 0);
+  sema_init (&cp->exit_sema, 0);
+  sema_init (&cp->waited_on, 0);
 }
 
 /* add a new child process to list */
 struct child_process* add_child_process (int pid)
 {
-  struct child_process *cp = malloc(sizeof(struct child_process));
+  /* The semaphores were initialized by child_process_ctor(). */
+  struct child_process *cp = kmem_cache_alloc (child_process_cache);
   cp->pid = pid;
   cp->load_status = NOT_LOADED;
   cp->wait = 0; // false
   cp->exit = 0; // false
-  sema_init(&cp->load_sema, 0);
-  sema_init(&cp->exit_sema, 0);
-  sema_init(&cp->waited_on, 0);
-  list_push_back(&thread_current()->child_list, &cp->elem);
+  list_push_back(&thread_process()->child_list, &cp->elem);
 
   return cp;
 }
 
+/* Frees CP, which must no longer be in any list.  Its
+   semaphores are brought back down to 0 first, the state in
+   which child_process_cache hands them out. */
+void
+free_child_process (struct child_process *cp)
+{
+  while (sema_try_down (&cp->load_sema))
+    continue;
+  while (sema_try_down (&cp->exit_sema))
+    continue;
+  while (sema_try_down (&cp->waited_on))
+    continue;
+  kmem_cache_free (child_process_cache, cp);
+}
+
 /* releases all the locks thread holds */
 void
 thread_release_locks (void)
@@ -25,6 +25,9 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+struct cpu;
+struct dir;
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -88,15 +91,44 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
+    int base_priority;                  /* Priority before donation. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct cpu *cpu;                    /* CPU last run on, or whose run
+                                           queue holds `elem'. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct semaphore *waiting_sema;     /* Semaphore whose waiters list
+                                           holds `elem', if any. */
+    struct lock *waiting_lock;          /* Lock being waited for, if any. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct thread *leader;              /* Process's main thread;
+                                           self for main and kernel
+                                           threads. */
+    struct uthread *uthread;            /* Join record, if not main. */
+
+    /* Owned by userprog/process.c, used only in a leader. */
+    struct lock uthread_lock;           /* Guards the members below. */
+    struct list uthread_list;           /* Join records of other threads. */
+    int uthread_cnt;                    /* Other threads still running. */
+    struct semaphore uthreads_done;     /* Upped as they exit when killed. */
+    uint32_t stack_slots;               /* Bitmap of user stacks in use. */
+    bool killed;                        /* True when the process is exiting. */
+    int kill_status;                    /* Exit status once killed. */
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c, used only in a leader. */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root. */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nested journal operations. */
+    int journal_blocks;                 /* Blocks made uncommitted by
+                                           the current operation. */
 #endif
 
     /* Owned by thread.c. */
@@ -111,7 +143,7 @@ struct thread
     struct child_process* cp;
     struct file* executable;
     struct list lock_list;
-    struct semaphore *waited_on;
+    struct semaphore waited_on;
   };
 
 /* If false (default), use round-robin scheduler.
@@ -121,6 +153,8 @@ extern bool thread_mlfqs;
 
 void thread_init (void);
 void thread_start (void);
+void thread_init_idle (struct thread *, struct cpu *);
+void thread_start_ap (void) NO_RETURN;
 
 void thread_tick (void);
 void thread_print_stats (void);
@@ -130,9 +164,11 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_yield_to_higher (void);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
+struct thread *thread_process (void);
 const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
@@ -144,6 +180,10 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (void);
+void thread_update_priority (void);
+bool thread_priority_more (const struct list_elem *,
+                           const struct list_elem *, void *aux);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -152,6 +192,7 @@ int thread_get_load_avg (void);
 
 int is_thread_alive(int pid);
 struct child_process* add_child_process(int pid);
+void free_child_process (struct child_process *);
 void thread_release_locks(void);
 
 #endif /* threads/thread.h */
@@ -0,0 +1,179 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#endif
+
+/* Identifies a trace file: "PTRC" in little-endian order. */
+#define TRACE_MAGIC 0x43525450
+
+/* Version of the trace file format. */
+#define TRACE_VERSION 1
+
+/* Header at the beginning of a trace file.  It is followed by
+   EVENT_CNT `struct trace_event's, oldest first. */
+struct trace_header
+  {
+    uint32_t magic;             /* TRACE_MAGIC. */
+    uint32_t version;           /* TRACE_VERSION. */
+    uint32_t event_cnt;         /* Number of events that follow. */
+    uint32_t reserved;          /* Always zero. */
+    uint64_t cycles_per_sec;    /* Timestamp units per second. */
+  };
+
+/* True if tracing is enabled. */
+bool trace_enabled;
+
+/* Ring buffer.
+   EVENT_HEAD is the slot the next event goes into.  Once the
+   buffer has WRAPPED, EVENT_HEAD is also the oldest event. */
+static struct trace_event *events;
+static size_t event_cnt;
+static size_t event_head;
+static bool wrapped;
+
+/* Number of events overwritten before they could be dumped. */
+static unsigned long long lost_cnt;
+
+/* File to dump the trace into, or a null pointer to dump it to
+   the console. */
+static const char *dump_file_name;
+
+#ifdef FILESYS
+static bool dump_to_file (size_t first, size_t cnt);
+#endif
+
+/* Allocates a PAGE_CNT-page trace buffer and starts tracing.
+   If FILE_NAME is non-null, the trace will be dumped into a file
+   by that name at shutdown, otherwise to the console.
+   Does nothing if PAGE_CNT is zero. */
+void
+trace_init (size_t page_cnt, const char *file_name)
+{
+  if (page_cnt == 0)
+    return;
+
+  events = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (events == NULL)
+    {
+      printf ("trace: cannot allocate %zu pages, tracing disabled\n",
+              page_cnt);
+      return;
+    }
+  event_cnt = page_cnt * PGSIZE / sizeof *events;
+  dump_file_name = file_name;
+  trace_enabled = true;
+  printf ("trace: recording up to %zu events.\n", event_cnt);
+}
+
+/* Appends an event of the given TYPE to the trace buffer.
+   Usually invoked through the TRACE macro. */
+void
+trace_record (enum trace_type type, uint32_t arg0, uint32_t arg1)
+{
+  enum intr_level old_level;
+  struct trace_event *e;
+
+  ASSERT (type < TRACE_TYPE_CNT);
+
+  old_level = intr_disable ();
+  e = &events[event_head];
+  if (wrapped)
+    lost_cnt++;
+  e->timestamp = timer_cycles ();
+  e->tid = thread_tid ();
+  e->type = type;
+  e->reserved = 0;
+  e->arg0 = arg0;
+  e->arg1 = arg1;
+  if (++event_head >= event_cnt)
+    {
+      event_head = 0;
+      wrapped = true;
+    }
+  intr_set_level (old_level);
+}
+
+/* Stops tracing and dumps the trace buffer.  Called at
+   shutdown. */
+void
+trace_dump (void)
+{
+  size_t first, cnt, i;
+
+  if (!trace_enabled)
+    return;
+  trace_enabled = false;
+
+  first = wrapped ? event_head : 0;
+  cnt = wrapped ? event_cnt : event_head;
+  if (lost_cnt > 0)
+    printf ("trace: %llu oldest events were overwritten\n", lost_cnt);
+
+#ifdef FILESYS
+  if (dump_file_name != NULL)
+    {
+      if (dump_to_file (first, cnt))
+        {
+          printf ("trace: wrote %zu events to \"%s\"\n",
+                  cnt, dump_file_name);
+          return;
+        }
+      printf ("trace: cannot write \"%s\", dumping to console\n",
+              dump_file_name);
+    }
+#endif
+
+  printf ("trace: begin %zu events, %"PRIu64" cycles/s\n",
+          cnt, timer_cycles_per_sec ());
+  for (i = 0; i < cnt; i++)
+    {
+      const struct trace_event *e = &events[(first + i) % event_cnt];
+      printf ("trace: %"PRIu64" %"PRId32" %"PRIu16" %08"PRIx32" %08"PRIx32"\n",
+              e->timestamp, e->tid, e->type, e->arg0, e->arg1);
+    }
+  printf ("trace: end\n");
+}
+
+#ifdef FILESYS
+/* Writes the CNT events starting at index FIRST in the ring
+   buffer to dump_file_name, preceded by a trace_header.
+   Returns true if successful, false on failure. */
+static bool
+dump_to_file (size_t first, size_t cnt)
+{
+  struct trace_header h;
+  struct file *file;
+  size_t tail_cnt = first + cnt > event_cnt ? event_cnt - first : cnt;
+  off_t tail_size = tail_cnt * sizeof *events;
+  off_t head_size = (cnt - tail_cnt) * sizeof *events;
+  bool success;
+
+  h.magic = TRACE_MAGIC;
+  h.version = TRACE_VERSION;
+  h.event_cnt = cnt;
+  h.reserved = 0;
+  h.cycles_per_sec = timer_cycles_per_sec ();
+
+  filesys_remove (dump_file_name);
+  if (!filesys_create (dump_file_name, sizeof h + tail_size + head_size))
+    return false;
+  file = filesys_open (dump_file_name);
+  if (file == NULL)
+    return false;
+
+  success = (file_write (file, &h, sizeof h) == sizeof h
+             && file_write (file, events + first, tail_size) == tail_size
+             && file_write (file, events, head_size) == head_size);
+  file_close (file);
+  return success;
+}
+#endif /* FILESYS */
@@ -0,0 +1,66 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel event tracing.
+
+   With the "-trace" kernel option, each tracepoint below appends
+   a fixed-size binary record to a ring buffer that is allocated
+   once at boot.  When the buffer fills, the oldest records are
+   overwritten.  At shutdown the buffer is dumped to the console
+   (and thus the serial port) or, given "-trace-file=NAME", to a
+   file in the file system.  utils/pintos-trace2json converts
+   either form into Chrome trace JSON.
+
+   Without "-trace", a tracepoint costs a single test of
+   trace_enabled. */
+
+/* Types of trace events. */
+enum trace_type
+  {
+    TRACE_SWITCH,               /* Context switch; ARG0 = previous tid. */
+    TRACE_SYSCALL_ENTER,        /* ARG0 = system call number. */
+    TRACE_SYSCALL_EXIT,         /* ARG0 = number, ARG1 = return value. */
+    TRACE_PAGE_FAULT,           /* ARG0 = fault address, ARG1 = error. */
+    TRACE_BLOCK_READ_BEGIN,     /* ARG0 = sector, ARG1 = device type. */
+    TRACE_BLOCK_READ_END,       /* ARG0 = sector, ARG1 = device type. */
+    TRACE_BLOCK_WRITE_BEGIN,    /* ARG0 = sector, ARG1 = device type. */
+    TRACE_BLOCK_WRITE_END,      /* ARG0 = sector, ARG1 = device type. */
+    TRACE_LOCK_WAIT_BEGIN,      /* ARG0 = lock, ARG1 = holder's tid. */
+    TRACE_LOCK_WAIT_END,        /* ARG0 = lock. */
+    TRACE_TYPE_CNT
+  };
+
+/* A trace record, as stored in the ring buffer and in dumps. */
+struct trace_event
+  {
+    uint64_t timestamp;         /* timer_cycles() at the event. */
+    int32_t tid;                /* Running thread. */
+    uint16_t type;              /* A TRACE_* value. */
+    uint16_t reserved;          /* Always zero. */
+    uint32_t arg0;              /* Event-specific arguments. */
+    uint32_t arg1;
+  };
+
+/* True if tracing is enabled.  Read-only outside trace.c. */
+extern bool trace_enabled;
+
+void trace_init (size_t page_cnt, const char *file_name);
+void trace_record (enum trace_type, uint32_t arg0, uint32_t arg1);
+void trace_dump (void);
+
+/* Records an event of the given TYPE with arguments ARG0 and
+   ARG1, if tracing is enabled. */
+#define TRACE(TYPE, ARG0, ARG1)                                         \
+        do                                                              \
+          {                                                             \
+            if (__builtin_expect (trace_enabled, 0))                    \
+              trace_record ((TYPE), (uint32_t) (ARG0),                  \
+                            (uint32_t) (ARG1));                         \
+          }                                                             \
+        while (0)
+
+#endif /* threads/trace.h */
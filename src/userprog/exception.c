@@ -4,6 +4,7 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "userprog/syscall.h"
 
 /* Number of page faults processed. */
@@ -145,6 +146,7 @@ page_fault (struct intr_frame *f)
 
   /* Count page faults. */
   page_fault_cnt++;
+  TRACE (TRACE_PAGE_FAULT, fault_addr, f->error_code);
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
@@ -0,0 +1,162 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Fast user-space mutexes.
+
+   A futex is a 32-bit word in user memory.  User code manipulates
+   it with atomic instructions and enters the kernel only to sleep
+   until the word changes (futex_wait) or to wake sleepers after
+   changing it (futex_wake).  lib/user/synch.c builds mutexes and
+   condition variables this way.
+
+   Sleepers are keyed by the kernel virtual address of the word,
+   which identifies the physical frame and the offset within it.
+   Thus the key is the same no matter which page directory or
+   user virtual address the word is reached through. */
+
+/* Number of hash buckets.  Must be a power of 2. */
+#define FUTEX_BUCKET_CNT 64
+
+/* A thread sleeping in futex_wait(). */
+struct futex_waiter
+  {
+    struct list_elem elem;      /* Element in futex_bucket's list. */
+    int32_t *key;               /* Kernel address of futex word. */
+    struct thread *thread;      /* Sleeping thread. */
+    struct semaphore sema;      /* Upped to wake the thread. */
+  };
+
+/* A hash bucket. */
+struct futex_bucket
+  {
+    struct lock lock;           /* Guards WAITERS. */
+    struct list waiters;        /* futex_waiters, by priority. */
+  };
+
+static struct futex_bucket buckets[FUTEX_BUCKET_CNT];
+
+static struct futex_bucket *key_to_bucket (const int32_t *);
+static bool waiter_more (const struct list_elem *,
+                         const struct list_elem *, void *aux);
+
+/* Initializes the futex module. */
+void
+futex_init (void) 
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKET_CNT; i++)
+    {
+      lock_init (&buckets[i].lock);
+      list_init (&buckets[i].waiters);
+    }
+}
+
+/* If the futex word at kernel address KADDR contains VAL, sleeps
+   until woken by futex_wake() and returns 0.  Otherwise returns
+   -1 at once.
+
+   The comparison and going to sleep are atomic with respect to
+   futex_wake(), so a waker that changes the word and then calls
+   futex_wake() cannot be missed. */
+int
+futex_wait (int32_t *kaddr, int32_t val) 
+{
+  struct futex_bucket *b = key_to_bucket (kaddr);
+  struct futex_waiter w;
+
+  lock_acquire (&b->lock);
+  if (*(volatile int32_t *) kaddr != val)
+    {
+      lock_release (&b->lock);
+      return -1;
+    }
+  w.key = kaddr;
+  w.thread = thread_current ();
+  sema_init (&w.sema, 0);
+  list_insert_ordered (&b->waiters, &w.elem, waiter_more, NULL);
+  lock_release (&b->lock);
+
+  /* If futex_wake() runs before we get here, it will already have
+     upped W.SEMA, so we don't sleep. */
+  sema_down (&w.sema);
+  return 0;
+}
+
+/* Wakes up to CNT threads sleeping on the futex word at kernel
+   address KADDR, highest priority first.  Returns the number of
+   threads woken. */
+int
+futex_wake (int32_t *kaddr, int cnt) 
+{
+  struct futex_bucket *b = key_to_bucket (kaddr);
+  struct list_elem *e, *next;
+  int woken = 0;
+
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < cnt; e = next)
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+      next = list_next (e);
+      if (w->key == kaddr)
+        {
+          list_remove (&w->elem);
+          sema_up (&w->sema);
+          woken++;
+        }
+    }
+  lock_release (&b->lock);
+  return woken;
+}
+
+/* Wakes every thread of the process whose main thread is LEADER
+   that is sleeping on a futex, so that it notices the process
+   is exiting.  The woken threads' futex_wait() calls return 0,
+   as if woken by futex_wake(). */
+void
+futex_wake_process (struct thread *leader) 
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKET_CNT; i++)
+    {
+      struct futex_bucket *b = &buckets[i];
+      struct list_elem *e, *next;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->waiters); e != list_end (&b->waiters);
+           e = next)
+        {
+          struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+          next = list_next (e);
+          if (w->thread->leader == leader)
+            {
+              list_remove (&w->elem);
+              sema_up (&w->sema);
+            }
+        }
+      lock_release (&b->lock);
+    }
+}
+
+/* Returns the bucket for the futex word at KEY. */
+static struct futex_bucket *
+key_to_bucket (const int32_t *key) 
+{
+  return &buckets[hash_int ((int) (uintptr_t) key) & (FUTEX_BUCKET_CNT - 1)];
+}
+
+/* Returns true if futex_waiter A's thread has higher priority
+   than futex_waiter B's. */
+static bool
+waiter_more (const struct list_elem *a, const struct list_elem *b,
+             void *aux UNUSED) 
+{
+  return (list_entry (a, struct futex_waiter, elem)->thread->priority
+          > list_entry (b, struct futex_waiter, elem)->thread->priority);
+}
@@ -0,0 +1,13 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdint.h>
+
+void futex_init (void);
+int futex_wait (int32_t *kaddr, int32_t val);
+int futex_wake (int32_t *kaddr, int cnt);
+
+struct thread;
+void futex_wake_process (struct thread *leader);
+
+#endif /* userprog/futex.h */
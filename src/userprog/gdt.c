@@ -35,7 +35,7 @@ static uint64_t make_gdtr_operand (uint16_t limit, void *base);
 void
 gdt_init (void)
 {
-  uint64_t gdtr_operand;
+  int i;
 
   /* Initialize GDT. */
   gdt[SEL_NULL / sizeof *gdt] = 0;
@@ -43,14 +43,27 @@ gdt_init (void)
   gdt[SEL_KDSEG / sizeof *gdt] = make_data_desc (0);
   gdt[SEL_UCSEG / sizeof *gdt] = make_code_desc (3);
   gdt[SEL_UDSEG / sizeof *gdt] = make_data_desc (3);
-  gdt[SEL_TSS / sizeof *gdt] = make_tss_desc (tss_get ());
+  for (i = 0; i < CPU_MAX; i++)
+    if (tss_get (i) != NULL)
+      gdt[SEL_TSS_CPU (i) / sizeof *gdt] = make_tss_desc (tss_get (i));
+
+  gdt_load (0);
+}
+
+/* Loads the GDT and the TSS of the CPU with ID CPU_ID into the
+   running CPU.  Every CPU must do this, because the registers
+   involved are per-CPU. */
+void
+gdt_load (int cpu_id) 
+{
+  uint64_t gdtr_operand;
 
   /* Load GDTR, TR.  See [IA32-v3a] 2.4.1 "Global Descriptor
      Table Register (GDTR)", 2.4.4 "Task Register (TR)", and
      6.2.4 "Task Register".  */
   gdtr_operand = make_gdtr_operand (sizeof gdt - 1, gdt);
   asm volatile ("lgdt %0" : : "m" (gdtr_operand));
-  asm volatile ("ltr %w0" : : "q" (SEL_TSS));
+  asm volatile ("ltr %w0" : : "q" (SEL_TSS_CPU (cpu_id)));
 }
 
 /* System segment or code/data segment? */
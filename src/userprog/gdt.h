@@ -1,15 +1,20 @@
 #ifndef USERPROG_GDT_H
 #define USERPROG_GDT_H
 
+#include "threads/cpu.h"
 #include "threads/loader.h"
 
 /* Segment selectors.
    More selectors are defined by the loader in loader.h. */
 #define SEL_UCSEG       0x1B    /* User code selector. */
 #define SEL_UDSEG       0x23    /* User data selector. */
-#define SEL_TSS         0x28    /* Task-state segment. */
-#define SEL_CNT         6       /* Number of segments. */
+#define SEL_TSS         0x28    /* First CPU's task-state segment. */
+#define SEL_CNT         (5 + CPU_MAX) /* Number of segments. */
+
+/* Selector of the task-state segment of the CPU with ID CPU_ID. */
+#define SEL_TSS_CPU(CPU_ID) (SEL_TSS + 8 * (CPU_ID))
 
 void gdt_init (void);
+void gdt_load (int cpu_id);
 
 #endif /* userprog/gdt.h */
@@ -2,7 +2,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
@@ -219,15 +221,23 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 void
 pagedir_activate (uint32_t *pd) 
 {
+  enum intr_level old_level;
+
   if (pd == NULL)
     pd = init_page_dir;
 
+  /* Record PD for cpu_flush_tlbs() on the same CPU that loads
+     it. */
+  old_level = intr_disable ();
+  cpu_current ()->pagedir = pd;
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
      Address of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  intr_set_level (old_level);
 }
 
 /* Returns the currently active page directory. */
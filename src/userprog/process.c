@@ -5,12 +5,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -22,7 +24,50 @@
 #include "userprog/syscall.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_uthread NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp, char **save_ptr);
+static bool install_page (void *upage, void *kpage, bool writable);
+
+/* User threads.
+
+   A process starts with a single thread, its "leader".  Further
+   threads created with process_thread_create() share the
+   leader's page directory, open files and children, and each
+   runs on its own user stack.  The process ends when its leader
+   exits or any of its threads calls exit(): the other threads
+   are then killed the next time they enter or leave the kernel. */
+
+/* Number of pages in each user thread's stack.  Each stack also
+   has an unmapped guard page below it, so that overflowing one
+   thread's stack faults instead of running into the next. */
+#define UTHREAD_STACK_PAGES 2
+
+/* Maximum number of threads in a process, including the leader.
+   Limited by the width of `stack_slots' in struct thread. */
+#define UTHREAD_MAX 32
+
+/* A thread other than the leader, as seen by threads joining it. */
+struct uthread
+  {
+    struct list_elem elem;      /* Element in leader's uthread_list. */
+    tid_t tid;                  /* Thread's tid. */
+    int slot;                   /* User stack slot. */
+    int status;                 /* Exit status. */
+    bool joined;                /* Has someone joined this thread? */
+    struct semaphore done;      /* Upped when the thread exits. */
+    struct thread *leader;      /* Process's leader. */
+    void *eip, *func, *aux;     /* User entry point and its arguments. */
+  };
+
+static void uthread_exit (void);
+static void leader_exit (void);
+
+/* Argument to start_process(), in a page of its own. */
+struct exec_args
+  {
+    struct dir *cwd;            /* New process's working directory. */
+    char file_name[1];          /* Program to load (more follows). */
+  };
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -31,7 +76,8 @@ static bool load (const char *cmdline, void (**eip) (void), void **esp, char **s
 tid_t
 process_execute (const char* file_name) 
 {
-  char *fn_copy;
+  struct dir *cwd;
+  struct exec_args *args;
   tid_t tid;
 
   char *split_file_name;
@@ -42,16 +88,32 @@ process_execute (const char* file_name)
   }
   /* Make a copy of name.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  args = palloc_get_page (0);
+  if (args == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, name, PGSIZE);
-
+  strlcpy (args->file_name, name, PGSIZE - sizeof *args);
+
+  /* The new process starts out in the caller's working
+     directory.  Another thread of the caller may be changing it
+     in filesys_chdir(), which closes the old one, so read and
+     reopen it under file_system_lock, which chdir holds. */
+  lock_acquire (&file_system_lock);
+  cwd = thread_process ()->cwd;
+  args->cwd = cwd != NULL ? dir_reopen (cwd) : NULL;
+  lock_release (&file_system_lock);
+  if (cwd != NULL && args->cwd == NULL)
+    {
+      palloc_free_page (args);
+      return TID_ERROR;
+    }
   
   /* Create a new thread to execute name. */
-  tid = thread_create (name, PRI_DEFAULT, start_process, fn_copy);
+  tid = thread_create (name, PRI_DEFAULT, start_process, args);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      dir_close (args->cwd);
+      palloc_free_page (args); 
+    }
   return tid;
 
 
@@ -60,9 +122,9 @@ process_execute (const char* file_name)
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void* file_name_)
+start_process (void* args_)
 {
-  char *file_name = file_name_;
+  struct exec_args *args = args_;
   char* save_ptr;
   struct intr_frame if_;
   bool success;
@@ -72,10 +134,11 @@ start_process (void* file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp, &save_ptr);
+  thread_current ()->cwd = args->cwd;
+  success = load (args->file_name, &if_.eip, &if_.esp, &save_ptr);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
+  palloc_free_page (args);
   if (!success) 
     thread_exit ();
 
@@ -137,6 +200,18 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  /* A thread other than the leader gives up only its own stack;
+     the leader owns everything else. */
+  if (cur->leader != cur)
+    {
+      uthread_exit ();
+      return;
+    }
+  if (cur->pagedir != NULL)
+    leader_exit ();
+  dir_close (cur->cwd);
+  cur->cwd = NULL;
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -155,6 +230,303 @@ process_exit (void)
     }
 }
 
+/* Returns the top of user stack slot SLOT.  Slot 0 is the
+   leader's stack, which setup_stack() creates. */
+static uint8_t *
+stack_slot_top (int slot) 
+{
+  return (uint8_t *) PHYS_BASE - slot * (UTHREAD_STACK_PAGES + 1) * PGSIZE;
+}
+
+/* Creates a new thread in the running process that starts
+   executing user code at EIP with FUNC and AUX as its two
+   arguments, on a stack of its own.  Returns the new thread's
+   tid, or TID_ERROR if it cannot be created. */
+tid_t
+process_thread_create (void *eip, void *func, void *aux) 
+{
+  struct thread *leader = thread_current ()->leader;
+  struct uthread *u;
+  tid_t tid;
+
+  if (!is_user_vaddr (eip) || eip < USER_VADDR_BOTTOM)
+    return TID_ERROR;
+  u = malloc (sizeof *u);
+  if (u == NULL)
+    return TID_ERROR;
+
+  /* Reserve a stack slot. */
+  lock_acquire (&leader->uthread_lock);
+  for (u->slot = 1; u->slot < UTHREAD_MAX; u->slot++)
+    if ((leader->stack_slots & (1u << u->slot)) == 0)
+      break;
+  if (leader->killed || u->slot >= UTHREAD_MAX)
+    {
+      lock_release (&leader->uthread_lock);
+      free (u);
+      return TID_ERROR;
+    }
+  leader->stack_slots |= 1u << u->slot;
+  leader->uthread_cnt++;
+  u->tid = TID_ERROR;
+  u->status = -1;
+  u->joined = false;
+  sema_init (&u->done, 0);
+  u->leader = leader;
+  u->eip = eip;
+  u->func = func;
+  u->aux = aux;
+  list_push_back (&leader->uthread_list, &u->elem);
+  lock_release (&leader->uthread_lock);
+
+  tid = thread_create (leader->name, thread_get_priority (),
+                       start_uthread, u);
+  if (tid == TID_ERROR)
+    {
+      lock_acquire (&leader->uthread_lock);
+      list_remove (&u->elem);
+      leader->stack_slots &= ~(1u << u->slot);
+      leader->uthread_cnt--;
+      lock_release (&leader->uthread_lock);
+      free (u);
+      return TID_ERROR;
+    }
+
+  /* thread_create() recorded the new thread as a child process,
+     but it cannot be waited for like one. */
+  remove_child_process (find_child_process (tid));
+
+  u->tid = tid;
+  return tid;
+}
+
+/* A thread function that starts a user thread described by
+   struct uthread U_. */
+static void
+start_uthread (void *u_) 
+{
+  struct uthread *u = u_;
+  struct thread *cur = thread_current ();
+  struct thread *leader = u->leader;
+  uint8_t *top = stack_slot_top (u->slot);
+  uint8_t *kpage = NULL;
+  struct intr_frame if_;
+  uint32_t *esp;
+  int i;
+
+  cur->leader = leader;
+  cur->uthread = u;
+  cur->cp = NULL;
+  cur->pagedir = leader->pagedir;
+  process_activate ();
+
+  /* Map the stack.  The process's threads may change its page
+     directory concurrently, so hold the leader's lock. */
+  lock_acquire (&leader->uthread_lock);
+  for (i = 1; i <= UTHREAD_STACK_PAGES; i++)
+    {
+      kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (kpage == NULL || !install_page (top - i * PGSIZE, kpage, true))
+        {
+          palloc_free_page (kpage);
+          lock_release (&leader->uthread_lock);
+          thread_exit ();
+        }
+      if (i == 1)
+        {
+          /* Push AUX, FUNC, and a null return address, so that
+             the entry point sees FUNC and AUX as its arguments. */
+          esp = (uint32_t *) (kpage + PGSIZE) - 3;
+          esp[0] = 0;
+          esp[1] = (uint32_t) u->func;
+          esp[2] = (uint32_t) u->aux;
+        }
+    }
+  lock_release (&leader->uthread_lock);
+  process_check_killed ();
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = (void (*) (void)) u->eip;
+  if_.esp = top - 3 * sizeof (uint32_t);
+
+  /* Start the user thread as start_process() does. */
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Ends the running thread with the given exit STATUS, which is
+   returned to a thread that joins it.  In the leader, ends the
+   whole process, like exit(). */
+void
+process_thread_exit (int status) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->leader == cur)
+    syscall_exit (status);
+  cur->uthread->status = status;
+  thread_exit ();
+}
+
+/* Waits for thread TID in the running process to exit and
+   returns its exit status, which is -1 if it was killed.
+   Returns -1 at once if TID is not a thread of this process
+   other than the leader and the caller, or if it has already
+   been joined. */
+int
+process_thread_join (tid_t tid) 
+{
+  struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
+  struct uthread *u = NULL;
+  struct list_elem *e;
+  int status;
+
+  lock_acquire (&leader->uthread_lock);
+  for (e = list_begin (&leader->uthread_list);
+       e != list_end (&leader->uthread_list); e = list_next (e))
+    {
+      struct uthread *candidate = list_entry (e, struct uthread, elem);
+      if (candidate->tid == tid)
+        {
+          u = candidate;
+          break;
+        }
+    }
+  if (u == NULL || u->joined || u == cur->uthread)
+    {
+      lock_release (&leader->uthread_lock);
+      return -1;
+    }
+  u->joined = true;
+  lock_release (&leader->uthread_lock);
+
+  sema_down (&u->done);
+
+  lock_acquire (&leader->uthread_lock);
+  list_remove (&u->elem);
+  status = u->status;
+  lock_release (&leader->uthread_lock);
+  free (u);
+  return status;
+}
+
+/* Marks the running process as exiting with the given STATUS,
+   so that all of its threads die.  Threads sleeping on futexes
+   are woken up to notice. */
+void
+process_kill (int status) 
+{
+  struct thread *leader = thread_current ()->leader;
+
+  lock_acquire (&leader->uthread_lock);
+  if (!leader->killed)
+    {
+      leader->killed = true;
+      leader->kill_status = status;
+    }
+  lock_release (&leader->uthread_lock);
+  futex_wake_process (leader);
+}
+
+/* Returns true if the running thread belongs to a process that
+   is exiting. */
+bool
+process_killed (void) 
+{
+  struct thread *cur = thread_current ();
+
+  return cur->pagedir != NULL && cur->leader->killed;
+}
+
+/* Terminates the running thread if its process is exiting.
+   Called on the way into and out of the kernel, with interrupts
+   on, because exiting tears down the process. */
+void
+process_check_killed (void) 
+{
+  struct thread *cur = thread_current ();
+
+  if (!process_killed ())
+    return;
+  ASSERT (intr_get_level () == INTR_ON);
+  if (cur->leader == cur)
+    syscall_exit (cur->kill_status);
+  else
+    thread_exit ();
+}
+
+/* Called by process_exit() in a thread other than the leader.
+   Frees the thread's stack and wakes any thread joining it.
+   Interrupts must be on, for cpu_flush_tlbs(). */
+static void
+uthread_exit (void) 
+{
+  struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
+  struct uthread *u = cur->uthread;
+  uint8_t *top = stack_slot_top (u->slot);
+  void *kpages[UTHREAD_STACK_PAGES];
+  int i;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  lock_acquire (&leader->uthread_lock);
+  for (i = 0; i < UTHREAD_STACK_PAGES; i++)
+    {
+      uint8_t *upage = top - (i + 1) * PGSIZE;
+      kpages[i] = pagedir_get_page (cur->pagedir, upage);
+      if (kpages[i] != NULL)
+        pagedir_clear_page (cur->pagedir, upage);
+    }
+
+  /* Sibling threads on other CPUs may still have the stack in
+     their TLBs, so the pages may only be reused once those
+     entries are gone. */
+  cpu_flush_tlbs (cur->pagedir);
+  for (i = 0; i < UTHREAD_STACK_PAGES; i++)
+    palloc_free_page (kpages[i]);
+  leader->stack_slots &= ~(1u << u->slot);
+
+  /* Switch to the kernel page directory first, as in the
+     leader's case below. */
+  cur->pagedir = NULL;
+  pagedir_activate (NULL);
+
+  sema_up (&u->done);
+  if (--leader->uthread_cnt == 0 && leader->killed)
+    sema_up (&leader->uthreads_done);
+  lock_release (&leader->uthread_lock);
+}
+
+/* Called by process_exit() in a process's leader.  Kills the
+   process's other threads, waits for them to die, and frees
+   their join records. */
+static void
+leader_exit (void) 
+{
+  struct thread *cur = thread_current ();
+  bool must_wait;
+
+  lock_acquire (&cur->uthread_lock);
+  cur->killed = true;
+  must_wait = cur->uthread_cnt > 0;
+  lock_release (&cur->uthread_lock);
+
+  if (must_wait)
+    {
+      futex_wake_process (cur);
+      sema_down (&cur->uthreads_done);
+    }
+
+  while (!list_empty (&cur->uthread_list))
+    free (list_entry (list_pop_front (&cur->uthread_list),
+                      struct uthread, elem));
+}
+
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -357,8 +729,6 @@ load (const char *file_name, void (**eip) (void), void **esp, char** save_ptr)
 
 /* load() helpers. */
 
-static bool install_page (void *upage, void *kpage, bool writable);
-
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
 static bool
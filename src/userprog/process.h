@@ -9,4 +9,11 @@ int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 
+tid_t process_thread_create (void *eip, void *func, void *aux);
+void process_thread_exit (int status) NO_RETURN;
+int process_thread_join (tid_t);
+void process_kill (int status);
+bool process_killed (void);
+void process_check_killed (void);
+
 #endif /* userprog/process.h */
@@ -1,21 +1,30 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "userprog/futex.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include <user/syscall.h>
 #include "devices/input.h"
 #include "devices/shutdown.h"
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 
 static void syscall_handler (struct intr_frame *);
-int add_file (struct file *file_name);
+
+/* Cache of struct process_file. */
+static struct kmem_cache *process_file_cache;
+int add_file (struct file *file_name, struct dir *dir);
 void get_args (struct intr_frame *f, int *arg, int num_of_args);
 void syscall_halt (void);
 pid_t syscall_exec(const char* cmdline);
@@ -29,31 +38,40 @@ int syscall_write (int filedes, const void * buffer, unsigned byte_size);
 void syscall_seek (int filedes, unsigned new_position);
 unsigned syscall_tell(int fildes);
 void syscall_close(int filedes);
+bool syscall_chdir (const char *dir);
+bool syscall_mkdir (const char *dir);
+bool syscall_readdir (int filedes, char *name);
+bool syscall_isdir (int filedes);
+int syscall_inumber (int filedes);
+static struct process_file *get_process_file (int filedes);
 void validate_ptr (const void* vaddr);
 void validate_str (const void* str);
 void validate_buffer (const void* buf, unsigned byte_size);
-
-bool file_lock_init = false;
+int32_t *get_futex_ptr (const void *uaddr);
 
 void
 syscall_init (void) 
 {
+  lock_init (&file_system_lock);
+  lock_set_name (&file_system_lock, "file_system_lock");
+  process_file_cache = kmem_cache_create ("process_file",
+                                          sizeof (struct process_file), NULL);
+  if (process_file_cache == NULL)
+    PANIC ("cannot create process_file cache");
+  futex_init ();
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
-  if(!file_lock_init)
-  {
-    lock_init(&file_system_lock);
-    file_lock_init = true;
-  }
-
   int arg[3];
   int esp = getpage_ptr((const void *) f->esp);
+  int syscall_no = * (int *) esp;
 
-  switch(* (int *) esp)
+  TRACE (TRACE_SYSCALL_ENTER, syscall_no, 0);
+  process_check_killed ();
+  switch(syscall_no)
   {
     case SYS_HALT:
       syscall_halt();
@@ -132,12 +150,67 @@ syscall_handler (struct intr_frame *f UNUSED)
       syscall_close(arg[0]);
       break;
 
+    case SYS_CHDIR:
+      get_args(f, &arg[0], 1);
+      validate_str((const void*)arg[0]);
+      arg[0] = getpage_ptr((const void *)arg[0]);
+      f->eax = syscall_chdir((const char *)arg[0]);
+      break;
+
+    case SYS_MKDIR:
+      get_args(f, &arg[0], 1);
+      validate_str((const void*)arg[0]);
+      arg[0] = getpage_ptr((const void *)arg[0]);
+      f->eax = syscall_mkdir((const char *)arg[0]);
+      break;
+
+    case SYS_READDIR:
+      get_args(f, &arg[0], 2);
+      validate_buffer((const void*)arg[1], READDIR_MAX_LEN + 1);
+      f->eax = syscall_readdir(arg[0], (char *) arg[1]);
+      break;
+
+    case SYS_ISDIR:
+      get_args(f, &arg[0], 1);
+      f->eax = syscall_isdir(arg[0]);
+      break;
+
+    case SYS_INUMBER:
+      get_args(f, &arg[0], 1);
+      f->eax = syscall_inumber(arg[0]);
+      break;
+
+    case SYS_FUTEX_WAIT:
+      get_args(f, &arg[0], 2);
+      f->eax = futex_wait(get_futex_ptr((const void *) arg[0]), arg[1]);
+      break;
+
+    case SYS_FUTEX_WAKE:
+      get_args(f, &arg[0], 2);
+      f->eax = futex_wake(get_futex_ptr((const void *) arg[0]), arg[1]);
+      break;
+
+    case SYS_THREAD_CREATE:
+      get_args(f, &arg[0], 3);
+      f->eax = process_thread_create((void *) arg[0], (void *) arg[1],
+                                     (void *) arg[2]);
+      break;
+
+    case SYS_THREAD_EXIT:
+      get_args(f, &arg[0], 1);
+      process_thread_exit(arg[0]);
+      break;
+
+    case SYS_THREAD_JOIN:
+      get_args(f, &arg[0], 1);
+      f->eax = process_thread_join(arg[0]);
+      break;
+
     default:
       break;
   }
-
-  printf ("system call!\n");
-  thread_exit ();
+  TRACE (TRACE_SYSCALL_EXIT, syscall_no, f->eax);
+  process_check_killed ();
 }
 
 /* halt */
@@ -165,6 +238,14 @@ void
 syscall_exit (int status)
 {
 	struct thread *cur = thread_current();
+
+	/* In a thread other than the main one, take the whole process
+	   down; the main thread reports the exit. */
+	if (cur->leader != cur)
+	{
+		process_kill(status);
+		thread_exit();
+	}
 	if (is_thread_alive(cur->parent) && cur->cp)
 	{
 		if (status < 0)
@@ -233,12 +314,20 @@ syscall_open (const char *file)
 {
 	lock_acquire(&file_system_lock);
 	struct file *file_ptr = filesys_open(file);
-	if (!file_ptr)
+	struct dir *dir_ptr = NULL;
+	if (file_ptr && inode_is_dir(file_get_inode(file_ptr)))
+	{
+		/* Directories are read with readdir, not read. */
+		dir_ptr = dir_open(inode_reopen(file_get_inode(file_ptr)));
+		file_close(file_ptr);
+		file_ptr = NULL;
+	}
+	if (!file_ptr && !dir_ptr)
 	{
 		lock_release(&file_system_lock);
 		return ERROR;
 	}
-	int fd = add_file(file_ptr);
+	int fd = add_file(file_ptr, dir_ptr);
 	lock_release(&file_system_lock);
 	return fd;
 }
@@ -355,6 +444,79 @@ syscall_close(int filedes)
   lock_release(&file_system_lock);
 }
 
+/* syscall_chdir */
+bool
+syscall_chdir (const char *dir)
+{
+  lock_acquire(&file_system_lock);
+  bool successful = filesys_chdir(dir);
+  lock_release(&file_system_lock);
+  return successful;
+}
+
+/* syscall_mkdir */
+bool
+syscall_mkdir (const char *dir)
+{
+  lock_acquire(&file_system_lock);
+  bool successful = filesys_mkdir(dir);
+  lock_release(&file_system_lock);
+  return successful;
+}
+
+/* syscall_readdir: NAME is a user address.  The bytes written
+   there may cross into another page, however short the name, so
+   it is copied out a byte at a time. */
+bool
+syscall_readdir (int filedes, char *name)
+{
+  char kernel_name[NAME_MAX + 1];
+  size_t i, len;
+
+  lock_acquire(&file_system_lock);
+  struct process_file *process_file_ptr = get_process_file(filedes);
+  bool successful = (process_file_ptr && process_file_ptr->dir
+                     && dir_readdir(process_file_ptr->dir, kernel_name));
+  lock_release(&file_system_lock);
+  if (successful)
+    {
+      len = strlen(kernel_name);
+      for (i = 0; i <= len; i++)
+        *(char *) getpage_ptr(name + i) = kernel_name[i];
+    }
+  return successful;
+}
+
+/* syscall_isdir */
+bool
+syscall_isdir (int filedes)
+{
+  lock_acquire(&file_system_lock);
+  struct process_file *process_file_ptr = get_process_file(filedes);
+  bool is_dir = process_file_ptr && process_file_ptr->dir;
+  lock_release(&file_system_lock);
+  return is_dir;
+}
+
+/* syscall_inumber */
+int
+syscall_inumber (int filedes)
+{
+  lock_acquire(&file_system_lock);
+  struct process_file *process_file_ptr = get_process_file(filedes);
+  if (!process_file_ptr)
+  {
+    lock_release(&file_system_lock);
+    return ERROR;
+  }
+  struct inode *inode = (process_file_ptr->dir
+                         ? dir_get_inode(process_file_ptr->dir)
+                         : file_get_inode(process_file_ptr->file));
+  int inumber = inode_get_inumber(inode);
+  lock_release(&file_system_lock);
+  return inumber;
+}
+
 
 /* function to check if pointer is valid */
 void
@@ -399,10 +561,21 @@ getpage_ptr(const void *vaddr)
   return (int)ptr;
 }
 
+/* get the kernel address of the futex word at user address
+   UADDR, which must be mapped and 4-byte aligned */
+int32_t *
+get_futex_ptr (const void *uaddr)
+{
+  if ((uintptr_t) uaddr % sizeof (int32_t) != 0)
+    syscall_exit(ERROR);
+  validate_ptr(uaddr);
+  return (int32_t *) getpage_ptr(uaddr);
+}
+
 /* find a child process based on pid */
 struct child_process* find_child_process(int pid)
 {
-  struct thread *t = thread_current();
+  struct thread *t = thread_process();
   struct list_elem *e;
   struct list_elem *next;
   
@@ -423,13 +596,13 @@ void
 remove_child_process (struct child_process *cp)
 {
   list_remove(&cp->elem);
-  free(cp);
+  free_child_process (cp);
 }
 
 /* remove all child processes for a thread */
 void remove_all_child_processes (void) 
 {
-  struct thread *t = thread_current();
+  struct thread *t = thread_process();
   struct list_elem *next;
   struct list_elem *e = list_begin(&t->child_list);
   
@@ -438,32 +611,43 @@ void remove_all_child_processes (void)
     next = list_next(e);
     struct child_process *cp = list_entry(e, struct child_process, elem);
     list_remove(&cp->elem); //remove child process
-    free(cp);
+    free_child_process (cp);
   }
 }
 
-/* add file to file list and return file descriptor of added file*/
+/* add file, or directory DIR if FILE_NAME is null, to file list
+   and return file descriptor of added file*/
 int
-add_file (struct file *file_name)
+add_file (struct file *file_name, struct dir *dir)
 {
-  struct process_file *process_file_ptr = malloc(sizeof(struct process_file));
+  struct process_file *process_file_ptr = kmem_cache_alloc (process_file_cache);
   if (!process_file_ptr)
   {
     return ERROR;
   }
   process_file_ptr->file = file_name;
-  process_file_ptr->fd = thread_current()->file_descr;
-  thread_current()->file_descr++;
-  list_push_back(&thread_current()->file_list, &process_file_ptr->elem);
+  process_file_ptr->dir = dir;
+  process_file_ptr->fd = thread_process()->file_descr;
+  thread_process()->file_descr++;
+  list_push_back(&thread_process()->file_list, &process_file_ptr->elem);
   return process_file_ptr->fd;
   
 }
 
-/* get file that matches file descriptor */
+/* get file that matches file descriptor, or null if it is a
+   directory */
 struct file*
 get_file (int filedes)
 {
-  struct thread *t = thread_current();
+  struct process_file *process_file_ptr = get_process_file(filedes);
+  return process_file_ptr ? process_file_ptr->file : NULL;
+}
+
+/* get file list entry that matches file descriptor */
+static struct process_file *
+get_process_file (int filedes)
+{
+  struct thread *t = thread_process();
   struct list_elem* next;
   struct list_elem* e = list_begin(&t->file_list);
   
@@ -473,7 +657,7 @@ get_file (int filedes)
     struct process_file *process_file_ptr = list_entry(e, struct process_file, elem);
     if (filedes == process_file_ptr->fd)
     {
-      return process_file_ptr->file;
+      return process_file_ptr;
     }
   }
   return NULL; // nothing found
@@ -484,7 +668,7 @@ get_file (int filedes)
 void
 process_close_file (int fdiptor)
 {
-  struct thread *t = thread_current();
+  struct thread *t = thread_process();
   struct list_elem *next;
   struct list_elem *e = list_begin(&t->file_list);
   
@@ -495,8 +679,9 @@ process_close_file (int fdiptor)
     if (fdiptor == process_file_ptr->fd || fdiptor == CLOSE_ALL_FD)
     {
       file_close(process_file_ptr->file);
+      dir_close(process_file_ptr->dir);
       list_remove(&process_file_ptr->elem);
-      free(process_file_ptr);
+      kmem_cache_free (process_file_cache, process_file_ptr);
       if (fdiptor != CLOSE_ALL_FD)
       {
         return;
@@ -25,7 +25,8 @@ struct child_process {
 };
 
 struct process_file {
-    struct file *file;
+    struct file *file;          /* Open file, or null for a directory. */
+    struct dir *dir;            /* Open directory, or null for a file. */
     int fd;
     struct list_elem elem;
 };
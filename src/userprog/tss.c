@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
+#include "threads/cpu.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -72,35 +73,45 @@ struct tss
     uint16_t trace, bitmap;
   };
 
-/* Kernel TSS. */
-static struct tss *tss;
+/* Kernel TSS of each CPU.  Each CPU needs its own, because each
+   runs a different thread on a different kernel stack. */
+static struct tss *tss[CPU_MAX];
 
-/* Initializes the kernel TSS. */
+/* Initializes a kernel TSS for each CPU that cpu_init() found. */
 void
 tss_init (void) 
 {
+  int i;
+
   /* Our TSS is never used in a call gate or task gate, so only a
      few fields of it are ever referenced, and those are the only
      ones we initialize. */
-  tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-  tss->ss0 = SEL_KDSEG;
-  tss->bitmap = 0xdfff;
+  for (i = 0; i < cpu_found_cnt; i++)
+    {
+      tss[i] = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      tss[i]->ss0 = SEL_KDSEG;
+      tss[i]->bitmap = 0xdfff;
+    }
   tss_update ();
 }
 
-/* Returns the kernel TSS. */
+/* Returns the kernel TSS of the CPU with the given ID, or a null
+   pointer if there is no such CPU. */
 struct tss *
-tss_get (void) 
+tss_get (int cpu_id) 
 {
-  ASSERT (tss != NULL);
-  return tss;
+  ASSERT (cpu_id >= 0 && cpu_id < CPU_MAX);
+  return tss[cpu_id];
 }
 
-/* Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+/* Sets the ring 0 stack pointer in the running CPU's TSS to
+   point to the end of the thread stack.  Interrupts must be
+   off. */
 void
 tss_update (void) 
 {
-  ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  struct tss *t = tss[cpu_current ()->id];
+
+  ASSERT (t != NULL);
+  t->esp0 = (uint8_t *) thread_current () + PGSIZE;
 }